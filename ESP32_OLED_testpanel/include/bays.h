@@ -0,0 +1,22 @@
+#ifndef bays_h
+#define bays_h
+
+#include <bayLayout.h>
+
+/*
+the bays on this panel, one line per bay. the fleet table, the buttons
+and the mqtt topics are all sized from this list, so adding a line is
+all that is needed for a bigger car park
+*/
+constexpr BayDescription BAY_LAYOUT[] = {
+    BAY(19, 1),
+    BAY(5, 2),
+    BAY(17, 3),
+};
+
+constexpr int BAY_COUNT = sizeof(BAY_LAYOUT) / sizeof(BAY_LAYOUT[0]);
+
+// the OLED has room for this many bays
+constexpr int DISPLAY_BAYS = BAY_COUNT < 3 ? BAY_COUNT : 3;
+
+#endif
@@ -0,0 +1,120 @@
+#include <adcFilter.h>
+
+AdcFilter::AdcFilter()
+	: next(0), filled(0), smooth(0), held(0), settings(ADC_FILTER_DEFAULTS), low_end(0), high_end(ADC_MAX), output(0)
+{
+	begin(ADC_UNCALIBRATED, ADC_FILTER_DEFAULTS);
+}
+
+void AdcFilter::begin(const AdcCalibration &calibration, const AdcFilterSettings &settings)
+{
+	this->settings = settings;
+	next = 0;
+	filled = 0;
+	smooth = 0;
+	held = 0;
+	output = 0;
+
+	// the division of the calibration and the scaling is done here, once per entry
+	long low = calibration.raw_low;
+	long high = calibration.raw_high > calibration.raw_low ? calibration.raw_high : calibration.raw_low + 1;
+	for (int i = 0; i < ADC_LUT_SIZE; i++)
+	{
+		long raw = long(i) * ADC_LUT_STEP;
+		if (raw <= low)
+		{
+			lut[i] = 0;
+		}
+		else if (raw >= high)
+		{
+			lut[i] = settings.full_scale;
+		}
+		else
+		{
+			lut[i] = ((raw - low) * settings.full_scale + (high - low) / 2) / (high - low);
+		}
+	}
+	low_end = int(low);
+	high_end = int(high);
+}
+
+uint16_t AdcFilter::median() const
+{
+	// insertion sort of a copy, the window is only a few samples
+	uint16_t sorted[ADC_MEDIAN_WINDOW];
+	for (int i = 0; i < filled; i++)
+	{
+		uint16_t sample = window[i];
+		int j = i;
+		while (j > 0 && sorted[j - 1] > sample)
+		{
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = sample;
+	}
+	return sorted[filled / 2];
+}
+
+long AdcFilter::lookup(int reading) const
+{
+	// the ends are exact, so the low end of the potentiometer always gives 0
+	if (reading <= low_end)
+	{
+		return 0;
+	}
+	if (reading >= high_end)
+	{
+		return settings.full_scale;
+	}
+	int index = reading >> ADC_LUT_SHIFT;
+	int32_t fraction = reading & (ADC_LUT_STEP - 1);
+	int32_t step = lut[index + 1] - lut[index];
+	return lut[index] + (step * fraction + ADC_LUT_STEP / 2) / ADC_LUT_STEP;
+}
+
+void AdcFilter::add(uint16_t raw)
+{
+	if (raw > ADC_MAX)
+	{
+		raw = ADC_MAX;
+	}
+	window[next] = raw;
+	next = (next + 1) % ADC_MEDIAN_WINDOW;
+	bool first = filled == 0;
+	if (filled < ADC_MEDIAN_WINDOW)
+	{
+		filled++;
+	}
+
+	int32_t target = int32_t(median()) << 16;
+	if (first)
+	{
+		smooth = target;
+	}
+	else
+	{
+		smooth += (target - smooth) / (1 << settings.iir_shift);
+	}
+
+	int filtered = int((smooth + 0x8000) >> 16);
+	int last = held;
+	bool end = (filtered <= low_end) != (held <= low_end) || (filtered >= high_end) != (held >= high_end);
+	if (first || end)
+	{
+		held = filtered;
+	}
+	// held trails the filtered value by the hysteresis, so noise must span twice it to move it
+	else if (filtered > held + settings.hysteresis)
+	{
+		held = filtered - settings.hysteresis;
+	}
+	else if (filtered < held - settings.hysteresis)
+	{
+		held = filtered + settings.hysteresis;
+	}
+	if (first || held != last)
+	{
+		output = lookup(held);
+	}
+}
@@ -0,0 +1,84 @@
+#ifndef adcFilter_h
+#define adcFilter_h
+
+#include <stdint.h>
+
+// the ESP32 ADC gives 12 bit readings
+const int ADC_MAX = 4095;
+
+// raw samples the median is taken over, odd
+const int ADC_MEDIAN_WINDOW = 7;
+
+// the lookup table has an entry every ADC_LUT_STEP readings, the values between are interpolated
+const int ADC_LUT_SHIFT = 4;
+const int ADC_LUT_STEP = 1 << ADC_LUT_SHIFT;
+const int ADC_LUT_SIZE = (ADC_MAX + 1) / ADC_LUT_STEP + 1;
+
+/*
+What the ADC reads at the two ends of the potentiometer. The ESP32 ADC
+does not reach 0 and 4095 at the ends of its range, and what it reads
+there differs between boards, so the ends are measured once per panel.
+Readings outside them are taken as the end.
+*/
+struct AdcCalibration
+{
+	uint16_t raw_low;
+	uint16_t raw_high;
+};
+
+const AdcCalibration ADC_UNCALIBRATED = {0, ADC_MAX};
+
+struct AdcFilterSettings
+{
+	int iir_shift;      // the IIR moves 1/2^iir_shift of the way to each median
+	int hysteresis;     // readings the output trails the filtered value by
+	long full_scale;    // output at the high end, e.g. watts of grid load
+};
+
+const AdcFilterSettings ADC_FILTER_DEFAULTS = {6, 5, 15000};
+
+/*
+Turns noisy raw ADC samples into a stable value in 0..full_scale:
+
+  median of the last ADC_MEDIAN_WINDOW samples, drops short spikes
+  IIR low-pass in fixed point, smooths the noise that is left
+  hysteresis, holds the output while the value wanders by a few counts,
+             but always follows it to the ends
+  lookup table, calibration and scaling in one step
+
+add() is called for every sample, from the sampler; value() only reads
+the last output, so the control loop pays nothing for the filtering.
+*/
+class AdcFilter
+{
+private:
+	uint16_t window[ADC_MEDIAN_WINDOW]; // ring of the last raw samples
+	int next;                           // slot of the next sample
+	int filled;
+	int32_t smooth; // IIR state, readings with 16 fraction bits
+	int held;       // filtered reading the output is taken from
+	AdcFilterSettings settings;
+	int32_t lut[ADC_LUT_SIZE];
+	int low_end;  // readings at or below give 0
+	int high_end; // readings at or above give full_scale
+	volatile long output;
+
+	uint16_t median() const;
+	long lookup(int reading) const;
+
+public:
+	AdcFilter();
+
+	// builds the lookup table and starts again without samples
+	void begin(const AdcCalibration &calibration, const AdcFilterSettings &settings);
+
+	void add(uint16_t raw);
+
+	// 0..full_scale, 0 before the first sample
+	long value() const { return output; }
+
+	// the filtered reading before the lookup, for calibrating
+	int reading() const { return held; }
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include <adcSampler.h>
+
+AdcSampler::AdcSampler() : pin(-1), burst(1), timer(NULL), samples(0)
+{
+}
+
+void AdcSampler::on_timer(void *self)
+{
+	AdcSampler *sampler = static_cast<AdcSampler *>(self);
+	for (int i = 0; i < sampler->burst; i++)
+	{
+		sampler->filter.add(uint16_t(analogRead(sampler->pin)));
+	}
+	sampler->samples += sampler->burst;
+}
+
+void AdcSampler::begin(int pin, const AdcCalibration &calibration, const AdcFilterSettings &settings,
+					   unsigned long period_us, int burst)
+{
+	this->pin = pin;
+	this->burst = burst < 1 ? 1 : burst;
+	filter.begin(calibration, settings);
+	// the value is there before the first tick of the loop
+	on_timer(this);
+
+	esp_timer_create_args_t args = {};
+	args.callback = on_timer;
+	args.arg = this;
+	args.dispatch_method = ESP_TIMER_TASK;
+	args.name = "adc";
+	// a late sample is just skipped, not made up for
+	args.skip_unhandled_events = true;
+	esp_timer_create(&args, &timer);
+	esp_timer_start_periodic(timer, period_us);
+}
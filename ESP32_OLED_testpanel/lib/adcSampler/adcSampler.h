@@ -0,0 +1,46 @@
+#ifndef adcSampler_h
+#define adcSampler_h
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <adcFilter.h>
+
+/*
+Reads an analog pin at a fixed rate from an esp_timer and runs every
+sample through an AdcFilter. The loop only reads the filtered value,
+it no longer calls analogRead() or map() itself.
+
+The timer callback runs in the esp_timer task, not in an interrupt, so
+analogRead() is allowed there.
+*/
+class AdcSampler
+{
+private:
+	AdcFilter filter;
+	int pin;
+	int burst;
+	esp_timer_handle_t timer;
+	volatile unsigned long samples;
+
+	static void on_timer(void *self);
+
+public:
+	AdcSampler();
+
+	/*
+	takes the first samples at once, then "burst" samples back to back every
+	period_us. A long period with a burst lets the chip sleep in between
+	*/
+	void begin(int pin, const AdcCalibration &calibration, const AdcFilterSettings &settings,
+			   unsigned long period_us, int burst = 1);
+
+	// the filtered value, 0..full_scale of the settings
+	long value() const { return filter.value(); }
+
+	// the filtered raw reading, to find the calibration of a panel
+	int reading() const { return filter.reading(); }
+
+	unsigned long get_samples() const { return samples; }
+};
+
+#endif
@@ -0,0 +1,49 @@
+#include <bitDebouncer.h>
+
+BitDebouncer::BitDebouncer()
+{
+	const uint32_t high[DEBOUNCE_WORDS] = {0xFFFFFFFF, 0xFFFFFFFF};
+	reset(high);
+}
+
+void BitDebouncer::reset(const uint32_t raw[DEBOUNCE_WORDS])
+{
+	for (int w = 0; w < DEBOUNCE_WORDS; w++)
+	{
+		state[w] = raw[w];
+		count0[w] = 0;
+		count1[w] = 0;
+	}
+}
+
+void BitDebouncer::sample(const uint32_t raw[DEBOUNCE_WORDS], uint32_t fell[DEBOUNCE_WORDS],
+						  uint32_t rose[DEBOUNCE_WORDS])
+{
+	for (int w = 0; w < DEBOUNCE_WORDS; w++)
+	{
+		uint32_t differs = raw[w] ^ state[w];
+
+		// counts up where the input differs, back to 0 where it agrees
+		count1[w] = (count1[w] ^ count0[w]) & differs;
+		count0[w] = ~count0[w] & differs;
+
+		// a counter at 3 (both bits) flips the state and starts again
+		uint32_t flip = count0[w] & count1[w];
+		count0[w] &= ~flip;
+		count1[w] &= ~flip;
+		state[w] ^= flip;
+
+		fell[w] = flip & ~state[w];
+		rose[w] = flip & state[w];
+	}
+}
+
+bool BitDebouncer::settled() const
+{
+	uint32_t counting = 0;
+	for (int w = 0; w < DEBOUNCE_WORDS; w++)
+	{
+		counting |= count0[w] | count1[w];
+	}
+	return counting == 0;
+}
@@ -0,0 +1,47 @@
+#ifndef bitDebouncer_h
+#define bitDebouncer_h
+
+#include <stdint.h>
+
+// all GPIO pins of the ESP32 fit in two 32 bit words, GPIO_IN_REG and GPIO_IN1_REG
+const int DEBOUNCE_WORDS = 2;
+
+// samples in a row that must differ from the steady state before it changes
+const int DEBOUNCE_SAMPLES = 3;
+
+/*
+Debounces every input of the GPIO words at once with vertical counters:
+bit n of count0 and count1 is a 2 bit counter for input n. A counter
+counts the samples in a row where the input differs from its steady
+state and is cleared by a sample that agrees. When it gets to
+DEBOUNCE_SAMPLES the steady state of that input flips.
+
+One sample is a few bitwise operations per word, the same for one input
+as for all of them.
+*/
+class BitDebouncer
+{
+private:
+	uint32_t state[DEBOUNCE_WORDS];
+	uint32_t count0[DEBOUNCE_WORDS];
+	uint32_t count1[DEBOUNCE_WORDS];
+
+public:
+	BitDebouncer();
+
+	// takes the inputs as steady, without any changes
+	void reset(const uint32_t raw[DEBOUNCE_WORDS]);
+
+	/*
+	one sample of the inputs. "fell" gets the inputs that became steady
+	low and "rose" the ones that became steady high
+	*/
+	void sample(const uint32_t raw[DEBOUNCE_WORDS], uint32_t fell[DEBOUNCE_WORDS], uint32_t rose[DEBOUNCE_WORDS]);
+
+	// no input is on its way to a new state, so sampling can stop
+	bool settled() const;
+
+	uint32_t steady(int word) const { return state[word]; }
+};
+
+#endif
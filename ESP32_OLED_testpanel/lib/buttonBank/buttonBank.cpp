@@ -0,0 +1,123 @@
+#include <buttonBank.h>
+#include <profiler.h>
+#include <soc/soc.h>
+#include <soc/gpio_reg.h>
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+
+volatile bool ButtonBank::edge = false;
+
+void IRAM_ATTR ButtonBank::on_edge()
+{
+	edge = true;
+}
+
+ButtonBank::ButtonBank() : interval(0), last_sample(0), lost(0)
+{
+	for (int w = 0; w < DEBOUNCE_WORDS; w++)
+	{
+		mask[w] = 0;
+	}
+	for (int pin = 0; pin < DEBOUNCE_WORDS * 32; pin++)
+	{
+		pin_bay[pin] = -1;
+	}
+}
+
+void ButtonBank::read(uint32_t raw[DEBOUNCE_WORDS]) const
+{
+	// the pins that are not bays read as steady high, so they never start a count
+	raw[0] = REG_READ(GPIO_IN_REG) | ~mask[0];
+	raw[1] = REG_READ(GPIO_IN1_REG) | ~mask[1];
+}
+
+void ButtonBank::begin(const BayDescription layout[], int count, unsigned long debounce_ms)
+{
+	for (int i = 0; i < count; i++)
+	{
+		int pin = layout[i].pin;
+		pinMode(pin, INPUT_PULLUP);
+		mask[pin / 32] |= 1UL << (pin % 32);
+		pin_bay[pin] = int8_t(i);
+		attachInterrupt(digitalPinToInterrupt(pin), on_edge, CHANGE);
+	}
+	interval = debounce_ms / DEBOUNCE_SAMPLES;
+
+	uint32_t raw[DEBOUNCE_WORDS];
+	read(raw);
+	debouncer.reset(raw);
+}
+
+void ButtonBank::enable_wakeup()
+{
+	for (int pin = 0; pin < DEBOUNCE_WORDS * 32; pin++)
+	{
+		if (pin_bay[pin] >= 0)
+		{
+			detachInterrupt(digitalPinToInterrupt(pin));
+			gpio_wakeup_enable(gpio_num_t(pin), GPIO_INTR_LOW_LEVEL);
+		}
+	}
+	esp_sleep_enable_gpio_wakeup();
+}
+
+void ButtonBank::queue(uint32_t bits, int word, bool pressed, unsigned long now)
+{
+	while (bits != 0)
+	{
+		ButtonEvent event;
+		event.bay = pin_bay[word * 32 + __builtin_ctz(bits)];
+		event.pressed = pressed;
+		event.time = now;
+		if (!events.push(event))
+		{
+			lost++;
+		}
+		bits &= bits - 1;
+	}
+}
+
+bool ButtonBank::moved(const uint32_t raw[DEBOUNCE_WORDS]) const
+{
+	for (int w = 0; w < DEBOUNCE_WORDS; w++)
+	{
+		if (raw[w] != debouncer.steady(w))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void ButtonBank::poll(unsigned long now)
+{
+	PROFILE_ZONE("button_scan");
+	uint32_t raw[DEBOUNCE_WORDS];
+	if (!edge && debouncer.settled())
+	{
+		read(raw);
+		if (!moved(raw))
+		{
+			return;
+		}
+	}
+	if (now - last_sample < interval)
+	{
+		return;
+	}
+	last_sample = now;
+
+	// cleared before the read, so an edge after it starts the next sample
+	edge = false;
+	read(raw);
+
+	uint32_t fell[DEBOUNCE_WORDS];
+	uint32_t rose[DEBOUNCE_WORDS];
+	debouncer.sample(raw, fell, rose);
+	for (int w = 0; w < DEBOUNCE_WORDS; w++)
+	{
+		// the buttons pull the pins low
+		queue(fell[w], w, true, now);
+		queue(rose[w], w, false, now);
+	}
+}
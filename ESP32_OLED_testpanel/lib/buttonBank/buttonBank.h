@@ -0,0 +1,74 @@
+#ifndef buttonBank_h
+#define buttonBank_h
+
+#include <Arduino.h>
+#include <bayLayout.h>
+#include <bitDebouncer.h>
+#include <spscRing.h>
+
+struct ButtonEvent
+{
+	int bay;            // index in the layout
+	bool pressed;       // pressed, or let go
+	unsigned long time; // millis() of the sample that settled it
+};
+
+/*
+The buttons of all bays, wired to ground with the internal pull-ups like
+ezButton. An edge interrupt on any bay pin starts sampling, and every
+sample reads all pins with one read of each GPIO input register and
+debounces them together with BitDebouncer. While no button moves, poll()
+only checks a flag and compares the pins with their steady state, which
+also catches an edge the interrupt missed.
+
+The cost of a sample does not depend on the number of bays, only the
+events that come out of it are looked up per bay.
+*/
+class ButtonBank
+{
+private:
+	// set by the edge interrupt, cleared when a sample is taken
+	static volatile bool edge;
+	static void IRAM_ATTR on_edge();
+
+	BitDebouncer debouncer;
+	uint32_t mask[DEBOUNCE_WORDS]; // the bay pins
+	int8_t pin_bay[DEBOUNCE_WORDS * 32];
+	unsigned long interval;
+	unsigned long last_sample;
+	SpscRing<ButtonEvent, 16> events;
+	unsigned long lost;
+
+	void read(uint32_t raw[DEBOUNCE_WORDS]) const;
+	bool moved(const uint32_t raw[DEBOUNCE_WORDS]) const;
+	void queue(uint32_t bits, int word, bool pressed, unsigned long now);
+
+public:
+	ButtonBank();
+
+	// sets up the pins of the layout, a press must be steady for about debounce_ms
+	void begin(const BayDescription layout[], int count, unsigned long debounce_ms);
+
+	// samples the pins if a button has moved, call it from loop()
+	void poll(unsigned long now);
+
+	/*
+	lets a pressed button wake the chip from light sleep. The ESP32 can
+	only do that on a level, and the wake-up level replaces the edge
+	interrupt of the pin, so the interrupts are taken off and poll() finds
+	the presses by comparing the pins
+	*/
+	void enable_wakeup();
+
+	// a button is on its way to a new state, poll() must be called every get_interval() ms
+	bool busy() const { return edge || !debouncer.settled(); }
+	unsigned long get_interval() const { return interval; }
+
+	// the next press or release, false if there is none
+	bool next(ButtonEvent &event) { return events.pop(event); }
+
+	// events that did not fit in the queue
+	unsigned long get_lost() const { return lost; }
+};
+
+#endif
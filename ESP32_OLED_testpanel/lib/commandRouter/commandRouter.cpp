@@ -0,0 +1,126 @@
+#include <commandRouter.h>
+#include <limits.h>
+#include <string.h>
+
+bool TextView::equals(const char *text) const
+{
+	return strlen(text) == length && memcmp(data, text, length) == 0;
+}
+
+bool TextView::to_long(long &value) const
+{
+	size_t i = 0;
+	bool negative = length > 0 && data[0] == '-';
+	if (negative)
+	{
+		i++;
+	}
+	if (i == length)
+	{
+		return false;
+	}
+	long result = 0;
+	for (; i < length; i++)
+	{
+		if (data[i] < '0' || data[i] > '9')
+		{
+			return false;
+		}
+		int digit = data[i] - '0';
+		if (result > (LONG_MAX - digit) / 10)
+		{
+			return false;
+		}
+		result = result * 10 + digit;
+	}
+	value = negative ? -result : result;
+	return true;
+}
+
+bool match_topic(const char *pattern, const char *topic, RouteMatch &match)
+{
+	match.captures = 0;
+	const char *p = pattern;
+	const char *t = topic;
+	while (true)
+	{
+		// the rest of the topic, whatever it is
+		if (*p == '#')
+		{
+			return true;
+		}
+		if (*p == '+')
+		{
+			const char *start = t;
+			while (*t != '\0' && *t != '/')
+			{
+				t++;
+			}
+			if (match.captures < ROUTE_CAPTURES)
+			{
+				match.capture[match.captures].data = start;
+				match.capture[match.captures].length = size_t(t - start);
+				match.captures++;
+			}
+			p++;
+		}
+		else
+		{
+			while (*p != '\0' && *p != '/')
+			{
+				if (*p != *t)
+				{
+					return false;
+				}
+				p++;
+				t++;
+			}
+			if (*t != '\0' && *t != '/')
+			{
+				return false;
+			}
+		}
+
+		// both are at the end of a level
+		if (*p == '\0')
+		{
+			return *t == '\0';
+		}
+		if (*t == '\0')
+		{
+			// "a/#" takes "a" too
+			return strcmp(p, "/#") == 0;
+		}
+		p++;
+		t++;
+	}
+}
+
+CommandRouter::CommandRouter(const CommandRoute *routes, int count)
+	: routes(routes), count(count), routed(0), unmatched(0)
+{
+}
+
+int CommandRouter::route(const char *topic, const uint8_t *payload, size_t length)
+{
+	TextView view = {reinterpret_cast<const char *>(payload), length};
+	RouteMatch match;
+	int handled = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (match_topic(routes[i].pattern, topic, match))
+		{
+			routes[i].handler(match, view);
+			handled++;
+		}
+	}
+	if (handled == 0)
+	{
+		unmatched++;
+	}
+	else
+	{
+		routed++;
+	}
+	return handled;
+}
@@ -0,0 +1,81 @@
+#ifndef commandRouter_h
+#define commandRouter_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// all commands to the panel are published under this prefix
+#define INPUT_PREFIX "esp32/input"
+
+// full command topic as one string literal, like TOPIC() for the output
+#define INPUT_TOPIC(name) INPUT_PREFIX "/" name
+
+// subscribing to this gets every command topic, "esp32/input" too
+#define INPUT_SUBSCRIPTION INPUT_PREFIX "/#"
+
+/*
+A piece of a buffer that belongs to someone else, e.g. the payload
+PubSubClient hands the callback. It is not copied and not NUL terminated,
+so it is only valid while the callback runs.
+*/
+struct TextView
+{
+	const char *data;
+	size_t length;
+
+	bool equals(const char *text) const;
+
+	// true if the whole view is a decimal number that fits in a long
+	bool to_long(long &value) const;
+};
+
+const int ROUTE_CAPTURES = 2;
+
+// the levels of the topic the "+" of a pattern stood for, in order
+struct RouteMatch
+{
+	int captures;
+	TextView capture[ROUTE_CAPTURES];
+};
+
+typedef void (*CommandHandler)(const RouteMatch &match, const TextView &payload);
+
+/*
+one line of the command table. the pattern is an MQTT topic filter: "+"
+stands for one level and a "#" at the end for any number of levels, none
+too, so "esp32/input/#" also takes "esp32/input"
+*/
+struct CommandRoute
+{
+	const char *pattern;
+	CommandHandler handler;
+};
+
+// true if the topic is matched by the pattern, the "+" levels end up in match
+bool match_topic(const char *pattern, const char *topic, RouteMatch &match);
+
+/*
+Hands the messages on the command topics to the handlers of a static
+table. Every route that matches is called, in the order of the table.
+Nothing is copied or allocated, the handlers get views into the topic and
+the payload.
+*/
+class CommandRouter
+{
+private:
+	const CommandRoute *routes;
+	int count;
+	unsigned long routed;
+	unsigned long unmatched;
+
+public:
+	CommandRouter(const CommandRoute *routes, int count);
+
+	// calls the handlers of the topic, returns how many there were
+	int route(const char *topic, const uint8_t *payload, size_t length);
+
+	unsigned long get_routed() const { return routed; }
+	unsigned long get_unmatched() const { return unmatched; }
+};
+
+#endif
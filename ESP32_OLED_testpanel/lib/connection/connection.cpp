@@ -0,0 +1,129 @@
+#include <connection.h>
+
+Backoff::Backoff(unsigned long first_ms, unsigned long longest_ms)
+	: first(first_ms), longest(longest_ms), current(first_ms), state(1)
+{
+}
+
+void Backoff::seed(uint32_t seed)
+{
+	// xorshift gets stuck at 0
+	state = seed == 0 ? 1 : seed;
+}
+
+void Backoff::reset()
+{
+	current = first;
+}
+
+unsigned long Backoff::next()
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	unsigned long half = current / 2;
+	unsigned long wait = current - half + state % (half + 1);
+	current = current >= longest / 2 ? longest : current * 2;
+	return wait;
+}
+
+ConnectionManager::ConnectionManager(const LinkDriver &link_driver, const LinkSettings &link_settings)
+	: driver(link_driver), settings(link_settings), backoff(link_settings.first_retry, link_settings.longest_retry),
+	  state(LINK_WIFI_JOINING), since(0), wait(0), attempts(0)
+{
+}
+
+void ConnectionManager::enter(LinkState next, unsigned long now, unsigned long wait_ms)
+{
+	state = next;
+	since = now;
+	wait = wait_ms;
+}
+
+void ConnectionManager::begin(unsigned long now, uint32_t seed)
+{
+	backoff.seed(seed);
+	backoff.reset();
+	driver.wifi_begin();
+	enter(LINK_WIFI_JOINING, now, 0);
+}
+
+LinkState ConnectionManager::poll(unsigned long now)
+{
+	switch (state)
+	{
+	case LINK_CONNECTED:
+		if (!driver.mqtt_connected())
+		{
+			// the network reconnects by itself, so a lost network is only waited for
+			if (driver.wifi_connected())
+			{
+				enter(LINK_MQTT_WAIT, now, backoff.next());
+			}
+			else
+			{
+				enter(LINK_WIFI_JOINING, now, 0);
+			}
+		}
+		break;
+
+	case LINK_WIFI_JOINING:
+		if (driver.wifi_connected())
+		{
+			// the broker is tried at once on a new network
+			enter(LINK_MQTT_WAIT, now, 0);
+		}
+		else if (now - since >= settings.join_timeout)
+		{
+			driver.wifi_disconnect();
+			enter(LINK_WIFI_WAIT, now, backoff.next());
+		}
+		break;
+
+	case LINK_WIFI_WAIT:
+		if (now - since >= wait)
+		{
+			driver.wifi_begin();
+			enter(LINK_WIFI_JOINING, now, 0);
+		}
+		break;
+
+	case LINK_MQTT_WAIT:
+		if (!driver.wifi_connected())
+		{
+			enter(LINK_WIFI_JOINING, now, 0);
+		}
+		else if (now - since >= wait)
+		{
+			attempts++;
+			if (driver.mqtt_connect())
+			{
+				backoff.reset();
+				enter(LINK_CONNECTED, now, 0);
+			}
+			else
+			{
+				enter(LINK_MQTT_WAIT, now, backoff.next());
+			}
+		}
+		break;
+	}
+	return state;
+}
+
+const char *link_state_name(LinkState state)
+{
+	switch (state)
+	{
+	case LINK_WIFI_JOINING:
+		return "joining wifi";
+	case LINK_WIFI_WAIT:
+		return "waiting for wifi";
+	case LINK_MQTT_WAIT:
+		return "waiting for mqtt";
+	case LINK_CONNECTED:
+		return "connected";
+	}
+	return "unknown";
+}
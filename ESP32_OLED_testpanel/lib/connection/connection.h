@@ -0,0 +1,135 @@
+#ifndef connection_h
+#define connection_h
+
+#include <stdint.h>
+
+/*
+What the connection needs from the board. All of them return at once,
+except mqtt_connect which can block for the TCP connect timeout of the
+client and the MQTT socket timeout.
+*/
+struct LinkDriver
+{
+	void (*wifi_begin)();      // starts joining the network
+	void (*wifi_disconnect)(); // gives up a join that takes too long
+	bool (*wifi_connected)();
+	bool (*mqtt_connect)(); // one attempt, subscribes if it is connected
+	bool (*mqtt_connected)();
+};
+
+/*
+Exponential backoff with jitter. The delay starts at "first" and doubles
+up to "longest", and every wait is a random time between half and all of
+the delay, so panels that lost the broker at the same time do not all
+come back at the same time.
+*/
+class Backoff
+{
+private:
+	unsigned long first;
+	unsigned long longest;
+	unsigned long current;
+	uint32_t state;
+
+public:
+	Backoff(unsigned long first_ms, unsigned long longest_ms);
+
+	// the seed should be different on every board, e.g. esp_random()
+	void seed(uint32_t seed);
+	// starts again from the first delay
+	void reset();
+	// ms to wait before the next attempt
+	unsigned long next();
+};
+
+enum LinkState
+{
+	LINK_WIFI_JOINING, // waiting for the network
+	LINK_WIFI_WAIT,    // the join timed out, waiting before joining again
+	LINK_MQTT_WAIT,    // on the network, waiting before the next broker attempt
+	LINK_CONNECTED,
+};
+
+// all in ms
+struct LinkSettings
+{
+	unsigned long join_timeout;  // a join that takes longer is started again
+	unsigned long first_retry;   // the first wait of the backoff
+	unsigned long longest_retry; // the longest wait of the backoff
+};
+
+const LinkSettings LINK_DEFAULTS = {10000, 500, 30000};
+
+/*
+Keeps Wi-Fi and MQTT connected without blocking the loop. poll() is
+called every loop and takes at most one step, so the buttons, the
+control tick and the display keep running while the link is down.
+*/
+class ConnectionManager
+{
+private:
+	const LinkDriver &driver;
+	LinkSettings settings;
+	Backoff backoff;
+	LinkState state;
+	unsigned long since; // when the current state was entered
+	unsigned long wait;  // how long to stay in a wait state
+	unsigned long attempts;
+
+	void enter(LinkState next, unsigned long now, unsigned long wait_ms);
+
+public:
+	ConnectionManager(const LinkDriver &link_driver, const LinkSettings &link_settings = LINK_DEFAULTS);
+
+	// starts joining the network
+	void begin(unsigned long now, uint32_t seed);
+	// one step, returns the state after it
+	LinkState poll(unsigned long now);
+
+	bool connected() const { return state == LINK_CONNECTED; }
+	LinkState get_state() const { return state; }
+	// broker attempts since begin
+	unsigned long get_attempts() const { return attempts; }
+};
+
+const char *link_state_name(LinkState state);
+
+/*
+The longest and the mean of a time in µs since the last reset, e.g. how
+long loop() can be held up while the link is down. start/stop time a
+piece of code, add takes a time measured some other way.
+*/
+class LoopTimer
+{
+private:
+	unsigned long started;
+	unsigned long worst;
+	unsigned long total;
+	unsigned long count;
+
+public:
+	LoopTimer() { reset(); }
+
+	void reset()
+	{
+		started = 0;
+		worst = 0;
+		total = 0;
+		count = 0;
+	}
+	void start(unsigned long now_us) { started = now_us; }
+	void stop(unsigned long now_us) { add(now_us - started); }
+	void add(unsigned long used)
+	{
+		worst = used > worst ? used : worst;
+		total += used;
+		count++;
+	}
+
+	unsigned long longest() const { return worst; }
+	unsigned long mean() const { return count == 0 ? 0 : total / count; }
+	unsigned long loops() const { return count; }
+	unsigned long sum() const { return total; }
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include <deviceId.h>
+#include <stdio.h>
+#include <string.h>
+
+DeviceId::DeviceId() : prefix_length(0)
+{
+	name[0] = '\0';
+	client_id[0] = '\0';
+	prefix[0] = '\0';
+}
+
+bool DeviceId::begin(const char *site, const char *kind, uint64_t mac)
+{
+	// the first byte of the MAC is the lowest byte of the efuse value
+	for (int i = 0; i < 6; i++)
+	{
+		snprintf(name + 2 * i, 3, "%02x", unsigned(mac >> (8 * i)) & 0xFF);
+	}
+
+	// a site with a wildcard or a "/" would not be one level of the topic
+	if (site[0] == '\0' || strpbrk(site, "/+#") != NULL)
+	{
+		return false;
+	}
+	int length = snprintf(client_id, sizeof(client_id), "%s-%s", kind, name);
+	if (length < 0 || size_t(length) >= sizeof(client_id))
+	{
+		return false;
+	}
+	length = snprintf(prefix, sizeof(prefix), "%s/%s/", site, name);
+	if (length < 0 || size_t(length) >= sizeof(prefix))
+	{
+		prefix[0] = '\0';
+		return false;
+	}
+	prefix_length = size_t(length);
+	return true;
+}
+
+bool DeviceId::topic(const char *local, char *out, size_t capacity) const
+{
+	size_t length = strlen(local);
+	if (prefix_length + length >= capacity)
+	{
+		return false;
+	}
+	memcpy(out, prefix, prefix_length);
+	memcpy(out + prefix_length, local, length + 1);
+	return true;
+}
+
+const char *DeviceId::local(const char *topic) const
+{
+	if (prefix_length == 0 || strncmp(topic, prefix, prefix_length) != 0)
+	{
+		return NULL;
+	}
+	return topic + prefix_length;
+}
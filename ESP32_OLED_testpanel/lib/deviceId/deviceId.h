@@ -0,0 +1,59 @@
+#ifndef deviceId_h
+#define deviceId_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Who a device is on the broker. The client id and the topics are made
+from the MAC of the chip, so any number of panels and sensor nodes can
+share one broker without a build per device: two clients with the same
+id throw each other off the broker, and two devices on the same topics
+mix up their data.
+
+Every topic of a device is under "<site>/<name>/", the name is the MAC in
+hex. The topics in the code stay as they were (TOPIC() and INPUT_TOPIC()),
+topic() puts the device in front of them on the way out and local() takes
+it off the commands on the way in. A dashboard subscribes to
+"<site>/+/esp32/output/..." for the whole fleet and tells the devices
+apart by the second level of the topic.
+*/
+
+// "a4cf12b3c4d5" and its '\0'
+const size_t DEVICE_NAME_SIZE = 13;
+// the longest "<kind>-<name>"
+const size_t DEVICE_CLIENT_ID_SIZE = 40;
+// the longest "<site>/<name>/", so a topic with the device in front needs this much more room
+const size_t DEVICE_PREFIX_SIZE = 48;
+
+class DeviceId
+{
+private:
+	char name[DEVICE_NAME_SIZE];
+	char client_id[DEVICE_CLIENT_ID_SIZE];
+	char prefix[DEVICE_PREFIX_SIZE];
+	size_t prefix_length;
+
+public:
+	DeviceId();
+
+	/*
+	the names of the device with the MAC, e.g. ESP.getEfuseMac() on the
+	ESP32. "kind" starts the client id, e.g. "testpanel". false if the site
+	or the kind does not fit or the site is not one level of a topic
+	*/
+	bool begin(const char *site, const char *kind, uint64_t mac);
+
+	const char *get_name() const { return name; }
+	const char *get_client_id() const { return client_id; }
+	// "<site>/<name>/"
+	const char *get_prefix() const { return prefix; }
+
+	// "<site>/<name>/<local>", false if it does not fit
+	bool topic(const char *local, char *out, size_t capacity) const;
+
+	// the topic without "<site>/<name>/", NULL if it is not for this device
+	const char *local(const char *topic) const;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include <flashLog.h>
+#include <LittleFS.h>
+
+#define FLASH_LOG_DIR "/store"
+
+static void segment_path(int segment, char *path, size_t size)
+{
+	snprintf(path, size, FLASH_LOG_DIR "/%d.log", segment);
+}
+
+static size_t flash_append(int segment, const uint8_t *data, size_t length)
+{
+	char path[24];
+	segment_path(segment, path, sizeof(path));
+	File file = LittleFS.open(path, FILE_APPEND);
+	if (!file)
+	{
+		return 0;
+	}
+	size_t written = file.write(data, length);
+	file.close();
+	return written;
+}
+
+static size_t flash_read(int segment, size_t offset, uint8_t *data, size_t length)
+{
+	char path[24];
+	segment_path(segment, path, sizeof(path));
+	File file = LittleFS.open(path, FILE_READ);
+	if (!file || !file.seek(offset))
+	{
+		return 0;
+	}
+	size_t read = file.read(data, length);
+	file.close();
+	return read;
+}
+
+static size_t flash_size(int segment)
+{
+	char path[24];
+	segment_path(segment, path, sizeof(path));
+	if (!LittleFS.exists(path))
+	{
+		return 0;
+	}
+	File file = LittleFS.open(path, FILE_READ);
+	size_t size = file ? file.size() : 0;
+	file.close();
+	return size;
+}
+
+static void flash_remove(int segment)
+{
+	char path[24];
+	segment_path(segment, path, sizeof(path));
+	if (LittleFS.exists(path))
+	{
+		LittleFS.remove(path);
+	}
+}
+
+const LogDriver FLASH_LOG = {flash_append, flash_read, flash_size, flash_remove};
+
+bool flash_log_begin()
+{
+	if (!LittleFS.begin(true))
+	{
+		return false;
+	}
+	if (!LittleFS.exists(FLASH_LOG_DIR))
+	{
+		LittleFS.mkdir(FLASH_LOG_DIR);
+	}
+	return true;
+}
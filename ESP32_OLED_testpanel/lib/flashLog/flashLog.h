@@ -0,0 +1,19 @@
+#ifndef flashLog_h
+#define flashLog_h
+
+#include <Arduino.h>
+#include <storeForward.h>
+
+/*
+The log of StoreForward on LittleFS, in the "spiffs" partition of the
+board. Every segment is a file /store/<n>.log, opened for each read and
+write so nothing is left open over a reset or a deep sleep. LittleFS
+spreads the writes over the flash blocks itself.
+*/
+
+// mounts LittleFS, and formats it if it can not be mounted
+bool flash_log_begin();
+
+extern const LogDriver FLASH_LOG;
+
+#endif
@@ -0,0 +1,76 @@
+#include <frameDiff.h>
+
+// address byte and control byte in front of every transmission
+static const size_t TRANSMISSION_BYTES = 2;
+
+// column and page address commands of a window, 3 bytes each
+static const size_t WINDOW_BYTES = 6;
+
+static size_t data_bytes(size_t length)
+{
+	size_t chunks = (length + OLED_CHUNK - 1) / OLED_CHUNK;
+	return length + chunks * TRANSMISSION_BYTES;
+}
+
+size_t diff_pages(const uint8_t *shown, const uint8_t *next, PageSpan spans[OLED_PAGES])
+{
+	size_t changed = 0;
+	for (int page = 0; page < OLED_PAGES; page++)
+	{
+		const uint8_t *a = shown + page * OLED_WIDTH;
+		const uint8_t *b = next + page * OLED_WIDTH;
+		PageSpan &span = spans[page];
+
+		int first = 0;
+		while (first < OLED_WIDTH && a[first] == b[first])
+		{
+			first++;
+		}
+		span.dirty = first < OLED_WIDTH;
+		if (!span.dirty)
+		{
+			span.first = 0;
+			span.last = 0;
+			continue;
+		}
+		int last = OLED_WIDTH - 1;
+		while (a[last] == b[last])
+		{
+			last--;
+		}
+		span.first = uint8_t(first);
+		span.last = uint8_t(last);
+		changed += last - first + 1;
+	}
+	return changed;
+}
+
+void all_pages(PageSpan spans[OLED_PAGES])
+{
+	for (int page = 0; page < OLED_PAGES; page++)
+	{
+		spans[page].dirty = true;
+		spans[page].first = 0;
+		spans[page].last = OLED_WIDTH - 1;
+	}
+}
+
+size_t bus_bytes(const PageSpan spans[OLED_PAGES])
+{
+	size_t bytes = 0;
+	for (int page = 0; page < OLED_PAGES; page++)
+	{
+		if (spans[page].dirty)
+		{
+			bytes += TRANSMISSION_BYTES + WINDOW_BYTES;
+			bytes += data_bytes(spans[page].last - spans[page].first + 1);
+		}
+	}
+	return bytes;
+}
+
+size_t full_bus_bytes()
+{
+	// one command list for the window of the whole screen, then the frame in chunks
+	return TRANSMISSION_BYTES + WINDOW_BYTES + data_bytes(OLED_BUFFER_SIZE);
+}
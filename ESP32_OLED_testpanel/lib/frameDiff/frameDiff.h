@@ -0,0 +1,47 @@
+#ifndef frameDiff_h
+#define frameDiff_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+The SSD1306 frame buffer as Adafruit_SSD1306 keeps it: 8 pages of 8 pixel
+rows, every byte is one column of a page, page after page.
+*/
+const int OLED_WIDTH = 128;
+const int OLED_PAGES = 8;
+const size_t OLED_BUFFER_SIZE = OLED_WIDTH * OLED_PAGES;
+
+// data bytes in one I2C transmission, the ESP32 Wire buffer holds 128 with the control byte
+const size_t OLED_CHUNK = 127;
+
+// the columns first..last of one page have to be sent, nothing if it is not dirty
+struct PageSpan
+{
+	bool dirty;
+	uint8_t first;
+	uint8_t last;
+};
+
+/*
+Compares the frame that is on the screen with the next one and gives the
+span of each page that changed, from the first to the last column that
+differs. Returns the number of data bytes in the spans, 0 if the frames
+are the same.
+*/
+size_t diff_pages(const uint8_t *shown, const uint8_t *next, PageSpan spans[OLED_PAGES]);
+
+// every page as dirty from the first to the last column, for a screen in an unknown state
+void all_pages(PageSpan spans[OLED_PAGES]);
+
+/*
+Bytes on the I2C bus to send the spans, with the address byte and the
+control byte of every transmission and the address window commands of
+every page.
+*/
+size_t bus_bytes(const PageSpan spans[OLED_PAGES]);
+
+// the same for Adafruit_SSD1306::display(), which sends the whole frame
+size_t full_bus_bytes();
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef batteryDispatcher_h
+#define batteryDispatcher_h
+
+#include <gridDispatch.h>
+#include <fleetTable.h>
+
+/*
+Incremental version of update_battery_status and update_battery_charging
+for a FleetTable.
+
+The cars that can give power (parked and over 10% battery) are kept in a
+max heap on battery status, so the biggest battery is found in O(1) and a
+tick that uses k cars costs O(k log N) instead of scanning all bays k times.
+Equal batteries are taken lowest bay first, like the linear scan does, so
+the results are the same as the free functions. This is DISPATCH_GREEDY,
+the other policies are in dispatchPolicy.h.
+
+Call update(bay) every time "parked" or "battery_status" of a bay is
+changed outside the dispatcher (a car arrives or leaves).
+*/
+template <int BAYS>
+class BatteryDispatcher
+{
+private:
+	static const int SIZE = BAYS;
+
+	FleetTable<BAYS> &fleet;
+
+	int heap[SIZE];     // bays ordered as a max heap on battery status
+	int position[SIZE]; // where a bay is in "heap", -1 if it is not there
+	int heap_size;
+
+	int used[SIZE]; // the bays that gave power in the last dispatch
+	int used_count;
+
+	// true if bay a should be used before bay b
+	bool before(int a, int b) const
+	{
+		const GridEnergy *battery_status = fleet.battery_status;
+		return battery_status[a] > battery_status[b] || (battery_status[a] == battery_status[b] && a < b);
+	}
+
+	bool available(int bay) const { return fleet.can_give(bay); }
+
+	void place(int index, int bay)
+	{
+		heap[index] = bay;
+		position[bay] = index;
+	}
+
+	void sift_up(int index)
+	{
+		int bay = heap[index];
+		while (index > 0)
+		{
+			int parent = (index - 1) / 2;
+			if (!before(bay, heap[parent]))
+			{
+				break;
+			}
+			place(index, heap[parent]);
+			index = parent;
+		}
+		place(index, bay);
+	}
+
+	void sift_down(int index)
+	{
+		int bay = heap[index];
+		while (true)
+		{
+			int child = 2 * index + 1;
+			if (child >= heap_size)
+			{
+				break;
+			}
+			if (child + 1 < heap_size && before(heap[child + 1], heap[child]))
+			{
+				child++;
+			}
+			if (!before(heap[child], bay))
+			{
+				break;
+			}
+			place(index, heap[child]);
+			index = child;
+		}
+		place(index, bay);
+	}
+
+	void push(int bay)
+	{
+		place(heap_size, bay);
+		heap_size++;
+		sift_up(heap_size - 1);
+	}
+
+	void remove(int bay)
+	{
+		int index = position[bay];
+		position[bay] = -1;
+		heap_size--;
+		if (index == heap_size)
+		{
+			return;
+		}
+		// the last bay fills the hole and is moved to where it belongs
+		int moved = heap[heap_size];
+		place(index, moved);
+		sift_up(index);
+		sift_down(position[moved]);
+	}
+
+	int pop()
+	{
+		int bay = heap[0];
+		remove(bay);
+		return bay;
+	}
+
+public:
+	static const DispatchPolicy POLICY = DISPATCH_GREEDY;
+
+	explicit BatteryDispatcher(FleetTable<BAYS> &fleet_table) : fleet(fleet_table)
+	{
+		reset();
+	}
+
+	// rebuilds the heap from the fleet table
+	void reset()
+	{
+		heap_size = 0;
+		used_count = 0;
+		fleet.decharging.clear();
+		for (int i = 0; i < SIZE; i++)
+		{
+			position[i] = -1;
+		}
+		for (int i = 0; i < SIZE; i++)
+		{
+			update(i);
+		}
+	}
+
+	// call when "parked" or "battery_status" of a bay has been changed
+	void update(int bay)
+	{
+		bool in_heap = position[bay] != -1;
+		if (available(bay))
+		{
+			if (in_heap)
+			{
+				sift_up(position[bay]);
+				sift_down(position[bay]);
+			}
+			else
+			{
+				push(bay);
+			}
+		}
+		else if (in_heap)
+		{
+			remove(bay);
+		}
+	}
+
+	// number of cars that can give power
+	int available_cars() const { return heap_size; }
+
+	/*
+	same as update_battery_status, but every car gives its power for the
+	elapsed_ms since the last dispatch instead of for one fixed tick
+	*/
+	DispatchResult dispatch(int battery_need, uint32_t elapsed_ms)
+	{
+		DispatchResult result = {battery_need, 0};
+
+		// only the cars that gave power last time can be decharging
+		for (int i = 0; i < used_count; i++)
+		{
+			fleet.decharging.set(used[i], false);
+		}
+		used_count = 0;
+
+		// every car gives at most its power limit, the last one only what is left
+		while (result.battery_need > 0 && heap_size > 0)
+		{
+			int bay = pop();
+			int limit = fleet.power_limit[bay];
+			int power = result.battery_need < limit ? result.battery_need : limit;
+			fleet.battery_status[bay] -= grid_energy(power, elapsed_ms);
+			result.power_given_from_battery += power;
+			result.battery_need -= power;
+
+			fleet.decharging.set(bay, true);
+			fleet.charging.set(bay, false);
+			used[used_count++] = bay;
+		}
+
+		// a car is only used once per tick, so they go back when all are picked
+		for (int i = 0; i < used_count; i++)
+		{
+			update(used[i]);
+		}
+		return result;
+	}
+
+	/*
+	same as update_battery_charging, but over elapsed_ms, and the forced cars
+	are charged even when the grid has no power to spare. "charged" is only
+	written when some car may be charged, so a tick where the cars give power
+	stays O(k log N). returns false if "charged" was not written
+	*/
+	bool charge(int grid, uint32_t elapsed_ms, BitFlags<BAYS> &charged)
+	{
+		if (grid != 0 && !fleet.forced.any())
+		{
+			return false;
+		}
+		fleet.charge(grid_energy(GRID_CHARGE_POWER, elapsed_ms), grid == 0, charged);
+
+		/*
+		every car that was charged got the same amount, so the heap is repaired
+		from the top. a parent is fixed before its children, so most cars stay
+		where they are and only the ones passing a full battery move
+		*/
+		for (int i = 0; i < heap_size; i++)
+		{
+			sift_up(i);
+		}
+		// cars that were charged over 10% can now give power
+		charged.for_each([this](int bay) {
+			if (position[bay] == -1)
+			{
+				update(bay);
+			}
+		});
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef dispatchPolicy_h
+#define dispatchPolicy_h
+
+#include <stdint.h>
+#include <algorithm>
+#include <gridDispatch.h>
+#include <fleetTable.h>
+#include <batteryDispatcher.h>
+
+/*
+Dispatch policies for bigger sites, picked at compile time.
+
+A policy shares the need of the grid between the cars that can give power
+(FleetTable::can_give), in power per car. PolicyDispatcher does the rest
+the same way as update_battery_status: the cars that give power are
+decharging and stop charging, the battery status goes down by the power
+over the elapsed time, and what the cars could not cover is left in
+battery_need.
+
+A policy is a struct with
+
+	static const DispatchPolicy POLICY;
+	template <int BAYS>
+	static void allocate(const FleetTable<BAYS> &fleet, int cars[], int count, int need, int32_t power[]);
+
+where cars[] are the bays that can give power, which allocate() may
+reorder, and power[i] is what cars[i] gives. The sum may not be over need,
+and no car over its power limit.
+*/
+
+/*
+water filling: every car gives power in proportion to its energy over the
+floor, and a car that would go over its power limit gives the limit and
+the rest is shared by the others. The cars are sorted by limit per energy,
+so the cars that hit their limit come first and the share of the rest is
+found in one pass, O(N log N) for the sort.
+*/
+struct ProportionalPolicy
+{
+	static const DispatchPolicy POLICY = DISPATCH_PROPORTIONAL;
+
+	template <int BAYS>
+	static void allocate(const FleetTable<BAYS> &fleet, int cars[], int count, int need, int32_t power[])
+	{
+		const GridEnergy *battery = fleet.battery_status;
+		const int32_t *limit = fleet.power_limit;
+
+		// limit[a] / weight[a] < limit[b] / weight[b], without dividing
+		std::sort(cars, cars + count, [battery, limit](int a, int b) {
+			GridEnergy weight_a = battery[a] - GRID_ENERGY_MIN;
+			GridEnergy weight_b = battery[b] - GRID_ENERGY_MIN;
+			GridEnergy left = GridEnergy(limit[a]) * weight_b;
+			GridEnergy right = GridEnergy(limit[b]) * weight_a;
+			return left < right || (left == right && a < b);
+		});
+
+		GridEnergy weight_left = 0;
+		for (int i = 0; i < count; i++)
+		{
+			weight_left += battery[cars[i]] - GRID_ENERGY_MIN;
+		}
+
+		// each car gets its share of what is left, so the shares add up to the need exactly
+		GridEnergy need_left = need;
+		for (int i = 0; i < count; i++)
+		{
+			int bay = cars[i];
+			GridEnergy weight = battery[bay] - GRID_ENERGY_MIN;
+			GridEnergy share = weight_left > 0 ? need_left * weight / weight_left : 0;
+			power[i] = int32_t(share < limit[bay] ? share : limit[bay]);
+			need_left -= power[i];
+			weight_left -= weight;
+		}
+	}
+};
+
+// the car that has been parked the longest gives first, equal times lowest bay first
+struct LongestParkedPolicy
+{
+	static const DispatchPolicy POLICY = DISPATCH_LONGEST_PARKED;
+
+	template <int BAYS>
+	static void allocate(const FleetTable<BAYS> &fleet, int cars[], int count, int need, int32_t power[])
+	{
+		const int32_t *parked = fleet.timeParked;
+		std::sort(cars, cars + count,
+				  [parked](int a, int b) { return parked[a] > parked[b] || (parked[a] == parked[b] && a < b); });
+
+		for (int i = 0; i < count; i++)
+		{
+			int32_t limit = fleet.power_limit[cars[i]];
+			power[i] = need < limit ? need : limit;
+			need -= power[i];
+		}
+	}
+};
+
+/*
+the dispatcher for a policy, used like BatteryDispatcher. It goes through
+all parked cars every dispatch, so update() has nothing to do
+*/
+template <int BAYS, class Policy>
+class PolicyDispatcher
+{
+private:
+	FleetTable<BAYS> &fleet;
+	int cars[BAYS];
+	int32_t power[BAYS];
+
+public:
+	static const DispatchPolicy POLICY = Policy::POLICY;
+
+	explicit PolicyDispatcher(FleetTable<BAYS> &fleet_table) : fleet(fleet_table)
+	{
+		reset();
+	}
+
+	void reset() { fleet.decharging.clear(); }
+
+	void update(int) {}
+
+	// number of cars that can give power
+	int available_cars() const
+	{
+		int count = 0;
+		const FleetTable<BAYS> &table = fleet;
+		fleet.parked.for_each([&table, &count](int bay) { count += table.can_give(bay); });
+		return count;
+	}
+
+	DispatchResult dispatch(int battery_need, uint32_t elapsed_ms)
+	{
+		DispatchResult result = {battery_need, 0};
+		fleet.decharging.clear();
+		if (battery_need <= 0)
+		{
+			return result;
+		}
+
+		int count = 0;
+		FleetTable<BAYS> &table = fleet;
+		int *list = cars;
+		fleet.parked.for_each([&table, list, &count](int bay) {
+			if (table.can_give(bay))
+			{
+				list[count++] = bay;
+			}
+		});
+
+		Policy::allocate(fleet, cars, count, battery_need, power);
+
+		for (int i = 0; i < count; i++)
+		{
+			if (power[i] <= 0)
+			{
+				continue;
+			}
+			int bay = cars[i];
+			fleet.battery_status[bay] -= grid_energy(power[i], elapsed_ms);
+			result.power_given_from_battery += power[i];
+			fleet.decharging.set(bay, true);
+			fleet.charging.set(bay, false);
+		}
+		result.battery_need -= result.power_given_from_battery;
+		return result;
+	}
+
+	// same as BatteryDispatcher::charge
+	bool charge(int grid, uint32_t elapsed_ms, BitFlags<BAYS> &charged)
+	{
+		if (grid != 0 && !fleet.forced.any())
+		{
+			return false;
+		}
+		fleet.charge(grid_energy(GRID_CHARGE_POWER, elapsed_ms), grid == 0, charged);
+		return true;
+	}
+};
+
+// the dispatcher type of a DispatchPolicy, for a setting in main.cpp
+template <int BAYS, int POLICY>
+struct DispatcherFor;
+
+template <int BAYS>
+struct DispatcherFor<BAYS, DISPATCH_GREEDY>
+{
+	typedef BatteryDispatcher<BAYS> type;
+};
+
+template <int BAYS>
+struct DispatcherFor<BAYS, DISPATCH_PROPORTIONAL>
+{
+	typedef PolicyDispatcher<BAYS, ProportionalPolicy> type;
+};
+
+template <int BAYS>
+struct DispatcherFor<BAYS, DISPATCH_LONGEST_PARKED>
+{
+	typedef PolicyDispatcher<BAYS, LongestParkedPolicy> type;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef fleetTable_h
+#define fleetTable_h
+
+#include <stdint.h>
+#include <gridDispatch.h>
+
+// N flags packed 32 to a word
+template <int N>
+class BitFlags
+{
+private:
+	static const int WORDS = (N + 31) / 32;
+	uint32_t words[WORDS];
+
+public:
+	BitFlags() { clear(); }
+
+	bool get(int i) const { return (words[i >> 5] >> (i & 31)) & 1; }
+
+	void set(int i, bool value)
+	{
+		if (value)
+		{
+			words[i >> 5] |= uint32_t(1) << (i & 31);
+		}
+		else
+		{
+			words[i >> 5] &= ~(uint32_t(1) << (i & 31));
+		}
+	}
+
+	void toggle(int i) { words[i >> 5] ^= uint32_t(1) << (i & 31); }
+
+	void clear()
+	{
+		for (int w = 0; w < WORDS; w++)
+		{
+			words[w] = 0;
+		}
+	}
+
+	// number of flags that are set
+	int count() const
+	{
+		int sum = 0;
+		for (int w = 0; w < WORDS; w++)
+		{
+			sum += __builtin_popcount(words[w]);
+		}
+		return sum;
+	}
+
+	bool any() const
+	{
+		for (int w = 0; w < WORDS; w++)
+		{
+			if (words[w] != 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	BitFlags &operator&=(const BitFlags &other)
+	{
+		for (int w = 0; w < WORDS; w++)
+		{
+			words[w] &= other.words[w];
+		}
+		return *this;
+	}
+
+	bool operator==(const BitFlags &other) const
+	{
+		for (int w = 0; w < WORDS; w++)
+		{
+			if (words[w] != other.words[w])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool operator!=(const BitFlags &other) const { return !(*this == other); }
+
+	// calls function(i) for every flag that is set, lowest first
+	template <class Function>
+	void for_each(Function function) const
+	{
+		for (int w = 0; w < WORDS; w++)
+		{
+			uint32_t word = words[w];
+			while (word != 0)
+			{
+				function(w * 32 + __builtin_ctz(word));
+				word &= word - 1;
+			}
+		}
+	}
+};
+
+/*
+State of a car park with BAYS parking bays, numbered from 0.
+
+The state is stored as a struct of arrays: the flags are bit packed and
+the battery status of all bays lies next to each other, so a pass over
+the park touches as few cache lines as possible.
+*/
+template <int BAYS>
+struct FleetTable
+{
+	static const int SIZE = BAYS;
+
+	BitFlags<BAYS> parked;     // a car is parked in the bay
+	BitFlags<BAYS> charging;   // the car is being charged
+	BitFlags<BAYS> decharging; // the car gave power to the grid in the last tick
+	BitFlags<BAYS> held;       // the car may not give power to the grid
+	BitFlags<BAYS> forced;     // the car is charged even when the grid has no power to spare
+
+	GridEnergy battery_status[BAYS]; // see GRID_ENERGY_WH
+	int32_t timeParked[BAYS];        // seconds since the car arrived
+	uint16_t parked_ms[BAYS];        // the part of a second timeParked has not counted yet
+	int32_t power_limit[BAYS];       // the most the car can give to the grid, W
+
+	FleetTable()
+	{
+		for (int i = 0; i < BAYS; i++)
+		{
+			battery_status[i] = 0;
+			timeParked[i] = 0;
+			parked_ms[i] = 0;
+			power_limit[i] = GRID_CAR_POWER;
+		}
+	}
+
+	// number of parked cars
+	int parked_count() const { return parked.count(); }
+
+	// parked, over the 10% floor, and not held or forced to charge
+	bool can_give(int bay) const
+	{
+		return parked.get(bay) && !held.get(bay) && !forced.get(bay) && battery_status[bay] >= GRID_ENERGY_MIN;
+	}
+
+	// battery status in % (0-100)
+	int battery_percent(int bay) const { return int(battery_status[bay] / GRID_ENERGY_WH); }
+
+	// adds the time since the last tick for each parked car, resets it for empty bays
+	void time_parked(uint32_t elapsed_ms)
+	{
+		for (int i = 0; i < BAYS; i++)
+		{
+			if (parked.get(i))
+			{
+				uint32_t ms = parked_ms[i] + elapsed_ms;
+				timeParked[i] += int32_t(ms / 1000);
+				parked_ms[i] = uint16_t(ms % 1000);
+			}
+			else
+			{
+				timeParked[i] = 0;
+				parked_ms[i] = 0;
+			}
+		}
+	}
+
+	/*
+	charges the parked cars that are not full with "energy", all of them when
+	the grid has power to spare and else only the forced ones. empty bays stop
+	charging. "charged" tells which cars were charged
+	*/
+	void charge(GridEnergy energy, bool spare, BitFlags<BAYS> &charged)
+	{
+		charged.clear();
+		charging &= parked;
+		BitFlags<BAYS> cars = parked;
+		if (!spare)
+		{
+			cars &= forced;
+		}
+		FleetTable &table = *this;
+		cars.for_each([&table, &charged, energy](int bay) {
+			if (table.battery_status[bay] < GRID_ENERGY_FULL)
+			{
+				table.charging.set(bay, true);
+				table.battery_status[bay] += energy;
+				charged.set(bay, true);
+			}
+		});
+	}
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include <gridDispatch.h>
+
+int parking_status_array(const bool varArray[], int size)
+{
+	int sum = 0;
+	for (int i = 1; i < size; i++)
+	{
+		if (varArray[i])
+		{
+			sum++;
+		}
+	}
+	return sum;
+}
+
+int battery_grid_need(int actual_grid, int max_grid)
+{
+	int battery_grid_need = 0;
+	if ((actual_grid + 100000) > max_grid)
+	{
+		battery_grid_need = actual_grid + 100000 - max_grid;
+	}
+	return battery_grid_need;
+}
+
+void time_parked(const bool parked[], int timeParked_cars[], int size)
+{
+	for (int i = 1; i < size; i++)
+	{
+		if (parked[i])
+		{
+			timeParked_cars[i] += 1;
+		}
+		else
+		{
+			timeParked_cars[i] = 0;
+		}
+	}
+}
+
+DispatchResult update_battery_status(int battery_need, const bool parked[], int battery_status[],
+									 bool charging_status[], bool decharging_status[], int size)
+{
+	DispatchResult result = {battery_need, 0};
+
+	// a car can give power if it is parked and has over 10% battery left,
+	// decharging_status marks the cars that already have been used this tick
+	int number_of_cars = 0;
+	for (int i = 0; i < size; i++)
+	{
+		decharging_status[i] = false;
+		if (i > 0 && parked[i] && battery_status[i] >= GRID_MIN_BATTERY)
+		{
+			number_of_cars++;
+		}
+	}
+
+	while (result.battery_need > 0 && number_of_cars > 0)
+	{
+		// find the biggest battery that has not been used yet
+		int biggest_battery = 0;
+		int biggest_battery_index = 0;
+		for (int i = 1; i < size; i++)
+		{
+			if (parked[i] && !decharging_status[i] && battery_status[i] >= GRID_MIN_BATTERY &&
+				battery_status[i] > biggest_battery)
+			{
+				biggest_battery = battery_status[i];
+				biggest_battery_index = i;
+			}
+		}
+		if (biggest_battery_index == 0)
+		{
+			break;
+		}
+
+		// every car gives at most 5 kW, the last one only what is left
+		int power = result.battery_need < GRID_CAR_POWER ? result.battery_need : GRID_CAR_POWER;
+		battery_status[biggest_battery_index] -= power;
+		result.power_given_from_battery += power;
+		result.battery_need -= power;
+
+		decharging_status[biggest_battery_index] = true;
+		charging_status[biggest_battery_index] = false;
+		number_of_cars--;
+	}
+	return result;
+}
+
+bool update_battery_charging(int grid, const bool parked[], int battery_status[],
+							 bool charging_status[], bool charged[], int size)
+{
+	for (int i = 0; i < size; i++)
+	{
+		charged[i] = false;
+	}
+	// only charge if there is power to spare
+	if (grid != 0)
+	{
+		return false;
+	}
+	for (int i = 1; i < size; i++)
+	{
+		if (parked[i])
+		{
+			if (battery_status[i] < GRID_FULL_BATTERY)
+			{
+				charging_status[i] = true;
+				battery_status[i] += GRID_CHARGE_POWER;
+				charged[i] = true;
+			}
+		}
+		else
+		{
+			charging_status[i] = false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,90 @@
+#ifndef gridDispatch_h
+#define gridDispatch_h
+
+#include <stdint.h>
+
+/*
+Hardware independent grid balancing logic for the testpanel.
+
+All arrays are indexed by bay, and like in the firmware the element at
+index 0 is a fail safe that is never used by a parked car. "size" is the
+length of the arrays, so a panel with 3 bays uses size = 4.
+*/
+
+// battery status is stored as Wh * 3600
+const int GRID_WH = 3600;
+
+// the most one car can give to the grid in one tick (5 kW)
+const int GRID_CAR_POWER = 5000;
+
+// what one car is charged with in one tick (5 kW)
+const int GRID_CHARGE_POWER = 5000;
+
+// cars below this level are not used to support the grid (10%)
+const int GRID_MIN_BATTERY = 10 * GRID_WH;
+
+// cars at or above this level are not charged (100%)
+const int GRID_FULL_BATTERY = 100 * GRID_WH;
+
+/*
+FleetTable and BatteryDispatcher count energy in 64 bits as power * ms, and
+give or charge power over the time that went by since the last tick. The
+figures above were made for a tick of GRID_TICK_MS, so a tick of that
+length gives the same battery status as the free functions (times
+GRID_TICK_MS), and any other tick rate the same per second.
+*/
+typedef int64_t GridEnergy;
+
+const int GRID_TICK_MS = 2000;
+
+// GRID_WH of battery status as energy, so 1% of a battery
+const GridEnergy GRID_ENERGY_WH = GridEnergy(GRID_WH) * GRID_TICK_MS;
+
+const GridEnergy GRID_ENERGY_MIN = 10 * GRID_ENERGY_WH;
+const GridEnergy GRID_ENERGY_FULL = 100 * GRID_ENERGY_WH;
+
+// the energy of "power" over "ms"
+inline GridEnergy grid_energy(int power, uint32_t ms) { return GridEnergy(power) * ms; }
+
+// how the need of the grid is shared between the parked cars, see dispatchPolicy.h
+enum DispatchPolicy
+{
+	DISPATCH_GREEDY,         // biggest battery first, each car up to its power limit
+	DISPATCH_PROPORTIONAL,   // every car in proportion to its energy over the 10% floor
+	DISPATCH_LONGEST_PARKED, // the car parked the longest first, each up to its power limit
+};
+
+// result of one dispatch of the battery park
+struct DispatchResult
+{
+	int battery_need;             // power the parked cars could not cover
+	int power_given_from_battery; // power the parked cars gave to the grid
+};
+
+// counts the true elements, the fail safe at index 0 is not counted
+int parking_status_array(const bool varArray[], int size);
+
+// how much the batteries have to give when the grid is loaded with actual_grid
+int battery_grid_need(int actual_grid, int max_grid);
+
+// increases the time parked for each parked car, resets it for empty bays
+void time_parked(const bool parked[], int timeParked_cars[], int size);
+
+/*
+lets the parked cars cover "battery_need", biggest battery first and at most
+GRID_CAR_POWER from each car. battery_status is updated with what the cars gave,
+decharging_status tells which cars gave power and charging_status is cleared
+for the same cars
+*/
+DispatchResult update_battery_status(int battery_need, const bool parked[], int battery_status[],
+									 bool charging_status[], bool decharging_status[], int size);
+
+/*
+charges every parked car that is not full when the grid has no load (grid == 0).
+charged tells which cars were charged this tick, and charging_status is
+cleared for empty bays. returns false if the grid had no power to spare
+*/
+bool update_battery_charging(int grid, const bool parked[], int battery_status[],
+							 bool charging_status[], bool charged[], int size);
+
+#endif
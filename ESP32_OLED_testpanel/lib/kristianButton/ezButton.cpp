@@ -1,31 +1,17 @@
 #include <kristianButton.h>
 
 // husk å legg til "pinMode(BUTTON_PIN, INPUT_PULLUP);"
+// medlemmene settes her, ikke som lokale variabler som skygger for dem
 kristianButton::kristianButton(int pin)
+	: btnPin(pin), debounceTime(0), lastSteadyState(LOW), lastFlickerableState(LOW), currentState(LOW),
+	  // denne endres med setLoop funksjon
+	  theButtonState(false), lastDebounceTime(0)
 {
-	int btnPin = pin;
-	int debounceTime = 0;
-	int lastSteadyState = LOW;		// the previous steady state from the input pin
-	int lastFlickerableState = LOW; // the previous flickerable state from the input pin
-	int currentState;				// the current reading from the input pin
-	// denne endres med setLoop funksjon
-	bool theButtonState = false;
-
-	// the following variables are unsigned longs because the time, measured in
-	// milliseconds, will quickly become a bigger number than can be stored in an int.
-	unsigned long lastDebounceTime = 0; // the last time the output pin was toggled
 }
 
 bool kristianButton::buttonState(void)
 {
-	if (theButtonState == true)
-	{
-		return true;
-	}
-	else if (theButtonState == false)
-	{
-		return false;
-	}
+	return theButtonState;
 }
 
 void kristianButton::debounce(int time)
@@ -48,7 +34,7 @@ void kristianButton::setLoop(void)
 		lastFlickerableState = currentState;
 	}
 
-	if ((millis() - lastDebounceTime) > debounceTime)
+	if ((millis() - lastDebounceTime) > (unsigned long)debounceTime)
 	{
 		// hvis du kommer inn i denne funksjonen, så har avlesningen vært på
 		// lenger enn debounce tid, ergo:
@@ -66,5 +52,4 @@ void kristianButton::setLoop(void)
 		// lagrer lastSteadyState
 		lastSteadyState = currentState;
 	}
-	Serial.println(lastSteadyState);
 }
\ No newline at end of file
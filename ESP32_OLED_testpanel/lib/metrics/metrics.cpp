@@ -0,0 +1,159 @@
+#include <metrics.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+uint32_t LogHistogram::upper(int bucket)
+{
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+	{
+		return uint32_t(bucket);
+	}
+	int power = bucket / HISTOGRAM_SUB_BUCKETS + 1;
+	uint64_t step = uint64_t(1) << (power - 2);
+	uint64_t lower = uint64_t(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) * step;
+	return uint32_t(lower + step - 1);
+}
+
+void LogHistogram::reset()
+{
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		buckets[i] = 0;
+	}
+}
+
+uint32_t LogHistogram::count() const
+{
+	uint32_t total = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		total += buckets[i];
+	}
+	return total;
+}
+
+MetricsReport::MetricsReport(const char *owner_name)
+	: owner(owner_name), histogram_count(0), value_count(0), last_report(0), started(false)
+{
+}
+
+bool MetricsReport::histogram(const char *name, const LogHistogram &histogram)
+{
+	if (histogram_count == METRICS_HISTOGRAMS)
+	{
+		return false;
+	}
+	Histogram &entry = histograms[histogram_count++];
+	entry.name = name;
+	entry.histogram = &histogram;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		entry.last[i] = histogram.get(i);
+	}
+	return true;
+}
+
+bool MetricsReport::counter(const char *name, MetricRead read)
+{
+	if (value_count == METRICS_VALUES)
+	{
+		return false;
+	}
+	Value value = {name, read, true, read()};
+	values[value_count++] = value;
+	return true;
+}
+
+bool MetricsReport::gauge(const char *name, MetricRead read)
+{
+	if (value_count == METRICS_VALUES)
+	{
+		return false;
+	}
+	Value value = {name, read, false, 0};
+	values[value_count++] = value;
+	return true;
+}
+
+// snprintf at the end of the text, false if it did not fit
+static bool append(char *out, size_t capacity, size_t &used, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(out + used, capacity - used, format, args);
+	va_end(args);
+	if (length < 0 || used + size_t(length) >= capacity)
+	{
+		return false;
+	}
+	used += size_t(length);
+	return true;
+}
+
+size_t MetricsReport::write(unsigned long now, char *out, size_t capacity)
+{
+	if (capacity == 0)
+	{
+		return 0;
+	}
+	size_t used = 0;
+	unsigned long interval = started ? now - last_report : now;
+	bool fits = append(out, capacity, used, "{\"owner\": \"%s\", \"ms\": %lu", owner, interval);
+
+	// each histogram is read once, it goes on while the text is written
+	uint32_t current[HISTOGRAM_BUCKETS];
+	for (int h = 0; h < histogram_count; h++)
+	{
+		Histogram &entry = histograms[h];
+		uint32_t total = 0;
+		int highest = 0;
+		for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		{
+			current[i] = entry.histogram->get(i);
+			uint32_t added = current[i] - entry.last[i];
+			total += added;
+			if (added > 0)
+			{
+				highest = i;
+			}
+		}
+
+		// the bucket of each percentile, rounded up
+		const uint32_t PERCENTILES[] = {50, 90, 99};
+		uint32_t value[3] = {0, 0, 0};
+		uint32_t seen = 0;
+		int p = 0;
+		for (int i = 0; i < HISTOGRAM_BUCKETS && p < 3 && total > 0; i++)
+		{
+			seen += current[i] - entry.last[i];
+			while (p < 3 && uint64_t(seen) * 100 >= uint64_t(total) * PERCENTILES[p])
+			{
+				value[p++] = LogHistogram::upper(i);
+			}
+		}
+		fits = fits && append(out, capacity, used, ", \"%s\": [%lu, %lu, %lu, %lu, %lu]", entry.name,
+							  (unsigned long)total, (unsigned long)value[0], (unsigned long)value[1],
+							  (unsigned long)value[2], (unsigned long)(total > 0 ? LogHistogram::upper(highest) : 0));
+		for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		{
+			entry.last[i] = current[i];
+		}
+	}
+
+	for (int v = 0; v < value_count; v++)
+	{
+		uint32_t read = values[v].read();
+		uint32_t shown = values[v].counter ? read - values[v].last : read;
+		values[v].last = read;
+		fits = fits && append(out, capacity, used, ", \"%s\": %lu", values[v].name, (unsigned long)shown);
+	}
+	fits = fits && append(out, capacity, used, "}");
+	last_report = now;
+	started = true;
+	if (!fits)
+	{
+		out[0] = '\0';
+		return 0;
+	}
+	return used;
+}
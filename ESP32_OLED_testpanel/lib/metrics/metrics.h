@@ -0,0 +1,105 @@
+#ifndef metrics_h
+#define metrics_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Runtime metrics in fixed memory: histograms of times, counters and
+gauges, and a compact JSON summary of them for esp32/output/metrics.
+
+A LogHistogram counts values in buckets that grow with the value, four
+per power of two, so a value is known to within 25 % from 0 to 2^32
+with 124 counters. add() is a few instructions and never allocates, so
+it can be called in the hot paths.
+
+Every histogram and counter has one task that writes it. The summary is
+made by another task that only reads: MetricsReport keeps a copy of what
+it last published and sends the difference, so nothing is reset under
+the writer and no update is lost. A summary made while a value is being
+added can be one count off.
+*/
+
+const int HISTOGRAM_SUB_BUCKETS = 4;
+const int HISTOGRAM_BUCKETS = 124;
+
+class LogHistogram
+{
+private:
+	volatile uint32_t buckets[HISTOGRAM_BUCKETS];
+
+public:
+	LogHistogram() { reset(); }
+
+	static int bucket(uint32_t value)
+	{
+		if (value < uint32_t(HISTOGRAM_SUB_BUCKETS))
+		{
+			return int(value);
+		}
+		int power = 31 - __builtin_clz(value);
+		int sub = int(value >> (power - 2)) & (HISTOGRAM_SUB_BUCKETS - 1);
+		return HISTOGRAM_SUB_BUCKETS * (power - 1) + sub;
+	}
+
+	// the biggest value of a bucket
+	static uint32_t upper(int bucket);
+
+	void add(uint32_t value) { buckets[bucket(value)]++; }
+	void reset();
+
+	uint32_t get(int bucket) const { return buckets[bucket]; }
+	uint32_t count() const;
+};
+
+// reads a counter or a gauge, e.g. the free heap
+typedef uint32_t (*MetricRead)();
+
+const int METRICS_HISTOGRAMS = 8;
+const int METRICS_VALUES = 8;
+
+// per histogram: the count and the 50th, 90th and 99th percentile and the biggest value of the interval
+class MetricsReport
+{
+private:
+	struct Histogram
+	{
+		const char *name;
+		const LogHistogram *histogram;
+		uint32_t last[HISTOGRAM_BUCKETS];
+	};
+
+	struct Value
+	{
+		const char *name;
+		MetricRead read;
+		bool counter;  // the change since the last summary is sent, not the value
+		uint32_t last; // counters only
+	};
+
+	const char *owner;
+	Histogram histograms[METRICS_HISTOGRAMS];
+	int histogram_count;
+	Value values[METRICS_VALUES];
+	int value_count;
+	unsigned long last_report;
+	bool started;
+
+public:
+	explicit MetricsReport(const char *owner);
+
+	// false if there is no room for it, the names are kept as pointers
+	bool histogram(const char *name, const LogHistogram &histogram);
+	bool counter(const char *name, MetricRead read);
+	bool gauge(const char *name, MetricRead read);
+
+	/*
+	{"owner": "<owner>", "ms": <ms since the last summary>, "<histogram>": [count, p50, p90, p99, max],
+	 "<counter>": <change>, "<gauge>": <value>}
+	returns the length, 0 if it did not fit. either way the next summary
+	starts from here
+	*/
+	size_t write(unsigned long now, char *out, size_t capacity);
+};
+
+#endif
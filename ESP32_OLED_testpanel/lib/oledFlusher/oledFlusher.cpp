@@ -0,0 +1,112 @@
+#include <oledFlusher.h>
+#include <string.h>
+
+// SSD1306 control bytes and commands
+static const uint8_t CONTROL_COMMAND = 0x00;
+static const uint8_t CONTROL_DATA = 0x40;
+static const uint8_t COMMAND_COLUMN_ADDRESS = 0x21;
+static const uint8_t COMMAND_PAGE_ADDRESS = 0x22;
+
+OledFlusher::OledFlusher()
+	: wire(NULL), address(0), task(NULL), known(false), flushes(0), unchanged(0), dropped(0), bytes(0),
+	  last_us(0)
+{
+}
+
+void OledFlusher::begin(TwoWire &wire, uint8_t address, uint32_t clock, int core)
+{
+	this->wire = &wire;
+	this->address = address;
+	// Adafruit_SSD1306 only raises the clock while it sends, the task keeps it up
+	wire.setClock(clock);
+	xTaskCreatePinnedToCore(run, "oled", 2048, this, 1, &task, core);
+}
+
+bool OledFlusher::submit(const uint8_t *pixels)
+{
+	memcpy(frames.slot().pixels, pixels, OLED_BUFFER_SIZE);
+	bool taken = frames.publish();
+	if (!taken)
+	{
+		dropped++;
+	}
+	if (task != NULL)
+	{
+		xTaskNotifyGive(task);
+	}
+	return taken;
+}
+
+void OledFlusher::run(void *self)
+{
+	OledFlusher *flusher = static_cast<OledFlusher *>(self);
+	for (;;)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		// the newest frame, the ones it replaced are counted by submit()
+		const Frame *frame = flusher->frames.take();
+		if (frame != NULL)
+		{
+			flusher->flush(frame->pixels);
+		}
+	}
+}
+
+void OledFlusher::flush(const uint8_t *pixels)
+{
+	unsigned long start = micros();
+	PageSpan spans[OLED_PAGES];
+	if (known)
+	{
+		if (diff_pages(shown, pixels, spans) == 0)
+		{
+			unchanged++;
+			return;
+		}
+	}
+	else
+	{
+		all_pages(spans);
+	}
+
+	for (int page = 0; page < OLED_PAGES; page++)
+	{
+		if (spans[page].dirty)
+		{
+			send(page, spans[page], pixels + page * OLED_WIDTH);
+		}
+	}
+	memcpy(shown, pixels, OLED_BUFFER_SIZE);
+	known = true;
+
+	flushes++;
+	bytes += bus_bytes(spans);
+	last_us = micros() - start;
+}
+
+void OledFlusher::send(int page, const PageSpan &span, const uint8_t *data)
+{
+	// a window of one page, the data after it fills it column by column
+	wire->beginTransmission(address);
+	wire->write(CONTROL_COMMAND);
+	wire->write(COMMAND_COLUMN_ADDRESS);
+	wire->write(span.first);
+	wire->write(span.last);
+	wire->write(COMMAND_PAGE_ADDRESS);
+	wire->write(uint8_t(page));
+	wire->write(uint8_t(page));
+	wire->endTransmission();
+
+	size_t column = span.first;
+	size_t end = size_t(span.last) + 1;
+	while (column < end)
+	{
+		size_t length = end - column < OLED_CHUNK ? end - column : OLED_CHUNK;
+		wire->beginTransmission(address);
+		wire->write(CONTROL_DATA);
+		wire->write(data + column, length);
+		wire->endTransmission();
+		column += length;
+	}
+}
@@ -0,0 +1,67 @@
+#ifndef oledFlusher_h
+#define oledFlusher_h
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <frameDiff.h>
+#include <spscRing.h>
+
+/*
+Sends frames to an SSD1306 from a task of its own, in place of
+Adafruit_SSD1306::display(). The loop draws into the Adafruit buffer as
+before and hands it over with submit(), which copies it and returns.
+
+The task keeps the frame that is on the screen and only sends the
+columns of each page that changed, with the column and page address
+commands in front. A frame that is the same as the screen costs no bus
+time at all. If the loop hands over frames faster than they can be sent,
+only the newest is sent: a frame the task has not taken yet is replaced
+by the next one.
+
+After begin() the task owns the I2C bus, nothing else may use Wire.
+*/
+class OledFlusher
+{
+private:
+	struct Frame
+	{
+		uint8_t pixels[OLED_BUFFER_SIZE];
+	};
+
+	TwoWire *wire;
+	uint8_t address;
+	TaskHandle_t task;
+	SpscMailbox<Frame> frames;
+
+	// only used by the task
+	uint8_t shown[OLED_BUFFER_SIZE];
+	bool known; // the screen holds "shown", false until the first frame is sent
+
+	// each is only written by one task: dropped by submit(), the rest by the flusher task
+	volatile unsigned long flushes;   // frames that changed the screen
+	volatile unsigned long unchanged; // frames that were the same as the screen
+	volatile unsigned long dropped;   // frames replaced by a newer one before they were sent
+	volatile unsigned long bytes;     // bytes on the bus
+	volatile unsigned long last_us;   // time of the last flush
+
+	static void run(void *self);
+	void flush(const uint8_t *pixels);
+	void send(int page, const PageSpan &span, const uint8_t *data);
+
+public:
+	OledFlusher();
+
+	// starts the task, the display must have been set up with display.begin()
+	void begin(TwoWire &wire, uint8_t address, uint32_t clock, int core);
+
+	// copies the frame for the task, false if it replaced one the task had not taken yet
+	bool submit(const uint8_t *pixels);
+
+	unsigned long get_flushes() const { return flushes; }
+	unsigned long get_unchanged() const { return unchanged; }
+	unsigned long get_dropped() const { return dropped; }
+	unsigned long get_bytes() const { return bytes; }
+	unsigned long get_last_us() const { return last_us; }
+};
+
+#endif
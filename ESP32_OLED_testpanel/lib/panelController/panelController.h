@@ -0,0 +1,110 @@
+#ifndef panelController_h
+#define panelController_h
+
+#include <stdint.h>
+#include <gridDispatch.h>
+#include <fleetTable.h>
+#include <batteryDispatcher.h>
+#include <telemetry.h>
+#include <profiler.h>
+
+/*
+The grid control of the testpanel without any hardware: a press toggles a
+bay, and a tick dispatches and charges the battery park for the grid load.
+The firmware and the trace replayer both run this, so a trace recorded on
+the panel gives the same results on the host.
+
+The battery of an arriving car is drawn from a seeded generator instead
+of random(), so the seed is all the trace needs to know about it. The
+dispatcher is BatteryDispatcher or one of dispatchPolicy.h. A tick
+counts the time since the one before, or since start() for the first, so
+the times of the ticks are all the trace needs to know about the clock.
+*/
+// what a command on a bay topic can change
+enum BayCommand
+{
+	BAY_FORCE_CHARGE,   // on: the car is charged every tick and does not give power
+	BAY_STOP_DISCHARGE, // on: the car does not give power
+};
+
+template <int BAYS, class Dispatcher = BatteryDispatcher<BAYS>>
+class PanelController
+{
+private:
+	uint32_t random_state;
+	uint32_t last_tick; // millis() of the last tick
+
+	// xorshift32
+	uint32_t next_random()
+	{
+		random_state ^= random_state << 13;
+		random_state ^= random_state >> 17;
+		random_state ^= random_state << 5;
+		return random_state;
+	}
+
+public:
+	FleetTable<BAYS> fleet;
+	Dispatcher dispatcher;
+
+	PanelController() : random_state(1), last_tick(0), dispatcher(fleet) {}
+
+	// the dispatcher points into this object
+	PanelController(const PanelController &) = delete;
+	PanelController &operator=(const PanelController &) = delete;
+
+	// the seed of the batteries, 0 is not a valid xorshift state and is taken as 1
+	void start(uint32_t seed, unsigned long now)
+	{
+		random_state = seed != 0 ? seed : 1;
+		last_tick = uint32_t(now);
+	}
+
+	// 20-79 % battery, like give_random_battery_status() was
+	GridEnergy random_battery() { return GridEnergy(20 + next_random() % 60) * GRID_ENERGY_WH; }
+
+	// a button press toggles if a car is parked in the bay
+	void press(int bay)
+	{
+		fleet.parked.toggle(bay);
+		fleet.battery_status[bay] = random_battery();
+		// the commands were for the car that was there
+		fleet.forced.set(bay, false);
+		fleet.held.set(bay, false);
+		dispatcher.update(bay);
+	}
+
+	// a command from mqtt for one bay
+	void command(BayCommand command, int bay, bool on)
+	{
+		if (bay < 0 || bay >= BAYS)
+		{
+			return;
+		}
+		if (command == BAY_FORCE_CHARGE)
+		{
+			fleet.forced.set(bay, on);
+		}
+		else if (command == BAY_STOP_DISCHARGE)
+		{
+			fleet.held.set(bay, on);
+		}
+		dispatcher.update(bay);
+	}
+
+	// one control tick with the grid load, fills everything of the report
+	void tick(int grid, unsigned long now, TickReport<BAYS> &report)
+	{
+		PROFILE_ZONE("dispatch");
+		uint32_t elapsed = uint32_t(now) - last_tick; // millis() wraps, the difference does not
+		last_tick = uint32_t(now);
+
+		fleet.time_parked(elapsed); // update the time parked for each car
+		report.grid = grid;
+		report.time = now;
+		report.result = dispatcher.dispatch(grid, elapsed);                 // update the battery status
+		report.charging = dispatcher.charge(grid, elapsed, report.charged); // update the charging status
+	}
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include <profiler.h>
+#include <stdio.h>
+#include <atomic>
+
+static ProfileZone *zones[PROFILE_MAX_ZONES];
+// zones that asked for a slot, the table holds the first PROFILE_MAX_ZONES
+static std::atomic<int> zone_count(0);
+
+bool ProfileZone::list()
+{
+	listed = true;
+	int slot = zone_count.fetch_add(1);
+	if (slot >= PROFILE_MAX_ZONES)
+	{
+		return false;
+	}
+	zones[slot] = this;
+	return true;
+}
+
+int profile_sorted(const ProfileZone **out, int capacity)
+{
+	int count = zone_count.load();
+	int found = 0;
+	for (int i = 0; i < count && i < PROFILE_MAX_ZONES && found < capacity; i++)
+	{
+		// the slot is taken before the zone is put in it
+		const ProfileZone *zone = zones[i];
+		if (zone == NULL)
+		{
+			continue;
+		}
+		int at = found++;
+		while (at > 0 && out[at - 1]->ticks < zone->ticks)
+		{
+			out[at] = out[at - 1];
+			at--;
+		}
+		out[at] = zone;
+	}
+	return found;
+}
+
+int profile_unlisted()
+{
+	int count = zone_count.load();
+	return count > PROFILE_MAX_ZONES ? count - PROFILE_MAX_ZONES : 0;
+}
+
+uint32_t profile_overhead()
+{
+	ProfileZone empty("overhead");
+	empty.listed = true; // not in the profile
+	uint32_t least = 0xFFFFFFFF;
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t start = profile_ticks();
+		{
+			ProfileScope scope(empty);
+		}
+		uint32_t used = profile_ticks() - start;
+		least = used < least ? used : least;
+	}
+	return least;
+}
+
+size_t format_profile(const ProfileZone &zone, char *line, size_t size)
+{
+	uint32_t calls = zone.calls;
+	uint64_t ticks = zone.ticks;
+	int length = snprintf(line, size, "Z %s %lu %llu %llu %lu", zone.name, (unsigned long)calls,
+						  (unsigned long long)ticks, (unsigned long long)(calls == 0 ? 0 : ticks / calls),
+						  (unsigned long)zone.longest);
+	if (length < 0 || size_t(length) >= size)
+	{
+		return 0;
+	}
+	return size_t(length);
+}
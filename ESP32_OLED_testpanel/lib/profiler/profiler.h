@@ -0,0 +1,133 @@
+#ifndef profiler_h
+#define profiler_h
+
+#include <stddef.h>
+#include <stdint.h>
+#if !defined(__XTENSA__)
+#include <chrono>
+#endif
+
+/*
+Times scopes of the firmware with the cycle counter of the core, for the
+functions where micros() is too coarse.
+
+PROFILE_ZONE("name") at the top of a scope times it to its end, and adds
+the time to a zone with that name: the calls, the cycles in all of them
+and the longest call. A zone is a static object of the function it is
+in, it goes into the table of zones the first time it is used, and the
+table can be written out as a flat profile on demand.
+
+With the build flag PROFILER off (the default) PROFILE_ZONE is nothing
+and nothing is timed. With it on a zone costs two reads of the counter
+and a few adds, profile_overhead() measures it.
+
+On the ESP32 the ticks are CPU cycles of the core the zone ran on, so
+the cost of a function does not change with the clock POWER_SAVE scales.
+On the host, for the benches, they are nanoseconds of steady_clock.
+
+A zone is written by the task it runs in and read by the one that
+writes the profile, so a profile made while a zone is timed can be one
+call off. Each name should be used once, two zones with the same name
+are listed twice. Nested zones are each timed whole, so their times add
+up to more than the time that went by.
+*/
+
+// PROFILER 1 (build_flags = -D PROFILER=1) times the PROFILE_ZONE scopes, 0 leaves them out of the build
+#ifndef PROFILER
+#define PROFILER 0
+#endif
+
+// the cycle counter of the core, nanoseconds on the host
+inline uint32_t profile_ticks()
+{
+#if defined(__XTENSA__)
+	uint32_t ccount;
+	__asm__ __volatile__("rsr %0, ccount" : "=a"(ccount));
+	return ccount;
+#else
+	return uint32_t(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+			.count());
+#endif
+}
+
+const int PROFILE_MAX_ZONES = 16;
+
+class ProfileZone
+{
+public:
+	const char *name;
+	uint32_t calls;
+	uint64_t ticks;
+	uint32_t longest;
+	bool listed; // in the table of zones
+
+	// constexpr, so a zone in a function is set up before the program runs and needs no guard
+	constexpr explicit ProfileZone(const char *zone_name)
+		: name(zone_name), calls(0), ticks(0), longest(0), listed(false)
+	{
+	}
+
+	void add(uint32_t used)
+	{
+		calls++;
+		ticks += used;
+		longest = used > longest ? used : longest;
+		if (!listed)
+		{
+			list();
+		}
+	}
+
+	// puts the zone in the table, false if it is full
+	bool list();
+};
+
+// times from its construction to the end of the scope
+class ProfileScope
+{
+private:
+	ProfileZone &zone;
+	uint32_t started;
+
+public:
+	explicit ProfileScope(ProfileZone &scope_zone) : zone(scope_zone), started(profile_ticks()) {}
+	~ProfileScope() { zone.add(profile_ticks() - started); }
+
+	ProfileScope(const ProfileScope &) = delete;
+	ProfileScope &operator=(const ProfileScope &) = delete;
+};
+
+#define PROFILE_JOIN_(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN_(a, b)
+
+#if PROFILER
+#define PROFILE_ZONE(name)                                                                                           \
+	static ProfileZone PROFILE_JOIN(profile_zone_, __LINE__)(name);                                                  \
+	ProfileScope PROFILE_JOIN(profile_scope_, __LINE__)(PROFILE_JOIN(profile_zone_, __LINE__))
+#else
+#define PROFILE_ZONE(name) \
+	do                     \
+	{                      \
+	} while (0)
+#endif
+
+// the zones in the table by their ticks, the most first. returns how many
+int profile_sorted(const ProfileZone **out, int capacity);
+
+// zones that did not fit in the table and are not in the profile
+int profile_unlisted();
+
+// the least ticks of an empty zone, what a zone adds to what it times
+uint32_t profile_overhead();
+
+// the longest line format_profile() writes
+const size_t PROFILE_LINE_SIZE = 96;
+
+/*
+one line of the flat profile, "Z <name> <calls> <ticks> <mean> <longest>",
+without a newline. returns the length, 0 if it does not fit
+*/
+size_t format_profile(const ProfileZone &zone, char *line, size_t size);
+
+#endif
@@ -0,0 +1,64 @@
+#include <publishRate.h>
+
+PublishRate::PublishRate(const PublishRateSettings &rate_settings)
+	: settings(rate_settings), period(0), floor(0), last(0), started(false)
+{
+	set_limits(rate_settings.min_period, rate_settings.max_period);
+	period = settings.max_period;
+}
+
+unsigned long PublishRate::clamp(unsigned long value) const
+{
+	if (value < settings.min_period)
+	{
+		return settings.min_period;
+	}
+	return value > settings.max_period ? settings.max_period : value;
+}
+
+void PublishRate::set_limits(unsigned long min_period, unsigned long max_period)
+{
+	settings.min_period = min_period < 1 ? 1 : min_period;
+	settings.max_period = max_period < settings.min_period ? settings.min_period : max_period;
+	period = clamp(period);
+	floor = clamp(floor);
+}
+
+bool PublishRate::due(unsigned long now, float change) const
+{
+	if (!started)
+	{
+		return true;
+	}
+	unsigned long since = now - last;
+	if (since < floor)
+	{
+		return false;
+	}
+	return since >= period || (change >= 1 && since >= settings.min_period);
+}
+
+void PublishRate::published(unsigned long now, bool news)
+{
+	started = true;
+	last = now;
+	period = clamp(news ? period / 2 : period + period / 2);
+	if (period < floor)
+	{
+		period = floor;
+	}
+}
+
+void PublishRate::congested()
+{
+	floor = clamp(floor * 2);
+	if (period < floor)
+	{
+		period = floor;
+	}
+}
+
+void PublishRate::delivered()
+{
+	floor = clamp(floor - floor / 4);
+}
@@ -0,0 +1,59 @@
+#ifndef publishRate_h
+#define publishRate_h
+
+/*
+Decides when a node publishes, between a shortest and a longest period.
+
+The caller tells how far its signals moved since the last publish, in
+deadbands, so 1 or more is news. News is published at once, as long as
+the shortest period has gone by, and every publish with news halves the
+period. A publish without news makes it half again as long, up to the
+longest period, so a quiet node ends up sending a heartbeat every
+max_period.
+
+The link pushes the other way: a failed publish or a queue that fills up
+doubles a floor under the period, and every publish that gets through
+takes a quarter off it again, down to min_period.
+*/
+struct PublishRateSettings
+{
+	unsigned long min_period; // ms, the fastest while the signals move
+	unsigned long max_period; // ms, the slowest while nothing happens
+};
+
+const PublishRateSettings PUBLISH_RATE_DEFAULTS = {250, 10000};
+
+class PublishRate
+{
+private:
+	PublishRateSettings settings;
+	unsigned long period;
+	unsigned long floor; // the link can take no more than one publish per floor
+	unsigned long last;
+	bool started;
+
+	unsigned long clamp(unsigned long value) const;
+
+public:
+	explicit PublishRate(const PublishRateSettings &settings = PUBLISH_RATE_DEFAULTS);
+
+	// min_period is at least 1 ms and max_period at least min_period
+	void set_limits(unsigned long min_period, unsigned long max_period);
+	const PublishRateSettings &get_limits() const { return settings; }
+
+	// true if a publish is due, the first one always is
+	bool due(unsigned long now, float change) const;
+
+	// call when the publish is made, news is a change of 1 or more
+	void published(unsigned long now, bool news);
+
+	// a publish failed, or the queue to the link is filling up
+	void congested();
+	// a publish got through
+	void delivered();
+
+	unsigned long get_period() const { return period; }
+	unsigned long get_floor() const { return floor; }
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef rtcState_h
+#define rtcState_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+// change it when the layout of anything kept in an RtcSlot changes
+const uint32_t RTC_STATE_VERSION = 4;
+
+// FNV-1a over the bytes
+inline uint32_t rtc_checksum(const void *data, size_t length)
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+A copy of a T that lives through deep sleep, declared with RTC_DATA_ATTR.
+
+The slot has no constructor on purpose: a global with a constructor is
+set up again on every boot, also after a wake, which would wipe it.
+After power-on the RTC memory holds zeros and load() fails, the same as
+after a firmware with another layout or a reset in the middle of save().
+*/
+template <class T>
+struct RtcSlot
+{
+	static_assert(std::is_trivially_copyable<T>::value, "RtcSlot needs a type that can be copied as bytes");
+
+	uint32_t version;
+	uint32_t checksum;
+	uint8_t data[sizeof(T)];
+
+	void save(const T &value)
+	{
+		memcpy(data, &value, sizeof(T));
+		version = RTC_STATE_VERSION;
+		checksum = rtc_checksum(data, sizeof(T)) ^ uint32_t(sizeof(T));
+	}
+
+	// false if nothing valid was saved, value is left as it was
+	bool load(T &value) const
+	{
+		if (version != RTC_STATE_VERSION || checksum != (rtc_checksum(data, sizeof(T)) ^ uint32_t(sizeof(T))))
+		{
+			return false;
+		}
+		memcpy(&value, data, sizeof(T));
+		return true;
+	}
+
+	void clear() { version = 0; }
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef spscRing_h
+#define spscRing_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/*
+Ring buffer between exactly one task that pushes and one task that pops,
+e.g. the control task and the network task on the two cores. No locks
+are used: only the producer writes "head" and only the consumer writes
+"tail", and the release/acquire pairs make a slot visible before the
+index that hands it over. SIZE must be a power of two.
+
+push() does not wait when the ring is full, it returns false and the
+caller decides what to drop.
+*/
+template <class T, size_t SIZE>
+class SpscRing
+{
+	static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "SpscRing size must be a power of two");
+
+private:
+	T slots[SIZE];
+	std::atomic<size_t> head; // next slot to write
+	std::atomic<size_t> tail; // next slot to read
+
+public:
+	SpscRing() : head(0), tail(0) {}
+
+	// producer only
+	bool push(const T &value)
+	{
+		size_t write = head.load(std::memory_order_relaxed);
+		if (write - tail.load(std::memory_order_acquire) == SIZE)
+		{
+			return false;
+		}
+		slots[write & (SIZE - 1)] = value;
+		head.store(write + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer only
+	bool pop(T &value)
+	{
+		size_t read = tail.load(std::memory_order_relaxed);
+		if (head.load(std::memory_order_acquire) == read)
+		{
+			return false;
+		}
+		value = slots[read & (SIZE - 1)];
+		tail.store(read + 1, std::memory_order_release);
+		return true;
+	}
+
+	// only exact when called from one of the two tasks while the other is idle
+	size_t size() const
+	{
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+	bool empty() const { return size() == 0; }
+};
+
+/*
+The newest value from one task to another, e.g. a frame for the OLED
+task. Three slots: the writer fills its own, publish() swaps it with the
+one in the middle, and take() swaps the middle with the reader's own. No
+slot is ever used by both tasks at once, a value that was not taken is
+overwritten by the next one, and take() always gets the newest. Neither
+side waits for the other.
+*/
+template <class T>
+class SpscMailbox
+{
+private:
+	static const uint8_t FRESH = 4; // the middle slot holds a value that was not taken
+
+	T slots[3];
+	std::atomic<uint8_t> middle; // slot index, with FRESH
+	uint8_t back;                // writer only
+	uint8_t front;               // reader only
+
+public:
+	SpscMailbox() : middle(1), back(0), front(2) {}
+
+	// writer only: the slot to put the next value in
+	T &slot() { return slots[back]; }
+
+	// writer only: hands over the value in slot(), false if it replaced one that was not taken
+	bool publish()
+	{
+		uint8_t old = middle.exchange(uint8_t(back | FRESH), std::memory_order_acq_rel);
+		back = old & 3;
+		return (old & FRESH) == 0;
+	}
+
+	// reader only: the newest value, valid until the next take(). NULL if there is nothing new
+	const T *take()
+	{
+		if ((middle.load(std::memory_order_acquire) & FRESH) == 0)
+		{
+			return NULL;
+		}
+		uint8_t old = middle.exchange(front, std::memory_order_acq_rel);
+		front = old & 3;
+		return &slots[front];
+	}
+};
+
+#endif
@@ -0,0 +1,273 @@
+#include <storeForward.h>
+#include <stdio.h>
+
+// the first byte of every record, anything else is the end of what can be read
+const uint8_t RECORD_MARKER = 0xA5;
+
+static void put32(uint8_t *out, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		out[i] = uint8_t(value >> (8 * i));
+	}
+}
+
+static uint32_t get32(const uint8_t *in)
+{
+	return uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+}
+
+size_t encode_record(uint32_t sequence, uint32_t time, const char *topic, const uint8_t *payload, size_t length,
+					 uint8_t *out, size_t capacity)
+{
+	size_t topic_size = strlen(topic) + 1;
+	size_t size = LOG_HEADER_SIZE + topic_size + length;
+	if (topic_size > STORE_TOPIC_SIZE || length > 0xFFFF || size > capacity)
+	{
+		return 0;
+	}
+	out[0] = RECORD_MARKER;
+	out[1] = uint8_t(topic_size);
+	out[2] = uint8_t(length);
+	out[3] = uint8_t(length >> 8);
+	put32(out + 4, sequence);
+	put32(out + 8, time);
+	memcpy(out + LOG_HEADER_SIZE, topic, topic_size);
+	memcpy(out + LOG_HEADER_SIZE + topic_size, payload, length);
+	return size;
+}
+
+MessageLog::MessageLog(const LogDriver &driver, const StoreSettings &store_settings)
+	: driver(driver), settings(store_settings), first(0), used(0), read_offset(0), write_size(0), read_sequence(0),
+	  last_sequence(0), any(false), dropped(0)
+{
+	if (settings.segments < 2)
+	{
+		settings.segments = 2;
+	}
+	if (settings.segments > STORE_MAX_SEGMENTS)
+	{
+		settings.segments = STORE_MAX_SEGMENTS;
+	}
+}
+
+bool MessageLog::read_header(int segment, size_t offset, LoggedMessage &message) const
+{
+	uint8_t header[LOG_HEADER_SIZE];
+	if (driver.read(segment, offset, header, LOG_HEADER_SIZE) != LOG_HEADER_SIZE || header[0] != RECORD_MARKER ||
+		header[1] == 0 || header[1] > STORE_TOPIC_SIZE)
+	{
+		return false;
+	}
+	message.length = size_t(header[2]) | size_t(header[3]) << 8;
+	message.sequence = get32(header + 4);
+	message.time = get32(header + 8);
+	message.size = LOG_HEADER_SIZE + header[1] + message.length;
+	// a record cut short by a reset
+	return offset + message.size <= driver.size(segment);
+}
+
+void MessageLog::begin()
+{
+	used = 0;
+	read_offset = 0;
+	any = false;
+
+	// the segment with the oldest first record, the others follow it in the ring
+	int oldest = -1;
+	uint32_t oldest_sequence = 0;
+	for (int i = 0; i < settings.segments; i++)
+	{
+		LoggedMessage message;
+		if (driver.size(i) == 0)
+		{
+			continue;
+		}
+		if (!read_header(i, 0, message))
+		{
+			driver.remove(i);
+			continue;
+		}
+		first_sequence[i] = message.sequence;
+		if (oldest < 0 || int32_t(message.sequence - oldest_sequence) < 0)
+		{
+			oldest = i;
+			oldest_sequence = message.sequence;
+		}
+	}
+	if (oldest < 0)
+	{
+		return;
+	}
+
+	first = oldest;
+	for (int i = 0; i < settings.segments; i++)
+	{
+		int segment = (first + i) % settings.segments;
+		if (used == i && driver.size(segment) > 0)
+		{
+			used++;
+		}
+		else
+		{
+			// not in line with the rest, left from an older run
+			driver.remove(segment);
+		}
+	}
+	read_sequence = first_sequence[first];
+
+	// the end of the newest segment, and its last record
+	size_t offset = 0;
+	LoggedMessage message;
+	while (read_header(newest(), offset, message))
+	{
+		last_sequence = message.sequence;
+		offset += message.size;
+		any = true;
+	}
+	// after a record that was cut short the next one goes into a new segment
+	write_size = offset < driver.size(newest()) ? settings.segment_size : offset;
+}
+
+void MessageLog::next_segment(bool lost)
+{
+	if (used > 1)
+	{
+		int next = (first + 1) % settings.segments;
+		if (lost)
+		{
+			dropped += first_sequence[next] - read_sequence;
+		}
+		driver.remove(first);
+		first = next;
+		used--;
+		read_sequence = first_sequence[first];
+	}
+	else
+	{
+		if (lost && any)
+		{
+			dropped += last_sequence + 1 - read_sequence;
+		}
+		driver.remove(first);
+		// the next record starts the next segment, so the writes go round all of them
+		first = (first + 1) % settings.segments;
+		used = 0;
+		write_size = 0;
+	}
+	read_offset = 0;
+}
+
+bool MessageLog::append(const uint8_t *record, size_t size, uint32_t sequence)
+{
+	if (size == 0 || size > settings.segment_size)
+	{
+		return false;
+	}
+	if (used == 0 || write_size + size > settings.segment_size)
+	{
+		if (used == settings.segments)
+		{
+			next_segment(true);
+		}
+		used++;
+		driver.remove(newest());
+		first_sequence[newest()] = sequence;
+		write_size = 0;
+		if (used == 1)
+		{
+			read_offset = 0;
+			read_sequence = sequence;
+		}
+	}
+	size_t written = driver.append(newest(), record, size);
+	write_size += written;
+	if (written != size)
+	{
+		// the file system is full, the cut record ends the segment
+		write_size = settings.segment_size;
+		return false;
+	}
+	last_sequence = sequence;
+	any = true;
+	return true;
+}
+
+bool MessageLog::peek(uint8_t *record, size_t capacity, LoggedMessage &message)
+{
+	if (used == 0 || !read_header(first, read_offset, message) || message.size > capacity)
+	{
+		return false;
+	}
+	if (driver.read(first, read_offset, record, message.size) != message.size)
+	{
+		return false;
+	}
+	size_t topic_size = record[1];
+	message.topic = reinterpret_cast<const char *>(record + LOG_HEADER_SIZE);
+	message.payload = record + LOG_HEADER_SIZE + topic_size;
+	return message.topic[topic_size - 1] == '\0';
+}
+
+void MessageLog::pop(const LoggedMessage &message)
+{
+	read_offset += message.size;
+	read_sequence = message.sequence + 1;
+	size_t end = used == 1 ? write_size : driver.size(first);
+	if (read_offset >= end)
+	{
+		next_segment(false);
+	}
+}
+
+void MessageLog::skip()
+{
+	if (used > 0)
+	{
+		next_segment(true);
+	}
+}
+
+bool history_topic(const char *topic, char *out, size_t capacity)
+{
+	int length = snprintf(out, capacity, "%s/history", topic);
+	return length > 0 && size_t(length) < capacity;
+}
+
+size_t history_payload(const uint8_t *payload, size_t length, uint32_t sequence, uint32_t time, uint32_t age,
+					   uint8_t *out, size_t capacity)
+{
+	if (length > 0 && payload[0] == '{')
+	{
+		// the rest of the object after the "{", with a comma if it has members
+		size_t rest = 1;
+		while (rest < length && payload[rest] == ' ')
+		{
+			rest++;
+		}
+		bool members = rest < length && payload[rest] != '}';
+		char age_text[12] = "null";
+		if (age != HISTORY_AGE_UNKNOWN)
+		{
+			snprintf(age_text, sizeof(age_text), "%lu", (unsigned long)age);
+		}
+		int header = snprintf(reinterpret_cast<char *>(out), capacity, "{\"seq\": %lu, \"time\": %lu, \"age\": %s%s",
+							  (unsigned long)sequence, (unsigned long)time, age_text, members ? ", " : "");
+		if (header < 0 || size_t(header) + length - rest > capacity)
+		{
+			return 0;
+		}
+		memcpy(out + header, payload + rest, length - rest);
+		return size_t(header) + length - rest;
+	}
+
+	if (12 + length > capacity)
+	{
+		return 0;
+	}
+	put32(out, sequence);
+	put32(out + 4, time);
+	put32(out + 8, age);
+	memcpy(out + 12, payload, length);
+	return 12 + length;
+}
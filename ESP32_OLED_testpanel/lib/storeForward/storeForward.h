@@ -0,0 +1,310 @@
+#ifndef storeForward_h
+#define storeForward_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+Keeps the messages that could not be published while the broker was gone,
+and sends them on when it is back.
+
+A message is kept with the time it was first published and a sequence
+number, in a ring in RAM. When the ring is full, its older half is written
+to a log in flash, so a long outage is kept too. The log is a ring of
+segment files that are written one after the other and removed when they
+are sent, so the writes move over the whole file system. When all
+segments are full the oldest one is dropped: the log is bounded and the
+newest history is kept. The missing sequence numbers show what was lost.
+
+drain() sends at most "batch" messages every "drain_interval" ms, the
+oldest first, so the history does not starve the live messages after a
+reconnect.
+
+The log starts again from the beginning of the oldest segment after a
+reboot, so messages that were sent but not removed yet are sent again.
+The subscribers can tell them by the sequence number.
+
+The times are from a clock of the node that must go on over a reboot for
+the age of the history to mean anything, e.g. the RTC clock. If it did not
+(a power-on reset of the ESP32 starts it again), the messages from before
+the reboot are sent with an unknown age, see from_this_boot().
+*/
+
+// the longest topic, with the ending '\0'
+const size_t STORE_TOPIC_SIZE = 64;
+const int STORE_MAX_SEGMENTS = 16;
+
+// the file system under the log, on the board LittleFS (flashLog.h)
+struct LogDriver
+{
+	// adds to the end of a segment, returns the bytes written
+	size_t (*append)(int segment, const uint8_t *data, size_t length);
+	// returns the bytes read, fewer at the end of the segment
+	size_t (*read)(int segment, size_t offset, uint8_t *data, size_t length);
+	// 0 if the segment is not there
+	size_t (*size)(int segment);
+	void (*remove)(int segment);
+};
+
+struct StoreSettings
+{
+	int segments;                 // files in the log, 2 to STORE_MAX_SEGMENTS
+	size_t segment_size;          // bytes per file
+	int batch;                    // messages per drain
+	unsigned long drain_interval; // ms between two drains
+};
+
+// 16 x 32 kB of log, and 40 messages a second while the history is sent
+const StoreSettings STORE_DEFAULTS = {16, 32768, 8, 200};
+
+// sends a kept message, returns false if it could not be sent
+typedef bool (*ForwardFunction)(const char *topic, const uint8_t *payload, size_t length, uint32_t sequence,
+								uint32_t time);
+
+// a message as it is in the log, the topic and the payload point into the read buffer
+struct LoggedMessage
+{
+	uint32_t sequence;
+	uint32_t time;
+	const char *topic;
+	const uint8_t *payload;
+	size_t length;
+	size_t size; // bytes of the record in the log
+};
+
+// what a record takes in the log besides the topic and the payload
+const size_t LOG_HEADER_SIZE = 12;
+
+/*
+a record of the log: a marker byte, the topic length with its '\0', the
+payload length, the sequence and the time, all little-endian, then the
+topic and the payload. returns the size, 0 if it does not fit
+*/
+size_t encode_record(uint32_t sequence, uint32_t time, const char *topic, const uint8_t *payload, size_t length,
+					 uint8_t *out, size_t capacity);
+
+/*
+The log in flash. Records are written one after the other into the
+newest segment and read from the oldest one.
+*/
+class MessageLog
+{
+private:
+	const LogDriver &driver;
+	StoreSettings settings;
+	int first;              // the oldest segment
+	int used;               // segments from first on that are in use
+	size_t read_offset;     // in the oldest segment
+	size_t write_size;      // of the newest segment
+	uint32_t read_sequence; // of the next record in the oldest segment
+	uint32_t first_sequence[STORE_MAX_SEGMENTS];
+	uint32_t last_sequence;
+	bool any; // last_sequence is valid
+	unsigned long dropped;
+
+	int newest() const { return (first + used - 1) % settings.segments; }
+	// the oldest segment is done with, "lost" if it was not sent
+	void next_segment(bool lost);
+	bool read_header(int segment, size_t offset, LoggedMessage &message) const;
+
+public:
+	MessageLog(const LogDriver &driver, const StoreSettings &settings);
+
+	// finds the segments that are left from before a reboot
+	void begin();
+
+	// a record from encode_record, false if it could not be written
+	bool append(const uint8_t *record, size_t size, uint32_t sequence);
+
+	// the oldest record, read into record. false if there is none or it can not be read
+	bool peek(uint8_t *record, size_t capacity, LoggedMessage &message);
+	// the record from peek() was sent
+	void pop(const LoggedMessage &message);
+	// the rest of the oldest segment can not be read, it is dropped
+	void skip();
+
+	bool empty() const { return used == 0; }
+	// the sequence of the newest record, valid if has_records()
+	uint32_t get_last_sequence() const { return last_sequence; }
+	bool has_records() const { return any; }
+	// records dropped because the log was full or could not be read
+	unsigned long get_dropped() const { return dropped; }
+	int get_used() const { return used; }
+};
+
+/*
+the topic a kept message is sent on: the topic with "/history" after it,
+so a subscriber of the live topic does not take old values for new ones.
+false if it does not fit
+*/
+bool history_topic(const char *topic, char *out, size_t capacity);
+
+// the age of a kept message from before a reboot, when the clock did not go on over it
+const uint32_t HISTORY_AGE_UNKNOWN = 0xFFFFFFFF;
+
+/*
+the payload of a kept message: a JSON object gets "seq", "time" and "age"
+(ms from the first publish to now, null if HISTORY_AGE_UNKNOWN) as its first
+members, anything else gets them in front as three little-endian uint32.
+returns the length, 0 if it does not fit
+*/
+size_t history_payload(const uint8_t *payload, size_t length, uint32_t sequence, uint32_t time, uint32_t age,
+					   uint8_t *out, size_t capacity);
+
+// the extra bytes history_payload adds at most
+const size_t HISTORY_PAYLOAD_EXTRA = 64;
+
+/*
+The RAM ring in front of the log, for SLOTS messages of up to PAYLOAD
+bytes. A bigger message is not kept, see get_too_big().
+*/
+template <int SLOTS, size_t PAYLOAD>
+class StoreForward
+{
+private:
+	struct Slot
+	{
+		uint32_t sequence;
+		uint32_t time;
+		uint16_t length;
+		char topic[STORE_TOPIC_SIZE];
+		uint8_t payload[PAYLOAD];
+	};
+
+	Slot slots[SLOTS];
+	int head;
+	int count;
+	MessageLog log;
+	StoreSettings settings;
+	uint8_t record[LOG_HEADER_SIZE + STORE_TOPIC_SIZE + PAYLOAD];
+	uint32_t next_sequence;
+	uint32_t boot_sequence; // the first one stored since begin()
+	unsigned long last_drain;
+	unsigned long stored;
+	unsigned long forwarded;
+	unsigned long too_big;
+	unsigned long lost; // could not be written to the log
+
+	// writes the oldest "spill" slots to the log
+	void spill(int spill)
+	{
+		for (; spill > 0 && count > 0; spill--)
+		{
+			const Slot &slot = slots[head];
+			size_t size =
+				encode_record(slot.sequence, slot.time, slot.topic, slot.payload, slot.length, record, sizeof(record));
+			if (!log.append(record, size, slot.sequence))
+			{
+				lost++;
+			}
+			head = (head + 1) % SLOTS;
+			count--;
+		}
+	}
+
+public:
+	explicit StoreForward(const LogDriver &driver, const StoreSettings &store_settings = STORE_DEFAULTS)
+		: head(0), count(0), log(driver, store_settings), settings(store_settings), next_sequence(0),
+		  boot_sequence(0), last_drain(0), stored(0), forwarded(0), too_big(0), lost(0)
+	{
+	}
+
+	// takes up the log from before a reboot, the sequence goes on from its newest record
+	void begin()
+	{
+		log.begin();
+		if (log.has_records())
+		{
+			next_sequence = log.get_last_sequence() + 1;
+		}
+		boot_sequence = next_sequence;
+	}
+
+	// keeps a message that could not be published at "time"
+	bool store(uint32_t time, const char *topic, const uint8_t *payload, size_t length)
+	{
+		if (length > PAYLOAD || strlen(topic) >= STORE_TOPIC_SIZE)
+		{
+			too_big++;
+			return false;
+		}
+		if (count == SLOTS)
+		{
+			// half the ring at a time, so the flash is written in bursts and not for every message
+			spill((SLOTS + 1) / 2);
+		}
+		Slot &slot = slots[(head + count) % SLOTS];
+		slot.sequence = next_sequence++;
+		slot.time = time;
+		slot.length = uint16_t(length);
+		strcpy(slot.topic, topic);
+		memcpy(slot.payload, payload, length);
+		count++;
+		stored++;
+		return true;
+	}
+
+	// writes everything in RAM to the log, before a deep sleep
+	void flush() { spill(count); }
+
+	// sends the oldest messages, at most settings.batch every settings.drain_interval ms
+	int drain(unsigned long now, ForwardFunction forward)
+	{
+		if (empty() || now - last_drain < settings.drain_interval)
+		{
+			return 0;
+		}
+		last_drain = now;
+		int sent = 0;
+		while (sent < settings.batch)
+		{
+			if (!log.empty())
+			{
+				LoggedMessage message;
+				if (!log.peek(record, sizeof(record), message))
+				{
+					log.skip();
+					continue;
+				}
+				if (!forward(message.topic, message.payload, message.length, message.sequence, message.time))
+				{
+					break;
+				}
+				log.pop(message);
+			}
+			else if (count > 0)
+			{
+				const Slot &slot = slots[head];
+				if (!forward(slot.topic, slot.payload, slot.length, slot.sequence, slot.time))
+				{
+					break;
+				}
+				head = (head + 1) % SLOTS;
+				count--;
+			}
+			else
+			{
+				break;
+			}
+			sent++;
+			forwarded++;
+		}
+		return sent;
+	}
+
+	bool empty() const { return count == 0 && log.empty(); }
+	// false for a message that was stored before the last reboot
+	bool from_this_boot(uint32_t sequence) const { return int32_t(sequence - boot_sequence) >= 0; }
+	// messages in RAM, that a reset would lose
+	int in_ram() const { return count; }
+	int segments_used() const { return log.get_used(); }
+
+	unsigned long get_stored() const { return stored; }
+	unsigned long get_forwarded() const { return forwarded; }
+	// dropped with the oldest segment when the log was full
+	unsigned long get_dropped() const { return log.get_dropped() + lost; }
+	unsigned long get_too_big() const { return too_big; }
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef bayLayout_h
+#define bayLayout_h
+
+// all telemetry is published under this prefix
+#define TOPIC_PREFIX "esp32/output/"
+
+// full topic as one string literal, so it is kept in flash and never built at runtime
+#define TOPIC(name) TOPIC_PREFIX name
+
+// description of one parking bay on the panel
+struct BayDescription
+{
+	int pin;            // port from the bay button to ESP32
+	const char *number; // bay number used in the powergrid messages
+	const char *topic;  // full parking topic
+	const char *owner;  // owner of the parking message
+};
+
+// BAY(pin, number) describes bay "number" with its button on "pin"
+#define BAY(pin, number) {pin, #number, TOPIC("parking_" #number), "button_" #number}
+
+#endif
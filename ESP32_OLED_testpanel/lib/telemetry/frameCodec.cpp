@@ -0,0 +1,84 @@
+#include <frameCodec.h>
+
+BinaryWriter::BinaryWriter(uint8_t *buffer, size_t capacity) : buffer(buffer), capacity(capacity)
+{
+	reset();
+}
+
+void BinaryWriter::reset()
+{
+	used = 0;
+	full = false;
+}
+
+void BinaryWriter::put(uint32_t value, size_t bytes)
+{
+	if (full || used + bytes > capacity)
+	{
+		full = true;
+		return;
+	}
+	for (size_t i = 0; i < bytes; i++)
+	{
+		buffer[used++] = uint8_t(value >> (8 * i));
+	}
+}
+
+void encode_frame_header(BinaryWriter &out, const FrameHeader &header)
+{
+	out.u8(FRAME_VERSION);
+	out.u8(header.charging ? 1 : 0);
+	out.u16(header.bays);
+	out.i32(header.grid);
+	out.i32(header.need);
+	out.i32(header.batteryPark);
+	out.u16(header.parking_status);
+}
+
+void encode_frame_bay(BinaryWriter &out, const FrameBay &bay)
+{
+	out.u16(bay.number);
+	out.u8((bay.parked ? 1 : 0) | (bay.decharging ? 2 : 0) | (bay.charged ? 4 : 0));
+	out.u8(bay.battery_status);
+	out.u32(bay.timeParked);
+}
+
+static uint32_t get(const uint8_t *data, size_t bytes)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < bytes; i++)
+	{
+		value |= uint32_t(data[i]) << (8 * i);
+	}
+	return value;
+}
+
+bool decode_frame(const uint8_t *data, size_t length, FrameHeader &header, FrameBay bays[], int max_bays)
+{
+	if (length < FRAME_BINARY_HEADER_SIZE || data[0] != FRAME_VERSION)
+	{
+		return false;
+	}
+	header.charging = (data[1] & 1) != 0;
+	header.bays = uint16_t(get(data + 2, 2));
+	header.grid = int32_t(get(data + 4, 4));
+	header.need = int32_t(get(data + 8, 4));
+	header.batteryPark = int32_t(get(data + 12, 4));
+	header.parking_status = uint16_t(get(data + 16, 2));
+	if (length != FRAME_BINARY_HEADER_SIZE + header.bays * FRAME_BINARY_BAY_SIZE)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < header.bays && i < max_bays; i++)
+	{
+		const uint8_t *bay = data + FRAME_BINARY_HEADER_SIZE + i * FRAME_BINARY_BAY_SIZE;
+		bays[i].number = uint16_t(get(bay, 2));
+		bays[i].parked = (bay[2] & 1) != 0;
+		bays[i].decharging = (bay[2] & 2) != 0;
+		bays[i].charged = (bay[2] & 4) != 0;
+		bays[i].battery_status = bay[3];
+		bays[i].timeParked = get(bay + 4, 4);
+	}
+	return true;
+}
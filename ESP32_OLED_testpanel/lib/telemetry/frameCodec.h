@@ -0,0 +1,90 @@
+#ifndef frameCodec_h
+#define frameCodec_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Packed binary version of the telemetry frame, for TELEMETRY_BINARY.
+
+All numbers are little endian. Version 1:
+
+  offset  size  field
+  0       1     version (FRAME_VERSION)
+  1       1     flags, bit 0: the grid had power to spare (charging)
+  2       2     number of bays
+  4       4     grid (signed)
+  8       4     need (signed)
+  12      4     batteryPark (signed)
+  16      2     parking_status
+  18      8     first bay, then one after the other:
+                  2 bay number
+                  1 flags, bit 0: parked (amount), bit 1: decharging, bit 2: charged
+                  1 battery status in %
+                  4 time parked
+
+A decoder must refuse a version it does not know.
+*/
+const uint8_t FRAME_VERSION = 1;
+const size_t FRAME_BINARY_HEADER_SIZE = 18;
+const size_t FRAME_BINARY_BAY_SIZE = 8;
+
+struct FrameHeader
+{
+	bool charging;
+	uint16_t bays;
+	int32_t grid;
+	int32_t need;
+	int32_t batteryPark;
+	uint16_t parking_status;
+};
+
+struct FrameBay
+{
+	uint16_t number;
+	bool parked;
+	bool decharging;
+	bool charged;
+	uint8_t battery_status;
+	uint32_t timeParked;
+};
+
+/*
+Writes little endian numbers into a fixed buffer. If the buffer is too
+small nothing more is written and overflow() returns true.
+*/
+class BinaryWriter
+{
+private:
+	uint8_t *buffer;
+	size_t capacity;
+	size_t used;
+	bool full;
+
+	void put(uint32_t value, size_t bytes);
+
+public:
+	BinaryWriter(uint8_t *buffer, size_t capacity);
+
+	void reset();
+	void u8(uint8_t value) { put(value, 1); }
+	void u16(uint16_t value) { put(value, 2); }
+	void u32(uint32_t value) { put(value, 4); }
+	void i32(int32_t value) { put(uint32_t(value), 4); }
+
+	const uint8_t *data() const { return buffer; }
+	size_t length() const { return used; }
+	bool overflow() const { return full; }
+};
+
+// starts a frame, the bays must follow with encode_frame_bay
+void encode_frame_header(BinaryWriter &out, const FrameHeader &header);
+void encode_frame_bay(BinaryWriter &out, const FrameBay &bay);
+
+/*
+reads a frame, the first max_bays bays are stored in "bays". returns
+false if the version is unknown or the length does not match
+*/
+bool decode_frame(const uint8_t *data, size_t length, FrameHeader &header, FrameBay bays[], int max_bays);
+
+#endif
@@ -0,0 +1,91 @@
+#include <telemetry.h>
+
+JsonWriter::JsonWriter(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity)
+{
+	reset();
+}
+
+void JsonWriter::reset()
+{
+	used = 0;
+	full = false;
+	buffer[0] = '\0';
+}
+
+void JsonWriter::put(char c)
+{
+	// one byte is always kept for the ending '\0'
+	if (used + 1 >= capacity)
+	{
+		full = true;
+		return;
+	}
+	buffer[used++] = c;
+	buffer[used] = '\0';
+}
+
+JsonWriter &JsonWriter::raw(const char *text)
+{
+	while (*text != '\0')
+	{
+		put(*text++);
+	}
+	return *this;
+}
+
+JsonWriter &JsonWriter::string(const char *text)
+{
+	put('"');
+	// only quotes and backslashes have to be escaped in the names we send
+	for (; *text != '\0'; text++)
+	{
+		if (*text == '"' || *text == '\\')
+		{
+			put('\\');
+		}
+		put(*text);
+	}
+	put('"');
+	return *this;
+}
+
+JsonWriter &JsonWriter::number(long value)
+{
+	// written backwards into a small buffer, 20 digits and a sign fits any long
+	char digits[22];
+	char *first = digits + sizeof(digits) - 1;
+	*first = '\0';
+
+	unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+	do
+	{
+		*--first = char('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude != 0);
+	if (value < 0)
+	{
+		*--first = '-';
+	}
+	return raw(first);
+}
+
+void message_payload(JsonWriter &json, const char *owner, const char *message)
+{
+	json.reset();
+	json.raw("{\"owner\": ").string(owner).raw(", \"message\": ").raw(message).raw("}");
+}
+
+void message_payload(JsonWriter &json, const char *owner, long message)
+{
+	json.reset();
+	json.raw("{\"owner\": ").string(owner).raw(", \"message\": ").number(message).raw("}");
+}
+
+void parking_payload(JsonWriter &json, const char *owner, int amount, long timeParked, int battery_status)
+{
+	json.reset();
+	json.raw("{\"owner\": ").string(owner);
+	json.raw(", \"amount\": ").number(amount);
+	json.raw(", \"timeParked\": ").number(timeParked);
+	json.raw(" , \"battery_status\": ").number(battery_status).raw("}");
+}
@@ -0,0 +1,507 @@
+#ifndef telemetry_h
+#define telemetry_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <gridDispatch.h>
+#include <fleetTable.h>
+#include <bayLayout.h>
+#include <frameCodec.h>
+#include <profiler.h>
+
+// the topics that are not per bay
+static const char TOPIC_BATTERY[] = TOPIC("battery");
+static const char TOPIC_PARKING_STATUS[] = TOPIC("parking_status");
+static const char TOPIC_GRID_NEED[] = TOPIC("powergrid/need");
+static const char TOPIC_GRID_BATTERY_PARK[] = TOPIC("powergrid/batteryPark");
+static const char TOPIC_GRID_DECHARGING[] = TOPIC("powergrid/decharging");
+static const char TOPIC_GRID_CHARGING[] = TOPIC("powergrid/charging");
+
+// everything from one tick in one message, see TELEMETRY_FRAME
+static const char TOPIC_FRAME[] = TOPIC("frame");
+// the same frame packed as in frameCodec.h, see TELEMETRY_BINARY
+static const char TOPIC_FRAME_BINARY[] = TOPIC("frame/bin");
+
+// room for the biggest payload, the parking message is about 90 bytes
+const size_t TELEMETRY_BUFFER_SIZE = 128;
+
+/*
+Writes JSON text into a fixed buffer, without using the heap. If the
+buffer is too small the text is cut and overflow() returns true.
+*/
+class JsonWriter
+{
+private:
+	char *buffer;
+	size_t capacity;
+	size_t used;
+	bool full;
+
+	void put(char c);
+
+public:
+	JsonWriter(char *buffer, size_t capacity);
+
+	// starts a new text in the same buffer
+	void reset();
+
+	// text as it is
+	JsonWriter &raw(const char *text);
+	// text in quotes
+	JsonWriter &string(const char *text);
+	// a whole number
+	JsonWriter &number(long value);
+
+	const char *c_str() const { return buffer; }
+	size_t length() const { return used; }
+	bool overflow() const { return full; }
+};
+
+// {"owner": "<owner>", "message": <message>}
+void message_payload(JsonWriter &json, const char *owner, const char *message);
+void message_payload(JsonWriter &json, const char *owner, long message);
+
+// {"owner": "<owner>", "amount": <amount>, "timeParked": <timeParked> , "battery_status": <battery_status>}
+void parking_payload(JsonWriter &json, const char *owner, int amount, long timeParked, int battery_status);
+
+// frame bytes per bay, a bay with the biggest numbers is about 100 bytes
+const size_t FRAME_BAY_SIZE = 112;
+// frame bytes that are not per bay
+const size_t FRAME_HEADER_SIZE = 160;
+
+// what the testpanel publishes every tick
+enum TelemetryMode
+{
+	TELEMETRY_MESSAGES, // one message per value, on the topics the dashboard subscribes to
+	TELEMETRY_FRAME,    // one message with all bays and grid figures on TOPIC_FRAME
+	TELEMETRY_BINARY,   // the frame packed as binary on TOPIC_FRAME_BINARY
+};
+
+/*
+How far a value may move before it is sent again when only changes are
+published, see TelemetryPublisher::set_delta. A deadband of 0 sends every
+change. Everything is sent again every keyframe_interval ms, so a
+subscriber that comes late gets the whole state.
+*/
+struct DeltaSettings
+{
+	long grid_deadband;              // W, for the potentiometer, need and batteryPark
+	int battery_deadband;            // % battery status
+	long time_deadband;              // seconds parked
+	unsigned long keyframe_interval; // ms
+};
+
+const DeltaSettings TELEMETRY_DELTA_DEFAULTS = {100, 1, 30, 30000};
+
+// what the dashboard shows for a bay after the decharging and charging messages of a tick
+enum BayStatus
+{
+	BAY_UNKNOWN,
+	BAY_STANDBY,
+	BAY_DISCHARGE,
+	BAY_CHARGE,
+};
+
+// sends one message, returns false if it could not be sent
+typedef bool (*PublishFunction)(const char *topic, const uint8_t *payload, size_t length);
+
+// what happened in one control tick
+template <int BAYS>
+struct TickReport
+{
+	int grid;              // load on the grid from the potentiometer
+	DispatchResult result; // what the parked cars gave
+	bool charging;         // the grid had power to spare, "charged" is valid
+	BitFlags<BAYS> charged;
+	unsigned long time; // millis() at the tick, for the keyframes
+};
+
+/*
+Publishes the messages of one control tick. The payload is written into
+a fixed buffer and all topics are string literals, so publishing does not
+use the heap.
+*/
+template <int BAYS>
+class TelemetryPublisher
+{
+public:
+	// the biggest frame, the MQTT client buffer must have room for it
+	static const size_t FRAME_SIZE = FRAME_HEADER_SIZE + BAYS * FRAME_BAY_SIZE;
+
+private:
+	const BayDescription *layout;
+	const FleetTable<BAYS> &fleet;
+	PublishFunction publish;
+	TelemetryMode mode;
+
+	char buffer[TELEMETRY_BUFFER_SIZE];
+	JsonWriter json;
+
+	// shared by the JSON and the binary frame, only one of them is sent per tick
+	char frame_buffer[FRAME_SIZE];
+	JsonWriter frame_json;
+	BinaryWriter frame_binary;
+
+	// what the subscribers were last sent, only kept when delta is on
+	bool delta;
+	DeltaSettings deadband;
+	bool keyframe_sent;
+	unsigned long last_keyframe;
+	long sent_grid;
+	long sent_need;
+	long sent_battery_park;
+	int sent_parking_status;
+	BitFlags<BAYS> sent_parked;
+	uint8_t sent_status[BAYS];
+	int32_t sent_battery[BAYS];
+	int32_t sent_time[BAYS];
+
+	static bool moved(long value, long last, long band)
+	{
+		return value - last > band || last - value > band;
+	}
+
+	BayStatus status(const TickReport<BAYS> &report, int bay) const
+	{
+		// the charging message comes after the decharging message, so it wins
+		if (report.charging && report.charged.get(bay))
+		{
+			return BAY_CHARGE;
+		}
+		return fleet.decharging.get(bay) ? BAY_DISCHARGE : BAY_STANDBY;
+	}
+
+	bool bay_changed(int bay) const
+	{
+		return fleet.parked.get(bay) != sent_parked.get(bay) ||
+			   moved(fleet.battery_percent(bay), sent_battery[bay], deadband.battery_deadband) ||
+			   moved(fleet.timeParked[bay], sent_time[bay], deadband.time_deadband);
+	}
+
+	void remember_bay(int bay)
+	{
+		sent_parked.set(bay, fleet.parked.get(bay));
+		sent_battery[bay] = fleet.battery_percent(bay);
+		sent_time[bay] = fleet.timeParked[bay];
+	}
+
+	void remember(const TickReport<BAYS> &report)
+	{
+		sent_grid = report.grid;
+		sent_need = report.result.battery_need;
+		sent_battery_park = report.result.power_given_from_battery;
+		sent_parking_status = fleet.parked_count();
+		for (int i = 0; i < BAYS; i++)
+		{
+			sent_status[i] = uint8_t(status(report, i));
+			remember_bay(i);
+		}
+	}
+
+	// true if a frame would show something the subscribers do not have
+	bool changed(const TickReport<BAYS> &report) const
+	{
+		if (moved(report.grid, sent_grid, deadband.grid_deadband) ||
+			moved(report.result.battery_need, sent_need, deadband.grid_deadband) ||
+			moved(report.result.power_given_from_battery, sent_battery_park, deadband.grid_deadband) ||
+			fleet.parked_count() != sent_parking_status)
+		{
+			return true;
+		}
+		for (int i = 0; i < BAYS; i++)
+		{
+			if (status(report, i) != sent_status[i] || bay_changed(i))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool send(const char *topic, const JsonWriter &payload)
+	{
+		// a payload that did not fit is never sent cut
+		return !payload.overflow() &&
+			   publish(topic, reinterpret_cast<const uint8_t *>(payload.c_str()), payload.length());
+	}
+
+	bool send(const char *topic, const BinaryWriter &payload)
+	{
+		return !payload.overflow() && publish(topic, payload.data(), payload.length());
+	}
+
+	// returns false if any of the messages could not be sent
+	bool messages(const TickReport<BAYS> &report)
+	{
+		bool sent = message(TOPIC_GRID_NEED, "grid", long(report.result.battery_need));
+		sent &= message(TOPIC_GRID_BATTERY_PARK, "grid", long(report.result.power_given_from_battery));
+		for (int i = 0; i < BAYS; i++)
+		{
+			sent &= message(TOPIC_GRID_DECHARGING, fleet.decharging.get(i) ? "discharge" : "standby", layout[i].number);
+		}
+		if (report.charging)
+		{
+			for (int i = 0; i < BAYS; i++)
+			{
+				if (report.charged.get(i))
+				{
+					sent &= message(TOPIC_GRID_CHARGING, "charge", layout[i].number);
+				}
+				if (!fleet.parked.get(i))
+				{
+					sent &= message(TOPIC_GRID_CHARGING, "standby", layout[i].number);
+				}
+			}
+		}
+
+		sent &= message(TOPIC_BATTERY, "pot_meter", long(report.grid));
+		for (int i = 0; i < BAYS; i++)
+		{
+			sent &= parking(i);
+		}
+		sent &= message(TOPIC_PARKING_STATUS, "parking_status", long(fleet.parked_count()));
+		return sent;
+	}
+
+	/*
+	only the messages that changed since they were last sent. a bay gets one
+	status message, on the topic that gives the dashboard the same status as
+	the full messages would
+	*/
+	void delta_messages(const TickReport<BAYS> &report)
+	{
+		if (moved(report.result.battery_need, sent_need, deadband.grid_deadband) &&
+			message(TOPIC_GRID_NEED, "grid", long(report.result.battery_need)))
+		{
+			sent_need = report.result.battery_need;
+		}
+		if (moved(report.result.power_given_from_battery, sent_battery_park, deadband.grid_deadband) &&
+			message(TOPIC_GRID_BATTERY_PARK, "grid", long(report.result.power_given_from_battery)))
+		{
+			sent_battery_park = report.result.power_given_from_battery;
+		}
+		for (int i = 0; i < BAYS; i++)
+		{
+			BayStatus now = status(report, i);
+			if (now == sent_status[i])
+			{
+				continue;
+			}
+			bool sent = now == BAY_CHARGE
+							? message(TOPIC_GRID_CHARGING, "charge", layout[i].number)
+							: message(TOPIC_GRID_DECHARGING, now == BAY_DISCHARGE ? "discharge" : "standby",
+									  layout[i].number);
+			if (sent)
+			{
+				sent_status[i] = uint8_t(now);
+			}
+		}
+
+		if (moved(report.grid, sent_grid, deadband.grid_deadband) &&
+			message(TOPIC_BATTERY, "pot_meter", long(report.grid)))
+		{
+			sent_grid = report.grid;
+		}
+		for (int i = 0; i < BAYS; i++)
+		{
+			if (bay_changed(i) && parking(i))
+			{
+				remember_bay(i);
+			}
+		}
+		int parked = fleet.parked_count();
+		if (parked != sent_parking_status && message(TOPIC_PARKING_STATUS, "parking_status", long(parked)))
+		{
+			sent_parking_status = parked;
+		}
+	}
+
+	/*
+	{"owner": "testpanel", "grid": <grid>, "need": <need>, "batteryPark": <given>,
+	 "parking_status": <parked>, "charging": <0/1>, "bays": [{"number": <number>,
+	 "amount": <0/1>, "timeParked": <time>, "battery_status": <%>, "decharging": <0/1>,
+	 "charged": <0/1>}, ...]}
+	*/
+	bool frame(const TickReport<BAYS> &report)
+	{
+		frame_json.reset();
+		frame_json.raw("{\"owner\": \"testpanel\", \"grid\": ").number(report.grid);
+		frame_json.raw(", \"need\": ").number(report.result.battery_need);
+		frame_json.raw(", \"batteryPark\": ").number(report.result.power_given_from_battery);
+		frame_json.raw(", \"parking_status\": ").number(fleet.parked_count());
+		frame_json.raw(", \"charging\": ").number(report.charging);
+		frame_json.raw(", \"bays\": [");
+		for (int i = 0; i < BAYS; i++)
+		{
+			frame_json.raw(i == 0 ? "{\"number\": " : ", {\"number\": ").raw(layout[i].number);
+			frame_json.raw(", \"amount\": ").number(fleet.parked.get(i));
+			frame_json.raw(", \"timeParked\": ").number(fleet.timeParked[i]);
+			frame_json.raw(", \"battery_status\": ").number(fleet.battery_percent(i));
+			frame_json.raw(", \"decharging\": ").number(fleet.decharging.get(i));
+			frame_json.raw(", \"charged\": ").number(report.charging && report.charged.get(i));
+			frame_json.raw("}");
+		}
+		frame_json.raw("]}");
+		return send(TOPIC_FRAME, frame_json);
+	}
+
+	// the same figures as frame(), packed as in frameCodec.h
+	bool binary_frame(const TickReport<BAYS> &report)
+	{
+		FrameHeader header;
+		header.charging = report.charging;
+		header.bays = uint16_t(BAYS);
+		header.grid = report.grid;
+		header.need = report.result.battery_need;
+		header.batteryPark = report.result.power_given_from_battery;
+		header.parking_status = uint16_t(fleet.parked_count());
+
+		frame_binary.reset();
+		encode_frame_header(frame_binary, header);
+		for (int i = 0; i < BAYS; i++)
+		{
+			int battery = fleet.battery_percent(i);
+			FrameBay bay;
+			bay.number = uint16_t(atoi(layout[i].number));
+			bay.parked = fleet.parked.get(i);
+			bay.decharging = fleet.decharging.get(i);
+			bay.charged = report.charging && report.charged.get(i);
+			bay.battery_status = uint8_t(battery < 0 ? 0 : battery > 255 ? 255 : battery);
+			bay.timeParked = uint32_t(fleet.timeParked[i]);
+			encode_frame_bay(frame_binary, bay);
+		}
+		return send(TOPIC_FRAME_BINARY, frame_binary);
+	}
+
+public:
+	TelemetryPublisher(const BayDescription bay_layout[], const FleetTable<BAYS> &fleet_table,
+					   PublishFunction publish_function)
+		: layout(bay_layout), fleet(fleet_table), publish(publish_function), mode(TELEMETRY_MESSAGES),
+		  json(buffer, sizeof(buffer)), frame_json(frame_buffer, sizeof(frame_buffer)),
+		  frame_binary(reinterpret_cast<uint8_t *>(frame_buffer), sizeof(frame_buffer)), delta(false),
+		  deadband(TELEMETRY_DELTA_DEFAULTS), keyframe_sent(false), last_keyframe(0)
+	{
+	}
+
+	void set_mode(TelemetryMode telemetry_mode) { mode = telemetry_mode; }
+	TelemetryMode get_mode() const { return mode; }
+
+	// only publish what changed, with a keyframe every deadband.keyframe_interval ms
+	void set_delta(bool enabled)
+	{
+		delta = enabled;
+		keyframe_sent = false;
+	}
+	bool get_delta() const { return delta; }
+
+	void set_deadband(const DeltaSettings &settings) { deadband = settings; }
+	const DeltaSettings &get_deadband() const { return deadband; }
+
+	bool message(const char *topic, const char *owner, const char *message)
+	{
+		message_payload(json, owner, message);
+		return send(topic, json);
+	}
+
+	bool message(const char *topic, const char *owner, long message)
+	{
+		message_payload(json, owner, message);
+		return send(topic, json);
+	}
+
+	bool parking(int bay)
+	{
+		PROFILE_ZONE("parking");
+		parking_payload(json, layout[bay].owner, fleet.parked.get(bay), fleet.timeParked[bay],
+						fleet.battery_percent(bay));
+		return send(layout[bay].topic, json);
+	}
+
+	/*
+	publishes everything the testpanel sends every tick, either as the
+	separate messages in the same order as before or as one frame. with
+	delta on, a keyframe is sent like that and the ticks between only send
+	the messages that changed, or the frame if anything in it changed
+	*/
+	void tick(const TickReport<BAYS> &report)
+	{
+		bool keyframe = !delta || !keyframe_sent || report.time - last_keyframe >= deadband.keyframe_interval;
+		if (!keyframe)
+		{
+			if (mode == TELEMETRY_MESSAGES)
+			{
+				delta_messages(report);
+				return;
+			}
+			if (!changed(report))
+			{
+				return;
+			}
+		}
+
+		bool sent;
+		if (mode == TELEMETRY_FRAME)
+		{
+			sent = frame(report);
+		}
+		else if (mode == TELEMETRY_BINARY)
+		{
+			sent = binary_frame(report);
+		}
+		else
+		{
+			sent = messages(report);
+		}
+
+		// a keyframe that could not be sent is tried again next tick
+		if (delta && sent)
+		{
+			remember(report);
+			if (keyframe)
+			{
+				keyframe_sent = true;
+				last_keyframe = report.time;
+			}
+		}
+	}
+};
+
+/*
+how far a tick is from the one that was last published, in deadbands: the
+biggest move of the grid load, the need or a battery, or 1 when a car came
+or left or started or stopped giving power. 1 or more is something the
+subscribers do not have yet, see PublishRate
+*/
+template <int BAYS>
+float telemetry_change(const TickReport<BAYS> &report, const FleetTable<BAYS> &fleet,
+					   const TickReport<BAYS> &sent_report, const FleetTable<BAYS> &sent_fleet,
+					   const DeltaSettings &deadband)
+{
+	float grid_band = deadband.grid_deadband > 0 ? float(deadband.grid_deadband) : 1.0f;
+	float battery_band = deadband.battery_deadband > 0 ? float(deadband.battery_deadband) : 1.0f;
+
+	float change = fabsf(float(report.grid - sent_report.grid)) / grid_band;
+	float need = fabsf(float(report.result.battery_need - sent_report.result.battery_need)) / grid_band;
+	if (need > change)
+	{
+		change = need;
+	}
+	for (int i = 0; i < BAYS; i++)
+	{
+		if (change < 1 && (fleet.parked.get(i) != sent_fleet.parked.get(i) ||
+						   fleet.decharging.get(i) != sent_fleet.decharging.get(i)))
+		{
+			change = 1;
+		}
+		float battery = fabsf(float(fleet.battery_percent(i) - sent_fleet.battery_percent(i))) / battery_band;
+		if (battery > change)
+		{
+			change = battery;
+		}
+	}
+	return change;
+}
+
+#endif
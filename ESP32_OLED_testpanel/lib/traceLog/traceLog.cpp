@@ -0,0 +1,77 @@
+#include <traceLog.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int trace_values(char kind)
+{
+	switch (kind)
+	{
+	case TRACE_SESSION:
+		return 4;
+	case TRACE_RESTORE:
+		return 6;
+	case TRACE_PRESS:
+		return 1;
+	case TRACE_COMMAND:
+		return 3;
+	case TRACE_TICK:
+		return 6;
+	case TRACE_LOST:
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+size_t format_trace(const TraceRecord &record, char *line, size_t size)
+{
+	int count = trace_values(record.kind);
+	if (count < 0)
+	{
+		return 0;
+	}
+	int length = snprintf(line, size, "T %c %lu", record.kind, (unsigned long)record.time);
+	for (int i = 0; i < count && length >= 0 && size_t(length) < size; i++)
+	{
+		length += snprintf(line + length, size - length, " %lld", (long long)record.value[i]);
+	}
+	if (length < 0 || size_t(length) >= size)
+	{
+		return 0;
+	}
+	return size_t(length);
+}
+
+bool parse_trace(const char *line, TraceRecord &record)
+{
+	const char *start = strstr(line, "T ");
+	if (start == NULL)
+	{
+		return false;
+	}
+	start += 2;
+	int count = trace_values(*start);
+	if (count < 0 || start[1] != ' ')
+	{
+		return false;
+	}
+	record = trace_record(*start, 0);
+
+	char *end;
+	record.time = uint32_t(strtoul(start + 2, &end, 10));
+	if (end == start + 2)
+	{
+		return false;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		const char *from = end;
+		record.value[i] = strtoll(from, &end, 10);
+		if (end == from)
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,154 @@
+#ifndef traceLog_h
+#define traceLog_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <fleetTable.h>
+#include <telemetry.h>
+
+// change it when a record kind or its values change
+const int TRACE_VERSION = 4;
+
+/*
+The record kinds, and what is in value[] for each:
+
+S session: seed of the battery generator, bays, TRACE_VERSION, the
+  DispatchPolicy. the first tick counts its time from here
+R restore: bay, parked, battery_status, timeParked, flags (1 charging,
+  2 held, 4 forced), parked_ms. a bay taken back from RTC memory after a
+  wake, right after the session
+P press: bay
+C command: BayCommand, bay, on
+K tick: grid, battery_need, power_given_from_battery, charging,
+  decharging and charged of the first 32 bays as bits
+L lost: records that did not fit in the queue, the trace has a hole here
+*/
+const char TRACE_SESSION = 'S';
+const char TRACE_RESTORE = 'R';
+const char TRACE_PRESS = 'P';
+const char TRACE_COMMAND = 'C';
+const char TRACE_TICK = 'K';
+const char TRACE_LOST = 'L';
+
+const int TRACE_VALUES = 6;
+
+struct TraceRecord
+{
+	char kind;
+	uint32_t time; // millis() on the panel
+	int64_t value[TRACE_VALUES];
+};
+
+// where the panel sends its trace
+enum TraceOutput
+{
+	TRACE_OFF,
+	TRACE_SERIAL, // lines on the serial port, mixed with the other output
+	TRACE_MQTT,   // one line per message on TOPIC_TRACE
+};
+
+static const char TOPIC_TRACE[] = TOPIC("trace");
+
+// the longest line format_trace() writes
+const size_t TRACE_LINE_SIZE = 160;
+
+// number of values of a kind, -1 for a kind that is not known
+int trace_values(char kind);
+
+/*
+writes the record as one line of text, "T <kind> <time> <values>", without
+a newline. returns the length, 0 if it does not fit
+*/
+size_t format_trace(const TraceRecord &record, char *line, size_t size);
+
+/*
+reads a line written by format_trace(). anything before the "T " is skipped
+and other lines give false, so a whole serial log can be read as a trace
+*/
+bool parse_trace(const char *line, TraceRecord &record);
+
+inline TraceRecord trace_record(char kind, unsigned long time)
+{
+	TraceRecord record;
+	record.kind = kind;
+	record.time = uint32_t(time);
+	for (int i = 0; i < TRACE_VALUES; i++)
+	{
+		record.value[i] = 0;
+	}
+	return record;
+}
+
+inline TraceRecord trace_session(unsigned long time, uint32_t seed, int bays, int policy)
+{
+	TraceRecord record = trace_record(TRACE_SESSION, time);
+	record.value[0] = seed;
+	record.value[1] = bays;
+	record.value[2] = TRACE_VERSION;
+	record.value[3] = policy;
+	return record;
+}
+
+inline TraceRecord trace_press(unsigned long time, int bay)
+{
+	TraceRecord record = trace_record(TRACE_PRESS, time);
+	record.value[0] = bay;
+	return record;
+}
+
+inline TraceRecord trace_command(unsigned long time, int command, int bay, bool on)
+{
+	TraceRecord record = trace_record(TRACE_COMMAND, time);
+	record.value[0] = command;
+	record.value[1] = bay;
+	record.value[2] = on;
+	return record;
+}
+
+inline TraceRecord trace_lost(unsigned long time, unsigned long lost)
+{
+	TraceRecord record = trace_record(TRACE_LOST, time);
+	record.value[0] = int64_t(lost);
+	return record;
+}
+
+// the first 32 flags as bits, the trace does not compare the rest
+template <int BAYS>
+int64_t trace_bits(const BitFlags<BAYS> &flags)
+{
+	uint32_t bits = 0;
+	for (int i = 0; i < BAYS && i < 32; i++)
+	{
+		bits |= uint32_t(flags.get(i)) << i;
+	}
+	return bits;
+}
+
+template <int BAYS>
+TraceRecord trace_restore(unsigned long time, const FleetTable<BAYS> &fleet, int bay)
+{
+	TraceRecord record = trace_record(TRACE_RESTORE, time);
+	record.value[0] = bay;
+	record.value[1] = fleet.parked.get(bay);
+	record.value[2] = fleet.battery_status[bay];
+	record.value[3] = fleet.timeParked[bay];
+	record.value[4] = fleet.charging.get(bay) | fleet.held.get(bay) << 1 | fleet.forced.get(bay) << 2;
+	record.value[5] = fleet.parked_ms[bay];
+	return record;
+}
+
+// the inputs and the outputs of a tick, the outputs are what the powergrid/* topics carry
+template <int BAYS>
+TraceRecord trace_tick(const TickReport<BAYS> &report, const FleetTable<BAYS> &fleet)
+{
+	TraceRecord record = trace_record(TRACE_TICK, report.time);
+	record.value[0] = report.grid;
+	record.value[1] = report.result.battery_need;
+	record.value[2] = report.result.power_given_from_battery;
+	record.value[3] = report.charging;
+	record.value[4] = trace_bits(fleet.decharging);
+	record.value[5] = report.charging ? trace_bits(report.charged) : 0;
+	return record;
+}
+
+#endif
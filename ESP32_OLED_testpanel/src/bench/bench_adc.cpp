@@ -0,0 +1,188 @@
+/*
+Benchmark for AdcFilter, runs on the host:
+  pio run -e bench_adc -t exec
+
+Feeds a sampled potentiometer, one sample per millisecond like the
+AdcSampler in main.cpp, through the filter and through the old
+analogRead() and map() of the loop. The samples have the noise of the
+ESP32 ADC: a few counts of gaussian noise, some mains hum, and now and
+then a spike of a few hundred counts.
+
+The potentiometer is held still, turned slowly, stepped and left at both
+ends. For every 2 s control tick it counts how often the grid value
+changed while the potentiometer did not move, and how far it wandered.
+The benchmark stops unless, while the potentiometer is held, the filtered
+value changes on at most one tick in ten and wanders at most
+WANDER_LIMIT, is exactly 0 and 15000 at the ends, and settles after a
+step within SETTLE_LIMIT_MS.
+
+The samples are made up here, with noise of the size the ESP32 ADC is
+known for; there are no recordings of the panel in the tree.
+*/
+#include <adcFilter.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+const int TICK_MS = 2000;
+const int SETTLE_LIMIT_MS = 500;
+const long WANDER_LIMIT = 15; // 0.1 % of the full scale
+const AdcCalibration CALIBRATION = {20, 4075};
+
+// a piece of the potentiometer's travel, true position in readings
+struct Segment
+{
+	const char *name;
+	int ms;
+	double from;
+	double to;
+};
+
+const Segment SEGMENTS[] = {
+	{"low end", 20000, 0, 0},
+	{"held 1/2", 60000, 2048, 2048},
+	{"slow turn", 4000, 2048, 3000},
+	{"held 3/4", 60000, 3000, 3000},
+	{"high end", 20000, 4095, 4095},
+	{"step to 1/4", 60000, 1000, 1000},
+	{"held 1/50", 60000, 80, 80},
+};
+
+struct Sample
+{
+	uint16_t raw;
+	double position;
+};
+
+// the made up recording: noise, hum and spikes on top of the position
+static std::vector<Sample> record(std::mt19937 &rng)
+{
+	std::normal_distribution<double> noise(0.0, 12.0);
+	std::vector<Sample> samples;
+	int t = 0;
+	for (const Segment &segment : SEGMENTS)
+	{
+		for (int ms = 0; ms < segment.ms; ms++, t++)
+		{
+			double position = segment.from + (segment.to - segment.from) * ms / segment.ms;
+			double raw = position + noise(rng) + 5.0 * std::sin(2 * M_PI * 50.0 * t / 1000.0);
+			if (rng() % 200 == 0)
+			{
+				raw += (rng() % 2 ? 1 : -1) * double(200 + rng() % 400);
+			}
+			raw = raw < 0 ? 0 : raw > ADC_MAX ? ADC_MAX : raw;
+			samples.push_back({uint16_t(raw + 0.5), position});
+		}
+	}
+	return samples;
+}
+
+static long old_map(uint16_t raw)
+{
+	return long(raw) * 15000 / ADC_MAX;
+}
+
+static long expected(double position)
+{
+	double watts = (position - CALIBRATION.raw_low) * 15000.0 / (CALIBRATION.raw_high - CALIBRATION.raw_low);
+	return long(watts < 0 ? 0 : watts > 15000 ? 15000 : watts + 0.5);
+}
+
+static void fail(const char *segment, const char *why, long value)
+{
+	printf("%s: %s (%ld)\n", segment, why, value);
+	exit(1);
+}
+
+int main()
+{
+	std::mt19937 rng(42);
+	std::vector<Sample> samples = record(rng);
+
+	AdcFilter filter;
+	filter.begin(CALIBRATION, ADC_FILTER_DEFAULTS);
+
+	printf("%-12s %8s %8s %10s %10s %10s %10s\n", "segment", "ticks", "", "changes", "", "wander W", "");
+	printf("%-12s %8s %8s %10s %10s %10s %10s\n", "", "", "settle", "old", "filtered", "old", "filtered");
+
+	size_t i = 0;
+	double add_ns = 0;
+	for (const Segment &segment : SEGMENTS)
+	{
+		bool held = segment.from == segment.to;
+		int ticks = 0;
+		int old_changes = 0;
+		int new_changes = 0;
+		long old_last = -1;
+		long new_last = -1;
+		long old_low = 1L << 30, old_high = -1, new_low = 1L << 30, new_high = -1;
+		int settle = -1;
+		long target = expected(segment.to);
+
+		for (int ms = 0; ms < segment.ms; ms++, i++)
+		{
+			bench_clock::time_point start = bench_clock::now();
+			filter.add(samples[i].raw);
+			add_ns += std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+
+			// within 1 % of the full scale of where the potentiometer is
+			if (settle < 0 && held && labs(filter.value() - target) <= 150)
+			{
+				settle = ms;
+			}
+
+			// the first tick of a segment is left out, the filter may still be on its way there
+			if (ms % TICK_MS != TICK_MS - 1 || !held || ms < TICK_MS)
+			{
+				continue;
+			}
+			ticks++;
+			long old_value = old_map(samples[i].raw);
+			long new_value = filter.value();
+			old_changes += old_last >= 0 && old_value != old_last;
+			new_changes += new_last >= 0 && new_value != new_last;
+			old_last = old_value;
+			new_last = new_value;
+			old_low = std::min(old_low, old_value);
+			old_high = std::max(old_high, old_value);
+			new_low = std::min(new_low, new_value);
+			new_high = std::max(new_high, new_value);
+		}
+		if (!held)
+		{
+			printf("%-12s %8s %8s\n", segment.name, "-", "-");
+			continue;
+		}
+		printf("%-12s %8d %6d ms %10d %10d %10ld %10ld\n", segment.name, ticks, settle, old_changes, new_changes,
+			   old_high - old_low, new_high - new_low);
+
+		if (new_changes * 10 > ticks)
+		{
+			fail(segment.name, "the filtered value changed too often while the potentiometer was held", new_changes);
+		}
+		if (new_high - new_low > WANDER_LIMIT)
+		{
+			fail(segment.name, "the filtered value wandered too far", new_high - new_low);
+		}
+		if (settle < 0 || settle > SETTLE_LIMIT_MS)
+		{
+			fail(segment.name, "the filtered value did not settle in time", settle);
+		}
+		if (segment.to == 0 && new_last != 0)
+		{
+			fail(segment.name, "the low end is not 0", new_last);
+		}
+		if (segment.to == ADC_MAX && new_last != 15000)
+		{
+			fail(segment.name, "the high end is not 15000", new_last);
+		}
+	}
+	printf("\none sample through the filter: %.0f ns\n", add_ns / samples.size());
+	return 0;
+}
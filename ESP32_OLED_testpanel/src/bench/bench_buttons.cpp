@@ -0,0 +1,225 @@
+/*
+Benchmark for BitDebouncer, runs on the host:
+  pio run -e bench_buttons -t exec
+
+Every bay gets a button that is pressed and let go at random, with
+contact bounce on every edge and short glitches in between. A bounce or
+a glitch is never more than DEBOUNCE_SAMPLES - 1 samples long. The
+benchmark stops unless every real press and release gives exactly one
+event, no glitch gives one, and every event comes at most
+DEBOUNCE_SAMPLES samples after the bouncing ended.
+
+Then one sample of all bays is timed against a polled button per bay
+like ezButton::loop(), for a growing number of bays.
+*/
+#include <bitDebouncer.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+const int SAMPLES = 200000;
+
+// the raw pin level of one bay for every sample, and where the real edges settle
+struct Signal
+{
+	std::vector<uint8_t> level;
+	std::vector<int> settled; // sample where the level is steady after an edge
+};
+
+static Signal make_signal(std::mt19937 &rng)
+{
+	Signal signal;
+	signal.level.reserve(SAMPLES + 64);
+	uint8_t level = 1; // pulled up, not pressed
+	while (int(signal.level.size()) < SAMPLES)
+	{
+		// the steady part, now and then with a glitch in it
+		int hold = 4 + int(rng() % 40);
+		for (int i = 0; i < hold; i++)
+		{
+			// only once the level has been steady long enough to count as an edge
+			bool glitch = i >= DEBOUNCE_SAMPLES && rng() % 30 == 0;
+			int length = glitch ? 1 + int(rng() % (DEBOUNCE_SAMPLES - 1)) : 0;
+			for (int j = 0; j < length && i < hold; j++, i++)
+			{
+				signal.level.push_back(level ^ 1);
+			}
+			signal.level.push_back(level);
+		}
+
+		// an edge with bounce
+		level ^= 1;
+		int bounces = int(rng() % 4);
+		for (int b = 0; b < bounces; b++)
+		{
+			int length = 1 + int(rng() % (DEBOUNCE_SAMPLES - 1));
+			for (int j = 0; j < length; j++)
+			{
+				signal.level.push_back(level);
+			}
+			signal.level.push_back(level ^ 1);
+		}
+		signal.settled.push_back(int(signal.level.size()));
+	}
+	signal.level.resize(SAMPLES);
+	while (!signal.settled.empty() && signal.settled.back() + DEBOUNCE_SAMPLES > SAMPLES)
+	{
+		signal.settled.pop_back();
+	}
+	return signal;
+}
+
+static void check(int bays)
+{
+	std::mt19937 rng(bays);
+	std::vector<Signal> signals;
+	for (int bay = 0; bay < bays; bay++)
+	{
+		signals.push_back(make_signal(rng));
+	}
+
+	BitDebouncer debouncer;
+	std::vector<std::vector<int>> events(bays);
+	for (int s = 0; s < SAMPLES; s++)
+	{
+		uint32_t raw[DEBOUNCE_WORDS] = {0xFFFFFFFF, 0xFFFFFFFF};
+		for (int bay = 0; bay < bays; bay++)
+		{
+			if (!signals[bay].level[s])
+			{
+				raw[bay / 32] &= ~(1UL << (bay % 32));
+			}
+		}
+		uint32_t fell[DEBOUNCE_WORDS];
+		uint32_t rose[DEBOUNCE_WORDS];
+		debouncer.sample(raw, fell, rose);
+		for (int bay = 0; bay < bays; bay++)
+		{
+			uint32_t bit = 1UL << (bay % 32);
+			if ((fell[bay / 32] | rose[bay / 32]) & bit)
+			{
+				// presses and releases take turns, starting with a press
+				bool press = events[bay].size() % 2 == 0;
+				if (press != ((fell[bay / 32] & bit) != 0))
+				{
+					printf("bay %d: event %zu has the wrong direction\n", bay, events[bay].size());
+					exit(1);
+				}
+				events[bay].push_back(s);
+			}
+		}
+	}
+
+	for (int bay = 0; bay < bays; bay++)
+	{
+		const std::vector<int> &settled = signals[bay].settled;
+		if (events[bay].size() < settled.size() || events[bay].size() > settled.size() + 1)
+		{
+			printf("bay %d: %zu events for %zu edges\n", bay, events[bay].size(), settled.size());
+			exit(1);
+		}
+		for (size_t e = 0; e < settled.size(); e++)
+		{
+			int late = events[bay][e] - settled[e];
+			if (late < 0 || late >= DEBOUNCE_SAMPLES)
+			{
+				printf("bay %d: edge %zu came %d samples after it settled\n", bay, e, late);
+				exit(1);
+			}
+		}
+	}
+}
+
+// ezButton::loop() for one button, with the pin level given
+struct PolledButton
+{
+	int flickerable = 1;
+	int steady = 1;
+	unsigned long changed = 0;
+	bool pressed = false;
+
+	void loop(int level, unsigned long now, unsigned long debounce)
+	{
+		if (level != flickerable)
+		{
+			changed = now;
+			flickerable = level;
+		}
+		if (now - changed >= debounce)
+		{
+			pressed = pressed || (steady == 1 && level == 0);
+			steady = level;
+		}
+	}
+};
+
+// keeps the compiler from reading the pins only once
+static volatile uint32_t gpio_in[DEBOUNCE_WORDS] = {0xFFFFFFFF, 0xFFFFFFFF};
+
+// keeps the results from being optimised away
+static volatile uint32_t results;
+
+__attribute__((noinline)) static int digital_read(int pin)
+{
+	return (gpio_in[pin / 32] >> (pin % 32)) & 1;
+}
+
+static void cost(int bays)
+{
+	const int SCANS = 2000000;
+	uint32_t sink = 0;
+
+	BitDebouncer debouncer;
+	bench_clock::time_point start = bench_clock::now();
+	for (int s = 0; s < SCANS; s++)
+	{
+		gpio_in[0] ^= uint32_t(s & 1); // one pin bounces all the time
+		uint32_t raw[DEBOUNCE_WORDS] = {gpio_in[0], gpio_in[1]};
+		uint32_t fell[DEBOUNCE_WORDS];
+		uint32_t rose[DEBOUNCE_WORDS];
+		debouncer.sample(raw, fell, rose);
+		sink += fell[0] + rose[1];
+	}
+	double bank_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / SCANS;
+
+	std::vector<PolledButton> buttons(bays);
+	start = bench_clock::now();
+	for (int s = 0; s < SCANS; s++)
+	{
+		gpio_in[0] ^= uint32_t(s & 1);
+		for (int bay = 0; bay < bays; bay++)
+		{
+			buttons[bay].loop(digital_read(bay), (unsigned long)s, 50);
+		}
+	}
+	double polled_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / SCANS;
+	for (const PolledButton &button : buttons)
+	{
+		sink += button.pressed;
+	}
+
+	results = sink;
+	printf("%8d %18.1f %18.1f\n", bays, bank_ns, polled_ns);
+}
+
+int main()
+{
+	const int bays[] = {3, 16, 40};
+	for (int count : bays)
+	{
+		check(count);
+	}
+	printf("%d samples of 3, 16 and 40 bounced buttons gave one event per edge\n\n", SAMPLES);
+
+	printf("%8s %18s %18s\n", "bays", "BitDebouncer ns", "polled ns");
+	for (int count : bays)
+	{
+		cost(count);
+	}
+	return 0;
+}
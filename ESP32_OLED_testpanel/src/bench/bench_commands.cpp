@@ -0,0 +1,259 @@
+/*
+Benchmark for the inbound MQTT messages, runs on the host:
+  pio run -e bench_commands -t exec
+
+First the topic filters are checked against a list of topics, with the
+MQTT rules for "+" and "#". Then a mix of commands, the LED and the per
+bay ones plus topics nobody handles, is handled once like the old
+callback did it (the payload and the topic copied into strings one char
+at a time and compared) and once with CommandRouter. Both are timed, and
+operator new is counted, to show that the router does not allocate.
+
+The same commands are also sent the way they arrive on a shared broker,
+under "site/<panel>/", to this panel and to another one: DeviceId must
+take the prefix off the topics of this panel, drop the others, and not
+allocate either. The names DeviceId makes from a MAC are checked first.
+*/
+#include <commandRouter.h>
+#include <deviceId.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+static unsigned long allocations = 0;
+
+void *operator new(size_t size)
+{
+	allocations++;
+	void *memory = malloc(size == 0 ? 1 : size);
+	if (memory == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+	free(memory);
+}
+
+struct MatchCase
+{
+	const char *pattern;
+	const char *topic;
+	bool matches;
+	const char *capture; // the first "+" level, NULL for none
+};
+
+const MatchCase MATCH_CASES[] = {
+	{"esp32/input", "esp32/input", true, NULL},
+	{"esp32/input", "esp32/input/bay", false, NULL},
+	{"esp32/input", "esp32/inpu", false, NULL},
+	{"esp32/input", "esp32/inputs", false, NULL},
+	{"esp32/input/#", "esp32/input", true, NULL},
+	{"esp32/input/#", "esp32/input/bay/1/charge", true, NULL},
+	{"esp32/input/#", "esp32/output", false, NULL},
+	{"esp32/input/bay/+/charge", "esp32/input/bay/12/charge", true, "12"},
+	{"esp32/input/bay/+/charge", "esp32/input/bay//charge", true, ""},
+	{"esp32/input/bay/+/charge", "esp32/input/bay/1/2/charge", false, NULL},
+	{"esp32/input/bay/+/charge", "esp32/input/bay/1/discharge", false, NULL},
+	{"esp32/input/bay/+/charge", "esp32/input/bay/1", false, NULL},
+	{"esp32/input/bay/+", "esp32/input/bay/3", true, "3"},
+	{"+/input/#", "esp32/input/led", true, "esp32"},
+	{"#", "anything/at/all", true, NULL},
+};
+
+// what the handlers saw, so the work is not optimized away
+static long handled_led = 0;
+static long handled_bay = 0;
+
+static void led(const RouteMatch &, const TextView &payload)
+{
+	handled_led += payload.equals("on") ? 1 : payload.equals("off") ? 2 : 0;
+}
+
+static void bay(const RouteMatch &match, const TextView &payload)
+{
+	long number;
+	if (match.captures == 1 && match.capture[0].to_long(number))
+	{
+		handled_bay += number + (payload.equals("on") ? 1 : 0);
+	}
+}
+
+const CommandRoute ROUTES[] = {
+	{INPUT_PREFIX, led},
+	{INPUT_TOPIC("bay/+/charge"), bay},
+	{INPUT_TOPIC("bay/+/discharge"), bay},
+};
+
+struct Message
+{
+	std::string topic;
+	std::string payload;
+};
+
+// like the old callback: strings built one char at a time, one topic compared
+static void string_callback(const char *topic, const uint8_t *message, unsigned int length)
+{
+	std::string data_message;
+	for (unsigned int i = 0; i < length; i++)
+	{
+		data_message += char(message[i]);
+	}
+	if (std::string(topic) == "esp32/input")
+	{
+		handled_led += data_message == "on" ? 1 : data_message == "off" ? 2 : 0;
+	}
+}
+
+int main()
+{
+	int failures = 0;
+	for (const MatchCase &test : MATCH_CASES)
+	{
+		RouteMatch match;
+		bool matches = match_topic(test.pattern, test.topic, match);
+		bool capture_ok = !matches || test.capture == NULL ||
+						  (match.captures > 0 && match.capture[0].equals(test.capture));
+		if (matches != test.matches || !capture_ok)
+		{
+			printf("FAILED: %s on %s\n", test.pattern, test.topic);
+			failures++;
+		}
+	}
+	printf("%d topic filters checked, %d failed\n\n", int(sizeof(MATCH_CASES) / sizeof(MATCH_CASES[0])), failures);
+
+	DeviceId device;
+	const uint64_t MAC = 0xD5C4B312CFA4ULL; // a4:cf:12:b3:c4:d5, lowest byte first like ESP.getEfuseMac()
+	char topic[64];
+	DeviceId bad_site;
+	if (!device.begin("site", "testpanel", MAC) || strcmp(device.get_name(), "a4cf12b3c4d5") != 0 ||
+		strcmp(device.get_client_id(), "testpanel-a4cf12b3c4d5") != 0 ||
+		!device.topic(INPUT_SUBSCRIPTION, topic, sizeof(topic)) ||
+		strcmp(topic, "site/a4cf12b3c4d5/esp32/input/#") != 0 ||
+		device.local("site/a4cf12b3c4d5/esp32/input") == NULL || device.local("site/a4cf12b3c4d6/esp32/input") != NULL ||
+		device.local("site/a4cf12b3c4d5") != NULL || device.topic("esp32/output/a/topic/that/is/longer/than/the/room", topic, 48) ||
+		bad_site.begin("site/+", "testpanel", MAC) || bad_site.local("esp32/input") != NULL)
+	{
+		printf("FAILED: the names of the device\n");
+		failures++;
+	}
+
+	std::vector<Message> messages;
+	for (int i = 0; i < 1000; i++)
+	{
+		switch (i % 5)
+		{
+		case 0:
+			messages.push_back(Message{"esp32/input", i % 2 ? "on" : "off"});
+			break;
+		case 1:
+			messages.push_back(Message{"esp32/input/bay/" + std::to_string(i % 3 + 1) + "/charge", "on"});
+			break;
+		case 2:
+			messages.push_back(Message{"esp32/input/bay/" + std::to_string(i % 3 + 1) + "/discharge", "off"});
+			break;
+		case 3:
+			messages.push_back(Message{"esp32/input/unknown", "1"});
+			break;
+		default:
+			messages.push_back(Message{"esp32/input", "a longer payload that is not a command at all"});
+			break;
+		}
+	}
+
+	const int ROUNDS = 2000;
+	CommandRouter router(ROUTES, sizeof(ROUTES) / sizeof(ROUTES[0]));
+
+	unsigned long before = allocations;
+	bench_clock::time_point start = bench_clock::now();
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		for (const Message &message : messages)
+		{
+			string_callback(message.topic.c_str(), reinterpret_cast<const uint8_t *>(message.payload.data()),
+							(unsigned int)message.payload.size());
+		}
+	}
+	double string_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+	unsigned long string_allocations = allocations - before;
+
+	before = allocations;
+	start = bench_clock::now();
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		for (const Message &message : messages)
+		{
+			router.route(message.topic.c_str(), reinterpret_cast<const uint8_t *>(message.payload.data()),
+						 message.payload.size());
+		}
+	}
+	double router_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+	unsigned long router_allocations = allocations - before;
+
+	// on a shared broker, half of it for another panel
+	DeviceId other;
+	other.begin("site", "testpanel", MAC + 1);
+	std::vector<Message> shared;
+	for (size_t i = 0; i < messages.size(); i++)
+	{
+		shared.push_back(Message{(i % 2 ? other : device).get_prefix() + messages[i].topic, messages[i].payload});
+	}
+	unsigned long routed_before = router.get_routed();
+	unsigned long ignored = 0;
+	before = allocations;
+	start = bench_clock::now();
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		for (const Message &message : shared)
+		{
+			const char *local = device.local(message.topic.c_str());
+			if (local == NULL)
+			{
+				ignored++;
+				continue;
+			}
+			router.route(local, reinterpret_cast<const uint8_t *>(message.payload.data()), message.payload.size());
+		}
+	}
+	double device_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+	unsigned long device_allocations = allocations - before;
+	unsigned long device_routed = router.get_routed() - routed_before;
+
+	double count = double(ROUNDS) * messages.size();
+	printf("%-16s %12s %18s %10s\n", "callback", "ns/message", "allocations/msg", "topics");
+	printf("%-16s %12.1f %18.2f %10s\n", "string compare", string_ns / count, string_allocations / count, "1");
+	printf("%-16s %12.1f %18.2f %10d\n", "CommandRouter", router_ns / count, router_allocations / count,
+		   int(sizeof(ROUTES) / sizeof(ROUTES[0])));
+	printf("%-16s %12.1f %18.2f %10s\n", "DeviceId+router", device_ns / count, device_allocations / count,
+		   "1/2 others");
+	printf("\n%lu routed, %lu unmatched (%ld %ld)\n", router.get_routed(), router.get_unmatched(), handled_led,
+		   handled_bay);
+
+	if (device_allocations != 0 || ignored != (unsigned long)ROUNDS * shared.size() / 2 ||
+		device_routed * 2 != routed_before)
+	{
+		printf("FAILED: the commands of another panel were routed, or the prefix allocated\n");
+		failures++;
+	}
+	if (router_allocations != 0)
+	{
+		printf("FAILED: the router allocated\n");
+		failures++;
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,309 @@
+/*
+Benchmark for the grid dispatch, runs on the host:
+  pio run -e bench_dispatch -t exec
+
+Simulates a car park with BAYS parking spots and runs the same control
+tick as the firmware (time_parked, dispatch and charging), once with the
+linear update_battery_status / update_battery_charging and once with
+BatteryDispatcher on a FleetTable. The grid load grows with the size of
+the park so that about a quarter of the parked cars have to give power
+every tick, and cars arrive and leave while it runs.
+
+Both versions get the same input, and the benchmark stops if they do not
+give the same result. The dispatcher counts energy over the elapsed time,
+so it is run with ticks of GRID_TICK_MS, the tick the free functions
+assume.
+
+Then a minute of the panel is run with PanelController at the 2 s tick,
+at 10 Hz and at 10 Hz with jitter and a stall, and the energy and the time
+parked must come out the same. The old accounting, a fixed amount per
+tick, is shown next to it.
+*/
+#include <gridDispatch.h>
+#include <batteryDispatcher.h>
+#include <fleetTable.h>
+#include <panelController.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+// the arrays used by the free functions, index 0 is the fail safe
+template <int SIZE>
+struct Fleet
+{
+	bool parked[SIZE];
+	bool charging_status[SIZE];
+	bool decharging_status[SIZE];
+	bool charged[SIZE];
+	int battery_status[SIZE];
+	int timeParked_cars[SIZE];
+
+	Fleet()
+	{
+		for (int i = 0; i < SIZE; i++)
+		{
+			parked[i] = false;
+			charging_status[i] = false;
+			decharging_status[i] = false;
+			charged[i] = false;
+			battery_status[i] = 0;
+			timeParked_cars[i] = 0;
+		}
+	}
+
+	// bay i of the fleet table is index i + 1 in the arrays
+	template <int BAYS>
+	bool operator==(const FleetTable<BAYS> &table) const
+	{
+		for (int i = 0; i < BAYS; i++)
+		{
+			if (parked[i + 1] != table.parked.get(i) || charging_status[i + 1] != table.charging.get(i) ||
+				decharging_status[i + 1] != table.decharging.get(i) ||
+				GridEnergy(battery_status[i + 1]) * GRID_TICK_MS != table.battery_status[i] ||
+				timeParked_cars[i + 1] * (GRID_TICK_MS / 1000) != table.timeParked[i])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+template <int BAYS>
+static void fill_park(Fleet<BAYS + 1> &fleet, FleetTable<BAYS> &table)
+{
+	std::mt19937 rng(BAYS);
+	for (int i = 0; i < BAYS; i++)
+	{
+		// about 3 of 4 bays are occupied, battery between 20 and 80%
+		bool parked = rng() % 4 != 0;
+		int battery = int(20 + rng() % 60) * GRID_WH;
+		fleet.parked[i + 1] = parked;
+		fleet.battery_status[i + 1] = battery;
+		table.parked.set(i, parked);
+		table.battery_status[i] = GridEnergy(battery) * GRID_TICK_MS;
+	}
+}
+
+// a car arriving or leaving, like a button press on the panel
+struct Toggle
+{
+	int bay; // numbered from 0
+	int battery;
+};
+
+struct Timing
+{
+	std::vector<long long> samples;
+	long long total_ns = 0;
+
+	void add(long long ns)
+	{
+		samples.push_back(ns);
+		total_ns += ns;
+	}
+
+	long long percentile(int p)
+	{
+		std::sort(samples.begin(), samples.end());
+		return samples[(samples.size() - 1) * p / 100];
+	}
+
+	double ticks_per_s() const { return samples.size() * 1e9 / total_ns; }
+};
+
+static long long elapsed_ns(bench_clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start).count();
+}
+
+template <int SIZE>
+static DispatchResult linear_tick(Fleet<SIZE> &fleet, const std::vector<Toggle> &toggles, int grid)
+{
+	for (const Toggle &toggle : toggles)
+	{
+		fleet.parked[toggle.bay + 1] = !fleet.parked[toggle.bay + 1];
+		fleet.battery_status[toggle.bay + 1] = toggle.battery;
+	}
+	time_parked(fleet.parked, fleet.timeParked_cars, SIZE);
+	DispatchResult result = update_battery_status(grid, fleet.parked, fleet.battery_status, fleet.charging_status,
+												  fleet.decharging_status, SIZE);
+	update_battery_charging(grid, fleet.parked, fleet.battery_status, fleet.charging_status, fleet.charged, SIZE);
+	return result;
+}
+
+template <int BAYS>
+static DispatchResult heap_tick(FleetTable<BAYS> &table, BatteryDispatcher<BAYS> &dispatcher,
+								BitFlags<BAYS> &charged, const std::vector<Toggle> &toggles, int grid)
+{
+	for (const Toggle &toggle : toggles)
+	{
+		table.parked.toggle(toggle.bay);
+		table.battery_status[toggle.bay] = GridEnergy(toggle.battery) * GRID_TICK_MS;
+		dispatcher.update(toggle.bay);
+	}
+	table.time_parked(GRID_TICK_MS);
+	DispatchResult result = dispatcher.dispatch(grid, GRID_TICK_MS);
+	dispatcher.charge(grid, GRID_TICK_MS, charged);
+	return result;
+}
+
+template <int BAYS>
+static void bench()
+{
+	std::unique_ptr<Fleet<BAYS + 1>> linear(new Fleet<BAYS + 1>());
+	std::unique_ptr<FleetTable<BAYS>> table(new FleetTable<BAYS>());
+	fill_park(*linear, *table);
+	std::unique_ptr<BatteryDispatcher<BAYS>> dispatcher(new BatteryDispatcher<BAYS>(*table));
+	BitFlags<BAYS> charged;
+
+	// the potentiometer goes up to 15 kW, bigger parks get a bigger load
+	int max_load = std::max(15000, BAYS * GRID_CAR_POWER / 4);
+	std::mt19937 rng(BAYS);
+	std::vector<Toggle> toggles;
+	Timing linear_timing;
+	Timing heap_timing;
+
+	for (int tick = 0; tick < 100000 && (tick < 20 || linear_timing.total_ns < 500000000LL); tick++)
+	{
+		// every fourth tick the grid has power to spare and the cars are charged
+		int grid = tick % 4 == 3 ? 0 : max_load / 2 + int(rng() % (max_load / 2));
+
+		toggles.clear();
+		for (int i = 0; i < BAYS / 64 + 1; i++)
+		{
+			toggles.push_back(Toggle{int(rng() % BAYS), int(20 + rng() % 60) * GRID_WH});
+		}
+
+		bench_clock::time_point start = bench_clock::now();
+		DispatchResult linear_result = linear_tick(*linear, toggles, grid);
+		linear_timing.add(elapsed_ns(start));
+
+		start = bench_clock::now();
+		DispatchResult heap_result = heap_tick(*table, *dispatcher, charged, toggles, grid);
+		heap_timing.add(elapsed_ns(start));
+
+		if (linear_result.battery_need != heap_result.battery_need ||
+			linear_result.power_given_from_battery != heap_result.power_given_from_battery || !(*linear == *table))
+		{
+			printf("%d bays: dispatcher differs from update_battery_status at tick %d\n", BAYS, tick);
+			exit(1);
+		}
+	}
+
+	printf("%8d %10zu %12lld %12lld %14.0f %12lld %12lld %14.0f %8.1fx\n", BAYS, linear_timing.samples.size(),
+		   linear_timing.percentile(50), linear_timing.percentile(99), linear_timing.ticks_per_s(),
+		   heap_timing.percentile(50), heap_timing.percentile(99), heap_timing.ticks_per_s(),
+		   heap_timing.ticks_per_s() / linear_timing.ticks_per_s());
+}
+
+const int RATE_BAYS = 16;
+const uint32_t RATE_RUN_MS = 60000;
+
+// the grid load at a time, it only changes on whole seconds
+static int rate_load(uint32_t ms)
+{
+	static const int loads[] = {12000, 5000, 0, 15000, 8000, 0};
+	return loads[(ms / 10000) % 6];
+}
+
+struct RateResult
+{
+	int ticks;
+	GridEnergy battery; // all batteries at the end
+	long parked;        // seconds parked of all cars at the end
+	GridEnergy old_battery;
+};
+
+// the next tick comes "interval" ms after the last one, the last tick is at RATE_RUN_MS
+template <class Interval>
+static RateResult run_rate(Interval interval)
+{
+	std::unique_ptr<PanelController<RATE_BAYS>> controller(new PanelController<RATE_BAYS>());
+	controller->start(1, 0);
+	for (int i = 0; i < RATE_BAYS; i++)
+	{
+		controller->press(i);
+	}
+	// the same park, with a fixed amount per tick like before
+	std::unique_ptr<PanelController<RATE_BAYS>> old(new PanelController<RATE_BAYS>());
+	old->start(1, 0);
+	for (int i = 0; i < RATE_BAYS; i++)
+	{
+		old->press(i);
+	}
+
+	RateResult result = {};
+	TickReport<RATE_BAYS> report;
+	uint32_t now = 0;
+	while (now < RATE_RUN_MS)
+	{
+		uint32_t last = now;
+		now = std::min(RATE_RUN_MS, now + interval());
+		// the load is read at the tick and holds for the time before it
+		controller->tick(rate_load(last), now, report);
+		old->dispatcher.dispatch(rate_load(last), GRID_TICK_MS);
+		old->dispatcher.charge(rate_load(last), GRID_TICK_MS, report.charged);
+		result.ticks++;
+	}
+	for (int i = 0; i < RATE_BAYS; i++)
+	{
+		result.battery += controller->fleet.battery_status[i];
+		result.parked += controller->fleet.timeParked[i];
+		result.old_battery += old->fleet.battery_status[i];
+	}
+	return result;
+}
+
+static void print_rate(const char *name, const RateResult &result)
+{
+	printf("%-22s %8d %14.3f %14.3f %10ld\n", name, result.ticks, double(result.battery) / GRID_ENERGY_WH,
+		   double(result.old_battery) / GRID_ENERGY_WH, result.parked);
+}
+
+static void rates()
+{
+	std::mt19937 rng(7);
+	RateResult slow = run_rate([]() { return uint32_t(GRID_TICK_MS); });
+	RateResult fast = run_rate([]() { return uint32_t(100); });
+	RateResult jitter = run_rate([&rng]() {
+		// 100 ms +-40 ms, and now and then the loop is held up for 700 ms
+		return rng() % 50 == 0 ? uint32_t(700) : uint32_t(60 + rng() % 81);
+	});
+
+	printf("\n%-22s %8s %14s %14s %10s\n", "rate", "ticks", "battery %", "old battery %", "parked s");
+	print_rate("0.5 Hz", slow);
+	print_rate("10 Hz", fast);
+	print_rate("10 Hz with jitter", jitter);
+
+	// the load steps fall inside a tick with jitter, so that run may be off by part of a tick
+	GridEnergy step_error = 6 * grid_energy(15000, 700);
+	if (fast.battery != slow.battery || fast.parked != slow.parked || jitter.parked != slow.parked ||
+		std::llabs(jitter.battery - slow.battery) > step_error)
+	{
+		printf("the energy totals depend on the tick rate\n");
+		exit(1);
+	}
+}
+
+int main()
+{
+	printf("%8s %10s %12s %12s %14s %12s %12s %14s %9s\n", "bays", "ticks", "linear p50", "linear p99",
+		   "linear tick/s", "heap p50", "heap p99", "heap tick/s", "speedup");
+	bench<3>();
+	bench<16>();
+	bench<64>();
+	bench<256>();
+	bench<1024>();
+	bench<4096>();
+	bench<10000>();
+	rates();
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+Benchmark for the dirty page flush of OledFlusher, runs on the host:
+  pio run -e bench_display -t exec
+
+The screen of displayPot() is drawn every tick into a frame buffer like
+the one of Adafruit_SSD1306: lines of 6x8 pixel characters, one line per
+page. Glyphs are made up from the character code, which is enough to make
+every changed character change its columns.
+
+A screen that only gets the spans from diff_pages() must end up the same
+as the frame after every tick, or the benchmark stops. Then the bytes and
+the time on the bus per tick are compared with display(), which sends the
+whole frame at 400 kHz, for a screen that does not change, one that
+mostly does not, and one where everything moves.
+*/
+#include <frameDiff.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+typedef std::chrono::steady_clock bench_clock;
+
+const int TICKS = 5000;
+const int BAYS = 3;
+
+// the clock of display() and the one OledFlusher is started with in main.cpp
+const double FULL_CLOCK = 400000;
+const double DIFF_CLOCK = 800000;
+
+struct Screen
+{
+	uint8_t pixels[OLED_BUFFER_SIZE];
+};
+
+// one line of text on a page, like print() and println() with text size 1
+static void draw_line(Screen &screen, int page, const std::string &text)
+{
+	uint8_t *row = screen.pixels + page * OLED_WIDTH;
+	int column = 0;
+	for (char c : text)
+	{
+		for (int x = 0; x < 6 && column < OLED_WIDTH; x++, column++)
+		{
+			uint32_t hash = uint32_t(uint8_t(c)) * 2654435761u >> (x * 4);
+			row[column] = (c == ' ' || x == 5) ? 0 : uint8_t(hash | 1);
+		}
+	}
+}
+
+struct Panel
+{
+	int pot;
+	bool parked[BAYS];
+	long time_parked[BAYS];
+};
+
+static void draw(Screen &screen, const Panel &panel)
+{
+	memset(screen.pixels, 0, sizeof(screen.pixels)); // clearDisplay()
+	draw_line(screen, 0, "Potentiometer: " + std::to_string(panel.pot));
+	for (int i = 0; i < BAYS; i++)
+	{
+		draw_line(screen, 1 + 2 * i, "Car " + std::to_string(i + 1) + ": " + std::to_string(int(panel.parked[i])));
+		draw_line(screen, 2 + 2 * i, "Time parked:" + std::to_string(panel.time_parked[i]));
+	}
+}
+
+enum Scene
+{
+	SCENE_STATIC,  // nothing moves
+	SCENE_QUIET,   // one car parked, a bit of noise on the potentiometer
+	SCENE_BUSY,    // every car parked, the potentiometer turned all the time
+};
+
+static const char *scene_name(Scene scene)
+{
+	switch (scene)
+	{
+	case SCENE_STATIC:
+		return "static";
+	case SCENE_QUIET:
+		return "mostly static";
+	default:
+		return "busy";
+	}
+}
+
+static void step(Panel &panel, Scene scene, std::mt19937 &rng)
+{
+	if (scene == SCENE_QUIET)
+	{
+		// ADC noise moves the mapped value by a few W now and then
+		if (rng() % 4 == 0)
+		{
+			panel.pot = 7500 + int(rng() % 7) - 3;
+		}
+		panel.time_parked[0] += 2;
+	}
+	else if (scene == SCENE_BUSY)
+	{
+		panel.pot = int(rng() % 15001);
+		for (int i = 0; i < BAYS; i++)
+		{
+			panel.time_parked[i] += 2;
+		}
+	}
+}
+
+static void run(Scene scene)
+{
+	std::mt19937 rng(scene);
+	Panel panel = {7500, {false, false, false}, {0, 0, 0}};
+	if (scene != SCENE_STATIC)
+	{
+		panel.parked[0] = true;
+	}
+	if (scene == SCENE_BUSY)
+	{
+		panel.parked[1] = panel.parked[2] = true;
+	}
+
+	Screen next;
+	Screen shown;  // what the flusher thinks is on the screen
+	Screen oled;   // what the spans would write into the SSD1306
+	draw(next, panel);
+	shown = next;
+	oled = next;
+
+	size_t bytes = 0;
+	int flushes = 0;
+	double diff_ns = 0;
+	for (int tick = 0; tick < TICKS; tick++)
+	{
+		step(panel, scene, rng);
+		draw(next, panel);
+
+		PageSpan spans[OLED_PAGES];
+		bench_clock::time_point start = bench_clock::now();
+		size_t changed = diff_pages(shown.pixels, next.pixels, spans);
+		diff_ns += std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+
+		if (changed != 0)
+		{
+			for (int page = 0; page < OLED_PAGES; page++)
+			{
+				if (spans[page].dirty)
+				{
+					size_t offset = page * OLED_WIDTH + spans[page].first;
+					memcpy(oled.pixels + offset, next.pixels + offset, spans[page].last - spans[page].first + 1);
+				}
+			}
+			bytes += bus_bytes(spans);
+			flushes++;
+			shown = next;
+		}
+		if (memcmp(oled.pixels, next.pixels, OLED_BUFFER_SIZE) != 0)
+		{
+			printf("%s: the screen is wrong after tick %d\n", scene_name(scene), tick);
+			exit(1);
+		}
+	}
+
+	double full_bytes = double(full_bus_bytes());
+	double diff_bytes = double(bytes) / TICKS;
+	double full_ms = full_bytes * 9 / FULL_CLOCK * 1000;
+	double diff_ms = diff_bytes * 9 / DIFF_CLOCK * 1000;
+	char less[16] = "no bus";
+	if (diff_ms > 0)
+	{
+		snprintf(less, sizeof(less), "%.1fx", full_ms / diff_ms);
+	}
+	printf("%-14s %8.0f %10.1f %9.2f %9.3f %9s %8.1f%% %8.0f\n", scene_name(scene), full_bytes, diff_bytes, full_ms,
+		   diff_ms, less, 100.0 * flushes / TICKS, diff_ns / TICKS);
+}
+
+int main()
+{
+	printf("%d ticks per scene, the screen was right after every one\n\n", TICKS);
+	printf("%-14s %8s %10s %9s %9s %9s %9s %8s\n", "screen", "full B", "dirty B", "full ms", "dirty ms", "less",
+		   "flushed", "diff ns");
+	run(SCENE_STATIC);
+	run(SCENE_QUIET);
+	run(SCENE_BUSY);
+	return 0;
+}
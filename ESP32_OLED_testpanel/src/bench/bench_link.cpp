@@ -0,0 +1,240 @@
+/*
+Benchmark for the connection manager, runs on the host:
+  pio run -e bench_link -t exec
+
+Simulates PANELS panels on one broker that goes away for five minutes,
+with time in LOOP_MS steps. A failed MQTT attempt holds up the loop of
+a panel, for a few ms if the broker refuses the connection and for the
+TCP connect timeout if the broker host does not answer at all.
+
+The old reconnect() loops with delay(5000) until the broker is back,
+which holds up everything for the whole outage. ConnectionManager only
+holds up the loop while an attempt runs. For both the benchmark prints
+how much of the outage the loop was held up, the longest single stall,
+the attempts, how long the panels took to come back after the broker
+and the most connects the broker got in one second.
+
+The benchmark stops if a panel managed by ConnectionManager does not
+come back, or if it stalls longer than one attempt.
+*/
+#include <connection.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+const int PANELS = 200;
+const unsigned long LOOP_MS = 10;
+const unsigned long BROKER_DOWN = 60 * 1000UL;
+const unsigned long BROKER_UP = 360 * 1000UL;
+const unsigned long END = 600 * 1000UL;
+
+struct Panel
+{
+	unsigned long busy_until = 0; // the loop is held up until then
+	unsigned long blocked = 0;    // ms held up during the outage
+	unsigned long longest = 0;    // longest stall
+	unsigned long attempts = 0;
+	unsigned long back = 0; // when it was connected after the outage
+	bool mqtt = true;
+
+	// the old reconnect()
+	bool reconnecting = false;
+	unsigned long next_attempt = 0;
+};
+
+// the simulated world the driver functions see
+static unsigned long now = 0;
+static unsigned long attempt_cost = 0;
+static Panel *panel = nullptr;
+static std::vector<int> connects_per_second;
+
+static bool broker_up()
+{
+	return now < BROKER_DOWN || now >= BROKER_UP;
+}
+
+// the loop of the panel is held up from "start" for "ms"
+static void stall(Panel &p, unsigned long start, unsigned long ms)
+{
+	p.busy_until = start + ms;
+	p.longest = std::max(p.longest, ms);
+	unsigned long from = std::max(start, BROKER_DOWN);
+	unsigned long to = std::min(start + ms, BROKER_UP);
+	if (from < to)
+	{
+		p.blocked += to - from;
+	}
+}
+
+static void wifi_begin() {}
+static void wifi_disconnect() {}
+static bool wifi_connected() { return true; }
+
+static bool mqtt_connect()
+{
+	panel->attempts++;
+	if (broker_up())
+	{
+		connects_per_second[now / 1000]++;
+		stall(*panel, now, 5);
+		panel->mqtt = true;
+		return true;
+	}
+	stall(*panel, now, attempt_cost);
+	return false;
+}
+
+static bool mqtt_connected()
+{
+	// every panel sees the broker go at once, the worst case for the broker
+	if (!broker_up())
+	{
+		panel->mqtt = false;
+	}
+	return panel->mqtt;
+}
+
+static const LinkDriver driver = {wifi_begin, wifi_disconnect, wifi_connected, mqtt_connect, mqtt_connected};
+
+struct Result
+{
+	double blocked; // % of the outage
+	unsigned long longest;
+	double attempts;
+	double back_mean;
+	unsigned long back_max;
+	int peak;
+};
+
+static Result summary(std::vector<Panel> &panels)
+{
+	Result result = {0, 0, 0, 0, 0, 0};
+	for (Panel &p : panels)
+	{
+		result.blocked += 100.0 * p.blocked / (BROKER_UP - BROKER_DOWN) / PANELS;
+		result.longest = std::max(result.longest, p.longest);
+		result.attempts += double(p.attempts) / PANELS;
+		result.back_mean += double(p.back - BROKER_UP) / PANELS;
+		result.back_max = std::max(result.back_max, p.back - BROKER_UP);
+	}
+	result.peak = *std::max_element(connects_per_second.begin() + BROKER_UP / 1000, connects_per_second.end());
+	return result;
+}
+
+// reconnect() as it was: try, and wait 5 s after every failure
+static Result old_reconnect()
+{
+	std::vector<Panel> panels(PANELS);
+	connects_per_second.assign(END / 1000 + 1, 0);
+	for (now = 0; now < END; now += LOOP_MS)
+	{
+		for (Panel &p : panels)
+		{
+			panel = &p;
+			if (now < p.busy_until)
+			{
+				continue;
+			}
+			if (!p.reconnecting && !mqtt_connected())
+			{
+				p.reconnecting = true;
+				p.next_attempt = now;
+				p.attempts = 0;
+			}
+			if (p.reconnecting && now >= p.next_attempt)
+			{
+				if (mqtt_connect())
+				{
+					// the whole while loop was one stall
+					p.reconnecting = false;
+					p.back = now;
+					p.longest = std::max(p.longest, now - BROKER_DOWN);
+				}
+				else
+				{
+					// delay(5000) after the failed attempt
+					stall(p, p.busy_until, 5000);
+					p.next_attempt = p.busy_until;
+				}
+			}
+		}
+	}
+	return summary(panels);
+}
+
+static Result connection_manager()
+{
+	std::vector<Panel> panels(PANELS);
+	std::vector<ConnectionManager> links;
+	links.reserve(PANELS);
+	std::mt19937 rng(1);
+	connects_per_second.assign(END / 1000 + 1, 0);
+	for (int i = 0; i < PANELS; i++)
+	{
+		links.emplace_back(driver);
+		panel = &panels[i];
+		links[i].begin(0, rng());
+	}
+
+	for (now = 0; now < END; now += LOOP_MS)
+	{
+		for (int i = 0; i < PANELS; i++)
+		{
+			Panel &p = panels[i];
+			panel = &p;
+			if (now < p.busy_until)
+			{
+				continue;
+			}
+			if (now == BROKER_DOWN)
+			{
+				p.attempts = 0;
+			}
+			bool was_connected = links[i].connected();
+			if (links[i].poll(now) == LINK_CONNECTED && !was_connected && now >= BROKER_UP)
+			{
+				p.back = now;
+			}
+		}
+	}
+
+	for (int i = 0; i < PANELS; i++)
+	{
+		if (!links[i].connected() || panels[i].back < BROKER_UP)
+		{
+			printf("panel %d did not come back after the broker\n", i);
+			exit(1);
+		}
+		if (panels[i].longest > std::max(attempt_cost, 5UL))
+		{
+			printf("panel %d stalled %lu ms, longer than one attempt\n", i, panels[i].longest);
+			exit(1);
+		}
+	}
+	return summary(panels);
+}
+
+static void print(const char *name, const Result &r)
+{
+	printf("%-20s %10.1f %12lu %10.1f %14.0f %14lu %12d\n", name, r.blocked, r.longest, r.attempts, r.back_mean,
+		   r.back_max, r.peak);
+}
+
+int main()
+{
+	printf("%d panels, broker away for %lu s, %lu ms loops\n", PANELS, (BROKER_UP - BROKER_DOWN) / 1000, LOOP_MS);
+	const unsigned long costs[] = {5, 3000};
+	for (unsigned long cost : costs)
+	{
+		attempt_cost = cost;
+		printf("\nfailed attempt takes %lu ms\n", cost);
+		printf("%-20s %10s %12s %10s %14s %14s %12s\n", "reconnect", "blocked %", "longest ms", "attempts",
+			   "back mean ms", "back max ms", "peak conn/s");
+		print("reconnect()", old_reconnect());
+		print("ConnectionManager", connection_manager());
+	}
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+Benchmark for the metrics, runs on the host:
+  pio run -e bench_metrics -t exec
+
+LogHistogram is checked on its own: every value falls in the bucket whose
+bounds hold it, and the bounds are within 25 % of the value. Then a
+million latencies from a mix of a fast path and a slow tail are added,
+and the percentiles of the summary are compared with the sorted values.
+The time of add() is measured, and the summary of the testpanel, with the
+same names and with long numbers in every field, must fit in METRICS_SIZE.
+*/
+#include <metrics.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+const size_t METRICS_SIZE = 512; // as in main.cpp
+
+static LogHistogram loop_us, display_us, publish_us, mqtt_loop_us;
+static uint32_t big_value;
+
+static uint32_t read_big() { return big_value; }
+
+// the bucket bounds hold every value up to "last", and are tight enough
+static int check_buckets(uint32_t last)
+{
+	int failures = 0;
+	for (uint64_t value = 0; value <= last; value += 1 + value / 1000)
+	{
+		int bucket = LogHistogram::bucket(uint32_t(value));
+		uint32_t high = LogHistogram::upper(bucket);
+		uint32_t low = bucket == 0 ? 0 : LogHistogram::upper(bucket - 1) + 1;
+		if (bucket < 0 || bucket >= HISTOGRAM_BUCKETS || value < low || value > high ||
+			double(high) > double(value) * 1.25 + 1)
+		{
+			if (failures++ < 5)
+			{
+				printf("FAILED: %llu in bucket %d of %lu..%lu\n", (unsigned long long)value, bucket,
+					   (unsigned long)low, (unsigned long)high);
+			}
+		}
+	}
+	if (LogHistogram::bucket(0xFFFFFFFF) != HISTOGRAM_BUCKETS - 1)
+	{
+		printf("FAILED: the biggest value is not in the last bucket\n");
+		failures++;
+	}
+	return failures;
+}
+
+int main()
+{
+	int failures = check_buckets(0xFFFFFFFF);
+
+	// 98 % around 400 us, 2 % around 30 ms, like a loop with the odd reconnect
+	std::mt19937 random(1);
+	std::lognormal_distribution<double> fast(6.0, 0.3), slow(10.3, 0.5);
+	std::uniform_real_distribution<double> pick(0, 1);
+	const int COUNT = 1000000;
+	std::vector<uint32_t> values(COUNT);
+	for (int i = 0; i < COUNT; i++)
+	{
+		values[i] = uint32_t(pick(random) < 0.98 ? fast(random) : slow(random));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < COUNT; i++)
+	{
+		loop_us.add(values[i]);
+	}
+	double add_ns =
+		std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / COUNT;
+
+	MetricsReport report("bench");
+	report.histogram("loop_us", loop_us);
+	char text[1024];
+	// the histogram was filled before it was registered, the first summary starts from there
+	loop_us.add(1);
+	report.write(0, text, sizeof(text));
+	for (int i = 0; i < COUNT; i++)
+	{
+		loop_us.add(values[i]);
+	}
+	size_t length = report.write(10000, text, sizeof(text));
+	unsigned long count, p50, p90, p99, max;
+	if (length == 0 ||
+		sscanf(text, "{\"owner\": \"bench\", \"ms\": 10000, \"loop_us\": [%lu, %lu, %lu, %lu, %lu]}", &count, &p50,
+			   &p90, &p99, &max) != 5)
+	{
+		printf("FAILED: summary %s\n", text);
+		return 1;
+	}
+
+	std::vector<uint32_t> sorted(values);
+	std::sort(sorted.begin(), sorted.end());
+	const double FRACTIONS[] = {0.50, 0.90, 0.99, 1.0};
+	const unsigned long REPORTED[] = {p50, p90, p99, max};
+	const char *const NAMES[] = {"p50", "p90", "p99", "max"};
+	printf("%-6s %10s %10s %7s\n", "", "exact us", "summary", "error");
+	for (int i = 0; i < 4; i++)
+	{
+		uint32_t exact = sorted[std::min(size_t(COUNT - 1), size_t(FRACTIONS[i] * COUNT))];
+		double error = (double(REPORTED[i]) - exact) / exact;
+		printf("%-6s %10lu %10lu %6.1f%%\n", NAMES[i], (unsigned long)exact, REPORTED[i], error * 100);
+		if (REPORTED[i] < exact || error > 0.25)
+		{
+			printf("FAILED: %s is off by more than a bucket\n", NAMES[i]);
+			failures++;
+		}
+	}
+	if (count != COUNT)
+	{
+		printf("FAILED: %lu of %d values in the interval\n", count, COUNT);
+		failures++;
+	}
+	printf("\nadd() takes %.1f ns\n", add_ns);
+
+	// the summary of the testpanel with numbers as long as they get in 10 s
+	MetricsReport panel("testpanel");
+	panel.histogram("loop_us", loop_us);
+	panel.histogram("display_us", display_us);
+	panel.histogram("publish_us", publish_us);
+	panel.histogram("mqtt_loop_us", mqtt_loop_us);
+	const char *const VALUES[] = {"publishes", "publish_failed", "reconnects", "stored",
+								  "heap",      "heap_block",     "heap_min",   "flush_us"};
+	for (int i = 0; i < 8; i++)
+	{
+		if (i < 4)
+		{
+			panel.counter(VALUES[i], read_big);
+		}
+		else
+		{
+			panel.gauge(VALUES[i], read_big);
+		}
+	}
+	panel.write(0, text, sizeof(text));
+	LogHistogram *const HISTOGRAMS[] = {&loop_us, &display_us, &publish_us, &mqtt_loop_us};
+	for (LogHistogram *histogram : HISTOGRAMS)
+	{
+		for (int i = 0; i < 999999; i++)
+		{
+			histogram->add(9999999);
+		}
+	}
+	big_value = 999999;
+	length = panel.write(9999999, text, sizeof(text));
+	printf("the longest testpanel summary is %zu of %zu bytes\n", length, METRICS_SIZE);
+	if (length == 0 || length >= METRICS_SIZE)
+	{
+		printf("FAILED: %s\n", text);
+		failures++;
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+/*
+Benchmark for the dispatch policies, runs on the host:
+  pio run -e bench_policy -t exec
+
+A car park with BAYS bays, about 3 of 4 taken, batteries between 20 and 80%
+and a power limit of 3.7, 7.4 or 11 kW per car, is run for ten minutes at
+the 10 Hz control tick with every policy. The grid need wanders around a
+twentieth of what the parked cars could give together, every fourth
+minute the grid has power to spare, and cars come and go. Every policy
+gets the same input.
+
+For every policy it prints the dispatch time per tick, the share of the
+need the cars covered, how many cars gave power per tick, and the spread
+of the battery status of the parked cars at the end. The benchmark stops if
+a policy gives more than the need or a car more than its limit.
+*/
+#include <gridDispatch.h>
+#include <batteryDispatcher.h>
+#include <dispatchPolicy.h>
+#include <fleetTable.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+const uint32_t TICK_MS = 100;
+const int TICKS = 10 * 60 * 1000 / TICK_MS;
+
+const int32_t LIMITS[] = {3700, 7400, 11000};
+
+// a car arriving or leaving
+struct Toggle
+{
+	int tick;
+	int bay;
+	GridEnergy battery;
+	int32_t limit;
+};
+
+struct Input
+{
+	std::vector<bool> parked;
+	std::vector<GridEnergy> battery;
+	std::vector<int32_t> limit;
+	std::vector<int> need; // per tick, 0 when the cars are charged
+	std::vector<Toggle> toggles;
+};
+
+template <int BAYS>
+static Input make_input()
+{
+	std::mt19937 rng(BAYS);
+	Input input;
+	long capacity = 0;
+	for (int i = 0; i < BAYS; i++)
+	{
+		input.parked.push_back(rng() % 4 != 0);
+		input.battery.push_back(GridEnergy(20 + rng() % 60) * GRID_ENERGY_WH);
+		input.limit.push_back(LIMITS[rng() % 3]);
+		capacity += input.parked.back() ? input.limit.back() : 0;
+	}
+
+	double need = capacity / 20.0;
+	for (int tick = 0; tick < TICKS; tick++)
+	{
+		need = std::min(capacity / 10.0, std::max(capacity / 40.0, need + int(rng() % 201) - 100));
+		bool spare = (tick / 600) % 4 == 3;
+		input.need.push_back(spare ? 0 : int(need));
+		if (rng() % 50 == 0)
+		{
+			input.toggles.push_back(Toggle{tick, int(rng() % BAYS), GridEnergy(20 + rng() % 60) * GRID_ENERGY_WH,
+										   LIMITS[rng() % 3]});
+		}
+	}
+	return input;
+}
+
+struct Outcome
+{
+	double tick_ns;
+	double covered;   // % of the need energy the cars gave
+	double givers;    // cars giving power per tick that had a need
+	double spread;    // standard deviation of the battery status of the parked cars, %
+	int below_floor;  // parked cars under the 10% floor at the end
+};
+
+template <int BAYS, class Dispatcher>
+static Outcome run(const Input &input)
+{
+	std::unique_ptr<FleetTable<BAYS>> fleet(new FleetTable<BAYS>());
+	for (int i = 0; i < BAYS; i++)
+	{
+		fleet->parked.set(i, input.parked[i]);
+		fleet->battery_status[i] = input.battery[i];
+		fleet->power_limit[i] = input.limit[i];
+	}
+	std::unique_ptr<Dispatcher> dispatcher(new Dispatcher(*fleet));
+	BitFlags<BAYS> charged;
+
+	Outcome outcome = {};
+	double needed = 0;
+	double given = 0;
+	long givers = 0;
+	int need_ticks = 0;
+	long long total_ns = 0;
+	size_t next_toggle = 0;
+
+	for (int tick = 0; tick < TICKS; tick++)
+	{
+		for (; next_toggle < input.toggles.size() && input.toggles[next_toggle].tick == tick; next_toggle++)
+		{
+			const Toggle &toggle = input.toggles[next_toggle];
+			fleet->parked.toggle(toggle.bay);
+			fleet->battery_status[toggle.bay] = toggle.battery;
+			fleet->power_limit[toggle.bay] = toggle.limit;
+			dispatcher->update(toggle.bay);
+		}
+
+		int need = input.need[tick];
+		std::vector<GridEnergy> before(fleet->battery_status, fleet->battery_status + BAYS);
+
+		bench_clock::time_point start = bench_clock::now();
+		DispatchResult result = dispatcher->dispatch(need, TICK_MS);
+		dispatcher->charge(need, TICK_MS, charged);
+		total_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start).count();
+
+		if (result.power_given_from_battery > need || result.battery_need != need - result.power_given_from_battery)
+		{
+			printf("%d bays: the cars gave %d for a need of %d\n", BAYS, result.power_given_from_battery, need);
+			exit(1);
+		}
+		for (int i = 0; i < BAYS; i++)
+		{
+			if (need != 0 && before[i] - fleet->battery_status[i] > grid_energy(fleet->power_limit[i], TICK_MS))
+			{
+				printf("%d bays: bay %d gave more than its limit\n", BAYS, i);
+				exit(1);
+			}
+		}
+
+		if (need != 0)
+		{
+			needed += need;
+			given += result.power_given_from_battery;
+			givers += fleet->decharging.count();
+			need_ticks++;
+		}
+	}
+
+	double sum = 0;
+	double square = 0;
+	int parked = 0;
+	fleet->parked.for_each([&](int bay) {
+		double percent = double(fleet->battery_status[bay]) / GRID_ENERGY_WH;
+		sum += percent;
+		square += percent * percent;
+		parked++;
+		outcome.below_floor += fleet->battery_status[bay] < GRID_ENERGY_MIN;
+	});
+	double mean = parked > 0 ? sum / parked : 0;
+
+	outcome.tick_ns = double(total_ns) / TICKS;
+	outcome.covered = needed > 0 ? 100.0 * given / needed : 100.0;
+	outcome.givers = need_ticks > 0 ? double(givers) / need_ticks : 0;
+	outcome.spread = parked > 0 ? sqrt(std::max(0.0, square / parked - mean * mean)) : 0;
+	return outcome;
+}
+
+static void print_outcome(int bays, const char *policy, const Outcome &outcome)
+{
+	printf("%8d %-16s %12.0f %10.0f %10.3f %10.1f %10.2f %8d\n", bays, policy, outcome.tick_ns,
+		   1e9 / outcome.tick_ns, outcome.covered, outcome.givers, outcome.spread, outcome.below_floor);
+}
+
+template <int BAYS>
+static void bench()
+{
+	Input input = make_input<BAYS>();
+	print_outcome(BAYS, "greedy", run<BAYS, BatteryDispatcher<BAYS>>(input));
+	print_outcome(BAYS, "proportional", run<BAYS, PolicyDispatcher<BAYS, ProportionalPolicy>>(input));
+	print_outcome(BAYS, "longest parked", run<BAYS, PolicyDispatcher<BAYS, LongestParkedPolicy>>(input));
+}
+
+int main()
+{
+	printf("%d ticks of %lu ms per policy\n\n", TICKS, (unsigned long)TICK_MS);
+	printf("%8s %-16s %12s %10s %10s %10s %10s %8s\n", "bays", "policy", "ns/tick", "tick/s", "covered %",
+		   "givers", "spread %", "< 10%");
+	bench<16>();
+	bench<256>();
+	bench<4096>();
+	return 0;
+}
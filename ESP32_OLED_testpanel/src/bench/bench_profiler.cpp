@@ -0,0 +1,123 @@
+/*
+Benchmark for the profiler, runs on the host with PROFILER on:
+  pio run -e bench_profiler -t exec
+
+Ten minutes of a 32 bay panel are run with PanelController at the 10 Hz
+control tick, with a press every few seconds, and the whole run is timed
+from the outside as well. The "dispatch" zone of the controller must
+have one call per tick, and its time must be close to the time from the
+outside. The cost of an empty zone (nanoseconds on the host) is printed
+with its share of a tick. At the end the flat profile is written out
+like on the panel, and its order and lines are checked.
+*/
+#include <panelController.h>
+#include <profiler.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if !PROFILER
+#error "bench_profiler needs -D PROFILER=1"
+#endif
+
+typedef std::chrono::steady_clock bench_clock;
+
+const int BAYS = 32;
+const uint32_t TICK_MS = 100;
+const int TICKS = 10 * 60 * 1000 / TICK_MS;
+
+// a zone that is bigger than "dispatch", for the order of the profile
+static void slow_zone()
+{
+	PROFILE_ZONE("bench_slow");
+	volatile uint32_t sum = 0;
+	for (int i = 0; i < 20000; i++)
+	{
+		sum = sum + uint32_t(i);
+	}
+}
+
+int main()
+{
+	int failures = 0;
+	static PanelController<BAYS> controller;
+	controller.start(3, 0);
+	TickReport<BAYS> report;
+
+	bench_clock::time_point start = bench_clock::now();
+	for (int tick = 1; tick <= TICKS; tick++)
+	{
+		uint32_t now = uint32_t(tick) * TICK_MS;
+		if (tick % 37 == 0)
+		{
+			controller.press(tick % BAYS);
+		}
+		controller.tick(int(now / 50 % 15000), now, report);
+	}
+	double outside_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+	for (int i = 0; i < 100; i++)
+	{
+		slow_zone();
+	}
+
+	const ProfileZone *zones[PROFILE_MAX_ZONES];
+	int count = profile_sorted(zones, PROFILE_MAX_ZONES);
+	const ProfileZone *dispatch = NULL;
+	for (int i = 0; i < count; i++)
+	{
+		if (strcmp(zones[i]->name, "dispatch") == 0)
+		{
+			dispatch = zones[i];
+		}
+	}
+	if (dispatch == NULL || dispatch->calls != uint32_t(TICKS))
+	{
+		printf("FAILED: the dispatch zone has %lu calls of %d ticks\n", dispatch ? (unsigned long)dispatch->calls : 0UL,
+			   TICKS);
+		return 1;
+	}
+
+	uint32_t overhead = profile_overhead();
+	double inside_ns = double(dispatch->ticks);
+	printf("%-26s %12s\n", "", "ns per tick");
+	printf("%-26s %12.0f\n", "timed from the outside", outside_ns / TICKS);
+	printf("%-26s %12.0f\n", "in the dispatch zone", inside_ns / TICKS);
+	printf("%-26s %12lu (%.1f%% of a tick)\n", "an empty zone", (unsigned long)overhead,
+		   100.0 * overhead / (outside_ns / TICKS));
+	// the loop around the zone and the presses are outside of it, the zone can not be longer
+	if (inside_ns > outside_ns * 1.02 || inside_ns < outside_ns * 0.5)
+	{
+		printf("FAILED: the zone does not match the time from the outside\n");
+		failures++;
+	}
+
+	printf("\n");
+	char line[PROFILE_LINE_SIZE];
+	for (int i = 0; i < count; i++)
+	{
+		size_t length = format_profile(*zones[i], line, sizeof(line));
+		char name[32];
+		unsigned long calls;
+		unsigned long long ticks, mean;
+		unsigned long longest;
+		if (length == 0 || sscanf(line, "Z %31s %lu %llu %llu %lu", name, &calls, &ticks, &mean, &longest) != 5 ||
+			strcmp(name, zones[i]->name) != 0 || calls != zones[i]->calls || mean > longest)
+		{
+			printf("FAILED: profile line %s\n", line);
+			failures++;
+		}
+		printf("%s\n", line);
+		if (i > 0 && zones[i]->ticks > zones[i - 1]->ticks)
+		{
+			printf("FAILED: the profile is not sorted\n");
+			failures++;
+		}
+	}
+	if (count != 2 || profile_unlisted() != 0)
+	{
+		printf("FAILED: %d zones in the profile, 2 expected\n", count);
+		failures++;
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+/*
+Benchmark for the publish rate, runs on the host:
+  pio run -e bench_rate -t exec
+
+First PublishRate is checked on its own: the limits are kept in order, a
+quiet node sends a heartbeat every max_period, news is sent after
+min_period and failed publishes hold it back.
+
+Then an hour of the testpanel is run at the 10 Hz control tick: a quiet
+car park, ten minutes of a swinging potentiometer with cars coming and
+going, ten minutes where most publishes fail, and a quiet end with one
+step of the potentiometer. The same ticks are published every 2000 ms as
+before and with PublishRate between 250 ms and 10 s, and for both the
+publishes tried, the publishes that got through and the time from a
+change past the deadbands to a publish that got it to the broker are
+counted, per phase.
+*/
+#include <panelController.h>
+#include <publishRate.h>
+#include <telemetry.h>
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+const int BAYS = 4;
+const unsigned long TICK_MS = 100;
+const unsigned long FIXED_PERIOD = 2000; // TICK_TIME before
+
+enum Phase
+{
+	PHASE_QUIET,
+	PHASE_SWING,
+	PHASE_FAILING,
+	PHASE_STEP,
+	PHASES,
+};
+
+const char *const PHASE_NAMES[PHASES] = {"quiet", "swing", "failing", "step"};
+
+// where the phases start, in minutes
+const unsigned long PHASE_START[PHASES + 1] = {0, 15, 25, 35, 60};
+
+struct PhaseCount
+{
+	unsigned long attempts;
+	unsigned long delivered;
+	unsigned long changes;       // changes past the deadbands that reached the broker
+	double latency_sum;          // ms
+	unsigned long latency_worst; // ms
+};
+
+// one way to decide when to publish, with what the broker has
+struct Schedule
+{
+	const char *name;
+	bool adaptive;
+	PublishRate rate;
+	unsigned long last;
+	bool started;
+	unsigned long failures;
+	unsigned long seen_failures;
+
+	// what was last handed over, for the rate, and what got to the broker
+	TickReport<BAYS> pushed_report;
+	FleetTable<BAYS> pushed_fleet;
+	TickReport<BAYS> broker_report;
+	FleetTable<BAYS> broker_fleet;
+
+	bool news;                // the broker is a change behind
+	unsigned long news_since; // since this tick
+	PhaseCount count[PHASES];
+
+	Schedule(const char *schedule_name, bool is_adaptive)
+		: name(schedule_name), adaptive(is_adaptive), last(0), started(false), failures(0), seen_failures(0),
+		  news(false), news_since(0), count()
+	{
+	}
+
+	bool due(unsigned long now, float change) const
+	{
+		if (adaptive)
+		{
+			return rate.due(now, change);
+		}
+		return !started || now - last >= FIXED_PERIOD;
+	}
+
+	void tick(const TickReport<BAYS> &report, const FleetTable<BAYS> &fleet, unsigned long now, Phase phase,
+			  bool link_up)
+	{
+		const DeltaSettings &deadband = TELEMETRY_DELTA_DEFAULTS;
+		if (!news && telemetry_change(report, fleet, broker_report, broker_fleet, deadband) >= 1)
+		{
+			news = true;
+			news_since = now;
+		}
+
+		float change = telemetry_change(report, fleet, pushed_report, pushed_fleet, deadband);
+		if (!due(now, change))
+		{
+			return;
+		}
+		if (adaptive)
+		{
+			if (failures != seen_failures)
+			{
+				rate.congested();
+			}
+			else
+			{
+				rate.delivered();
+			}
+			seen_failures = failures;
+			rate.published(now, change >= 1);
+		}
+		started = true;
+		last = now;
+		pushed_report = report;
+		pushed_fleet = fleet;
+
+		PhaseCount &counted = count[phase];
+		counted.attempts++;
+		if (!link_up)
+		{
+			failures++;
+			return;
+		}
+		counted.delivered++;
+		broker_report = report;
+		broker_fleet = fleet;
+		if (news)
+		{
+			unsigned long latency = now - news_since;
+			counted.changes++;
+			counted.latency_sum += latency;
+			if (latency > counted.latency_worst)
+			{
+				counted.latency_worst = latency;
+			}
+			news = false;
+		}
+	}
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+static void check_rate()
+{
+	PublishRate rate({250, 10000});
+	rate.set_limits(500, 100);
+	check(rate.get_limits().min_period == 500 && rate.get_limits().max_period == 500, "max below min");
+	rate.set_limits(0, 10000);
+	check(rate.get_limits().min_period == 1, "min of 0");
+
+	rate = PublishRate({250, 10000});
+	check(rate.due(0, 0), "first publish");
+	rate.published(0, false);
+	unsigned long now = 0;
+	for (int i = 0; i < 20; i++)
+	{
+		while (!rate.due(now, 0))
+		{
+			now += TICK_MS;
+		}
+		rate.published(now, false);
+	}
+	check(rate.get_period() == 10000, "quiet heartbeat");
+
+	check(!rate.due(now + 200, 5), "news before min_period");
+	check(rate.due(now + 300, 5), "news after min_period");
+
+	for (int i = 0; i < 6; i++)
+	{
+		rate.congested();
+	}
+	check(rate.get_floor() == 10000 && !rate.due(now + 5000, 5), "failing link");
+	for (int i = 0; i < 40; i++)
+	{
+		rate.delivered();
+	}
+	check(rate.get_floor() == 250, "link back");
+}
+
+int main()
+{
+	check_rate();
+
+	PanelController<BAYS> controller;
+	controller.start(7, 0);
+	Schedule fixed("fixed 2000 ms", false);
+	Schedule adaptive("PublishRate", true);
+	Schedule *schedules[] = {&fixed, &adaptive};
+
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> chance(0, 1);
+	TickReport<BAYS> report;
+	for (unsigned long now = 0; now < PHASE_START[PHASES] * 60000; now += TICK_MS)
+	{
+		unsigned long minute = now / 60000;
+		int phase = 0;
+		while (minute >= PHASE_START[phase + 1])
+		{
+			phase++;
+		}
+
+		int grid = 0;
+		bool link_up = true;
+		switch (phase)
+		{
+		case PHASE_SWING:
+			// a swing every 30 s, a car comes or goes every 40 s
+			grid = int(4000 + 4000 * sin(2 * M_PI * now / 30000.0));
+			if (now % 40000 == 0)
+			{
+				controller.press(int(now / 40000) % BAYS);
+			}
+			break;
+		case PHASE_FAILING:
+			grid = 2000;
+			link_up = chance(random) > 0.8f;
+			break;
+		case PHASE_STEP:
+			grid = minute >= 45 ? 3000 : 0;
+			break;
+		default:
+			break;
+		}
+		// the cars leave when the swing is over
+		if (phase != PHASE_SWING && controller.fleet.parked.any())
+		{
+			BitFlags<BAYS> parked = controller.fleet.parked;
+			parked.for_each([&controller](int bay) { controller.press(bay); });
+		}
+
+		controller.tick(grid, now, report);
+		for (Schedule *schedule : schedules)
+		{
+			schedule->tick(report, controller.fleet, now, Phase(phase), link_up);
+		}
+	}
+
+	printf("%-14s %-8s %9s %10s %8s %12s %12s\n", "schedule", "phase", "attempts", "delivered", "changes",
+		   "mean ms", "worst ms");
+	for (Schedule *schedule : schedules)
+	{
+		for (int phase = 0; phase < PHASES; phase++)
+		{
+			const PhaseCount &count = schedule->count[phase];
+			printf("%-14s %-8s %9lu %10lu %8lu %12.0f %12lu\n", schedule->name, PHASE_NAMES[phase], count.attempts,
+				   count.delivered, count.changes, count.changes ? count.latency_sum / count.changes : 0.0,
+				   count.latency_worst);
+		}
+	}
+
+	const PhaseCount &fixed_swing = fixed.count[PHASE_SWING];
+	const PhaseCount &adaptive_swing = adaptive.count[PHASE_SWING];
+	check(adaptive.count[PHASE_QUIET].attempts < fixed.count[PHASE_QUIET].attempts, "fewer publishes when quiet");
+	check(adaptive.count[PHASE_FAILING].attempts < fixed.count[PHASE_FAILING].attempts,
+		  "fewer publishes on a failing link");
+	check(adaptive_swing.latency_sum / adaptive_swing.changes < fixed_swing.latency_sum / fixed_swing.changes,
+		  "changes sooner while swinging");
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,365 @@
+/*
+Benchmark for SpscRing and the split into a control and a network task,
+runs on the host:
+  pio run -e bench_ring -t exec
+
+First one thread pushes numbered items and another pops them, through
+SpscRing and through a std::deque behind a std::mutex. The benchmark
+stops if an item is lost, repeated or out of order, and prints the items
+per second and the time from push to pop.
+
+Then frames the size of the OLED buffer go through SpscMailbox as fast
+as one thread can write them, like OledFlusher with a slow bus. Every
+frame taken must be whole, newer than the one before, and the last one
+taken must be the last one written. The frames taken and replaced must
+add up to the frames written.
+
+Then the testpanel loop is run scaled down on threads: a control tick
+every TICK_MS and publishing that blocks like client.publish does on a
+slow link, sometimes for a long time like a TCP retransmit. Once both
+run one after the other in one thread like loop() did before DUAL_CORE,
+and once the network runs in its own thread and gets the snapshots
+through SpscRing. The tick jitter and the time from a button press to
+its publish are printed for both, and the longest time the control loop
+did not get around to reading the buttons.
+*/
+#include <spscRing.h>
+#include <connection.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+static unsigned long micros_now()
+{
+	static const bench_clock::time_point start = bench_clock::now();
+	return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now() - start).count();
+}
+
+// about the size of a TickSnapshot for three bays
+struct Item
+{
+	unsigned long number;
+	unsigned long pushed_at;
+	char fleet[48];
+};
+
+// the same interface as SpscRing, with a lock
+template <class T>
+class MutexQueue
+{
+private:
+	std::mutex lock;
+	std::deque<T> items;
+	size_t capacity;
+
+public:
+	explicit MutexQueue(size_t size) : capacity(size) {}
+
+	bool push(const T &value)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (items.size() == capacity)
+		{
+			return false;
+		}
+		items.push_back(value);
+		return true;
+	}
+
+	bool pop(T &value)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (items.empty())
+		{
+			return false;
+		}
+		value = items.front();
+		items.pop_front();
+		return true;
+	}
+};
+
+static unsigned long percentile(std::vector<unsigned long> &values, double p)
+{
+	std::sort(values.begin(), values.end());
+	return values[size_t(p * (values.size() - 1))];
+}
+
+template <class Queue>
+static void handoff(const char *name, Queue &queue)
+{
+	const unsigned long ITEMS = 2000000;
+	std::vector<unsigned long> latency;
+	latency.reserve(ITEMS);
+
+	bench_clock::time_point start = bench_clock::now();
+	std::thread consumer([&]() {
+		Item item;
+		for (unsigned long expected = 0; expected < ITEMS;)
+		{
+			if (!queue.pop(item))
+			{
+				// the host may have fewer cores than threads
+				std::this_thread::yield();
+				continue;
+			}
+			if (item.number != expected)
+			{
+				printf("%s: got item %lu, expected %lu\n", name, item.number, expected);
+				exit(1);
+			}
+			latency.push_back(micros_now() - item.pushed_at);
+			expected++;
+		}
+	});
+
+	Item item = {};
+	for (unsigned long i = 0; i < ITEMS;)
+	{
+		item.number = i;
+		item.pushed_at = micros_now();
+		if (queue.push(item))
+		{
+			i++;
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+	consumer.join();
+	double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+	printf("%-12s %14.0f %12lu %12lu\n", name, ITEMS / seconds, percentile(latency, 0.5), percentile(latency, 0.99));
+}
+
+// a frame of the OLED, every word holds the number of the frame
+struct MailFrame
+{
+	uint32_t words[256];
+};
+
+static int mailbox()
+{
+	const uint32_t FRAMES = 500000;
+	static SpscMailbox<MailFrame> box;
+	std::atomic<bool> done(false);
+	unsigned long taken = 0;
+	bool failed = false;
+
+	std::thread reader([&]() {
+		uint32_t last = 0;
+		for (;;)
+		{
+			bool finished = done.load();
+			const MailFrame *frame = box.take();
+			if (frame == NULL)
+			{
+				if (finished)
+				{
+					break;
+				}
+				std::this_thread::yield();
+				continue;
+			}
+			uint32_t number = frame->words[0];
+			for (uint32_t word : frame->words)
+			{
+				failed |= word != number;
+			}
+			failed |= number <= last;
+			last = number;
+			taken++;
+		}
+		failed |= last != FRAMES;
+	});
+
+	unsigned long replaced = 0;
+	for (uint32_t number = 1; number <= FRAMES; number++)
+	{
+		MailFrame &frame = box.slot();
+		for (uint32_t &word : frame.words)
+		{
+			word = number;
+		}
+		replaced += !box.publish();
+		// the host may have fewer cores than threads
+		if (number % 64 == 0)
+		{
+			std::this_thread::yield();
+		}
+	}
+	done.store(true);
+	reader.join();
+
+	printf("%-12s %14lu %12lu %12lu\n", "SpscMailbox", (unsigned long)FRAMES, taken, replaced);
+	if (failed || taken + replaced != FRAMES)
+	{
+		printf("FAILED: a frame was torn, old, or not counted\n");
+		return 1;
+	}
+	return 0;
+}
+
+// the scaled down testpanel
+const unsigned long TICK_MS = 100;
+const int TICKS = 150;
+
+struct Snapshot
+{
+	bool pressed;
+	unsigned long pressed_at;
+};
+
+struct LoopResult
+{
+	LoopTimer jitter;
+	LoopTimer latency;
+	LoopTimer gap; // time between two passes of the control loop, the buttons are not read in it
+};
+
+// what client.publish costs: mostly fast, now and then a long stall
+static void publish_like(std::mt19937 &rng)
+{
+	unsigned long us = rng() % 20 == 0 ? 60000 : 1000 + rng() % 4000;
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+// a press every fifth tick, just before the tick
+static bool press(int tick)
+{
+	return tick % 5 == 4;
+}
+
+static void single_loop(LoopResult &result)
+{
+	std::mt19937 rng(7);
+	unsigned long next = micros_now() + TICK_MS * 1000;
+	unsigned long last = 0;
+	unsigned long pass = micros_now();
+	for (int tick = 0; tick < TICKS;)
+	{
+		unsigned long now = micros_now();
+		result.gap.add(now - pass);
+		pass = now;
+		if (now < next)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		next += TICK_MS * 1000;
+		if (last != 0)
+		{
+			unsigned long interval = now - last;
+			result.jitter.add(interval > TICK_MS * 1000 ? interval - TICK_MS * 1000 : TICK_MS * 1000 - interval);
+		}
+		last = now;
+
+		// the tick publishes before loop() gets back to anything else
+		bool pressed = press(tick);
+		publish_like(rng);
+		if (pressed)
+		{
+			result.latency.add(micros_now() - now);
+		}
+		tick++;
+	}
+}
+
+static void split(LoopResult &result)
+{
+	SpscRing<Snapshot, 4> ring;
+	std::atomic<bool> done(false);
+	std::thread network([&]() {
+		std::mt19937 rng(7);
+		Snapshot snapshot;
+		while (!done || !ring.empty())
+		{
+			if (!ring.pop(snapshot))
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				continue;
+			}
+			publish_like(rng);
+			if (snapshot.pressed)
+			{
+				result.latency.add(micros_now() - snapshot.pressed_at);
+			}
+		}
+	});
+
+	unsigned long next = micros_now() + TICK_MS * 1000;
+	unsigned long last = 0;
+	unsigned long dropped = 0;
+	unsigned long pass = micros_now();
+	for (int tick = 0; tick < TICKS;)
+	{
+		unsigned long now = micros_now();
+		result.gap.add(now - pass);
+		pass = now;
+		if (now < next)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		next += TICK_MS * 1000;
+		if (last != 0)
+		{
+			unsigned long interval = now - last;
+			result.jitter.add(interval > TICK_MS * 1000 ? interval - TICK_MS * 1000 : TICK_MS * 1000 - interval);
+		}
+		last = now;
+
+		Snapshot snapshot = {press(tick), now};
+		if (!ring.push(snapshot))
+		{
+			dropped++;
+		}
+		tick++;
+	}
+	done = true;
+	network.join();
+	if (dropped != 0)
+	{
+		printf("(%lu ticks dropped while the network was stalled)\n", dropped);
+	}
+}
+
+static void print(const char *name, const LoopResult &r)
+{
+	printf("%-12s %14lu %14lu %16lu %16lu %14lu\n", name, r.jitter.mean(), r.jitter.longest(), r.latency.mean(),
+		   r.latency.longest(), r.gap.longest());
+}
+
+int main()
+{
+	printf("%-12s %14s %12s %12s\n", "handoff", "items/s", "p50 us", "p99 us");
+	SpscRing<Item, 64> ring;
+	handoff("SpscRing", ring);
+	MutexQueue<Item> queue(64);
+	handoff("std::mutex", queue);
+
+	printf("\n%-12s %14s %12s %12s\n", "newest", "written", "taken", "replaced");
+	int failures = mailbox();
+
+	printf("\n%d ticks of %lu ms\n", TICKS, TICK_MS);
+	printf("%-12s %14s %14s %16s %16s %14s\n", "tasks", "jitter mean us", "jitter max us", "press->pub mean",
+		   "press->pub max", "scan gap max");
+	LoopResult one;
+	single_loop(one);
+	print("loop()", one);
+	LoopResult two;
+	split(two);
+	print("two tasks", two);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,371 @@
+/*
+Benchmark for the store-and-forward queue, runs on the host:
+  pio run -e bench_store -t exec
+
+A stand-in for mosquitto takes the messages of a sensor node that
+publishes every 2000 ms, and is stopped and started again. The log is
+written to files in a directory under /tmp, like the segments on LittleFS.
+
+The first run stops the broker for an hour, with a reboot in the middle
+of the outage (the RAM is written to the log first, like before a deep
+sleep). Every message must reach the broker once, live or on its history
+topic, with its time, and the history in order of sequence. The live
+messages must not wait for the history, and the history must not come
+faster than one batch per drain interval.
+
+The messages from before the reboot must be told apart by their sequence,
+for the age that is unknown if the clock of the node started again.
+
+The second run has a log of 4 x 2 kB and the same outage, so the oldest
+segments are dropped. The history that is left must be the newest, the
+dropped count must match the missing sequence numbers, and the log may
+not grow past its segments.
+*/
+#include <storeForward.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+const unsigned long PUBLISH_MS = 2000;
+const unsigned long STEP_MS = 50; // the loop of the node
+
+// ________________ the log in files, like flashLog.cpp ________________
+
+static std::string log_dir;
+static unsigned long segment_writes[STORE_MAX_SEGMENTS];
+
+static std::string segment_path(int segment)
+{
+	return log_dir + "/" + std::to_string(segment) + ".log";
+}
+
+static size_t file_append(int segment, const uint8_t *data, size_t length)
+{
+	FILE *file = fopen(segment_path(segment).c_str(), "ab");
+	if (file == NULL)
+	{
+		return 0;
+	}
+	size_t written = fwrite(data, 1, length, file);
+	fclose(file);
+	segment_writes[segment]++;
+	return written;
+}
+
+static size_t file_read(int segment, size_t offset, uint8_t *data, size_t length)
+{
+	FILE *file = fopen(segment_path(segment).c_str(), "rb");
+	if (file == NULL)
+	{
+		return 0;
+	}
+	size_t read = fseek(file, long(offset), SEEK_SET) == 0 ? fread(data, 1, length, file) : 0;
+	fclose(file);
+	return read;
+}
+
+static size_t file_size(int segment)
+{
+	FILE *file = fopen(segment_path(segment).c_str(), "rb");
+	if (file == NULL)
+	{
+		return 0;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	return size < 0 ? 0 : size_t(size);
+}
+
+static void file_remove(int segment)
+{
+	remove(segment_path(segment).c_str());
+}
+
+const LogDriver FILE_LOG = {file_append, file_read, file_size, file_remove};
+
+// ________________ the broker ________________
+
+struct Received
+{
+	bool history;
+	unsigned long sent;    // when the node published it first
+	unsigned long arrived; // when the broker got it
+	uint32_t sequence;     // history only
+};
+
+struct Broker
+{
+	bool up;
+	std::vector<Received> received;
+	unsigned long now;
+	unsigned long history_batch_start;
+	int history_in_batch;
+	int largest_batch; // history messages within one drain interval
+
+	Broker() : up(true), now(0), history_batch_start(0), history_in_batch(0), largest_batch(0) {}
+};
+
+static Broker broker;
+
+// the live message carries the time it was published, so the broker can check it
+static bool publish_live(const char *topic, const uint8_t *payload, size_t length)
+{
+	(void)topic;
+	if (!broker.up)
+	{
+		return false;
+	}
+	unsigned long sent;
+	std::string text(reinterpret_cast<const char *>(payload), length);
+	if (sscanf(text.c_str(), "{\"owner\": \"ESP32\", \"message\": %lu}", &sent) != 1)
+	{
+		return false;
+	}
+	broker.received.push_back(Received{false, sent, broker.now, 0});
+	return true;
+}
+
+static bool forward_history(const char *topic, const uint8_t *payload, size_t length, uint32_t sequence,
+							uint32_t time)
+{
+	if (!broker.up)
+	{
+		return false;
+	}
+	char history[STORE_TOPIC_SIZE + 8];
+	uint8_t buffer[64 + HISTORY_PAYLOAD_EXTRA];
+	size_t size = history_payload(payload, length, sequence, time, uint32_t(broker.now - time), buffer,
+								  sizeof(buffer) - 1);
+	if (size == 0 || !history_topic(topic, history, sizeof(history)))
+	{
+		return true;
+	}
+	buffer[size] = '\0';
+
+	// what a subscriber of the history topic reads
+	unsigned long seq, at, age, sent;
+	if (sscanf(reinterpret_cast<const char *>(buffer),
+			   "{\"seq\": %lu, \"time\": %lu, \"age\": %lu, \"owner\": \"ESP32\", \"message\": %lu}", &seq, &at, &age,
+			   &sent) != 4 ||
+		strcmp(history, "esp32/output/temperature/history") != 0 || at != sent || at + age != broker.now)
+	{
+		printf("FAILED: history message %s %s\n", history, buffer);
+		exit(1);
+	}
+
+	if (broker.now - broker.history_batch_start >= STORE_DEFAULTS.drain_interval)
+	{
+		broker.history_batch_start = broker.now;
+		broker.history_in_batch = 0;
+	}
+	broker.history_in_batch++;
+	if (broker.history_in_batch > broker.largest_batch)
+	{
+		broker.largest_batch = broker.history_in_batch;
+	}
+	broker.received.push_back(Received{true, sent, broker.now, uint32_t(seq)});
+	return true;
+}
+
+// ________________ the node ________________
+
+typedef StoreForward<16, 64> NodeStore;
+
+struct RunResult
+{
+	unsigned long published;
+	unsigned long live;
+	unsigned long history;
+	unsigned long duplicates;
+	unsigned long missing;
+	unsigned long dropped;
+	unsigned long out_of_order;
+	unsigned long live_late;    // live messages that arrived later than they were published
+	unsigned long old_kept;     // history older than a message that was dropped
+	unsigned long drain_ms;     // from the restart of the broker to an empty store
+	unsigned long before_boot;  // history the store tells from before the reboot
+	unsigned long stored_early; // history that was published before the reboot
+	int largest_batch;
+	int most_segments;
+};
+
+/*
+runs the node for "minutes", with the broker down from "down" to "up"
+minutes and a reboot at "reboot" (0 for none)
+*/
+static RunResult run(const StoreSettings &settings, unsigned long minutes, unsigned long down, unsigned long up,
+					 unsigned long reboot)
+{
+	std::string command = "rm -rf " + log_dir + " && mkdir -p " + log_dir;
+	if (system(command.c_str()) != 0)
+	{
+		printf("FAILED: %s\n", command.c_str());
+		exit(1);
+	}
+	memset(segment_writes, 0, sizeof(segment_writes));
+	broker = Broker();
+
+	RunResult result = {};
+	NodeStore *store = new NodeStore(FILE_LOG, settings);
+	store->begin();
+	std::vector<unsigned long> published; // the time of every message, the payload of the sensor
+	unsigned long empty_at = 0;
+	for (unsigned long now = 0; now < minutes * 60000; now += STEP_MS)
+	{
+		broker.now = now;
+		broker.up = now < down * 60000 || now >= up * 60000;
+		if (reboot != 0 && now == reboot * 60000)
+		{
+			store->flush();
+			delete store;
+			store = new NodeStore(FILE_LOG, settings);
+			store->begin();
+		}
+
+		if (now % PUBLISH_MS == 0)
+		{
+			char payload[64];
+			int length = snprintf(payload, sizeof(payload), "{\"owner\": \"ESP32\", \"message\": %lu}", now);
+			const char *topic = "esp32/output/temperature";
+			if (!publish_live(topic, reinterpret_cast<const uint8_t *>(payload), size_t(length)))
+			{
+				store->store(uint32_t(now), topic, reinterpret_cast<const uint8_t *>(payload), size_t(length));
+			}
+			published.push_back(now);
+		}
+		if (broker.up)
+		{
+			store->drain(now, forward_history);
+		}
+		if (store->segments_used() > result.most_segments)
+		{
+			result.most_segments = store->segments_used();
+		}
+		if (now >= up * 60000 && empty_at == 0 && store->empty())
+		{
+			empty_at = now;
+		}
+	}
+
+	std::map<unsigned long, int> seen;
+	uint32_t last_sequence = 0;
+	bool first = true;
+	for (const Received &received : broker.received)
+	{
+		seen[received.sent]++;
+		if (received.history)
+		{
+			result.history++;
+			if (!first && int32_t(received.sequence - last_sequence) <= 0)
+			{
+				result.out_of_order++;
+			}
+			first = false;
+			last_sequence = received.sequence;
+		}
+		else
+		{
+			result.live++;
+			result.live_late += received.arrived != received.sent;
+		}
+	}
+	unsigned long newest_missing = 0;
+	for (unsigned long sent : published)
+	{
+		int count = seen.count(sent) ? seen[sent] : 0;
+		result.missing += count == 0;
+		result.duplicates += count > 1 ? count - 1 : 0;
+		if (count == 0)
+		{
+			newest_missing = sent;
+		}
+	}
+	for (const Received &received : broker.received)
+	{
+		result.old_kept += received.history && result.missing > 0 && received.sent < newest_missing;
+		result.before_boot += received.history && !store->from_this_boot(received.sequence);
+		result.stored_early += received.history && received.sent < reboot * 60000;
+	}
+	result.published = published.size();
+	result.dropped = store->get_dropped();
+	result.drain_ms = empty_at - up * 60000;
+	result.largest_batch = broker.largest_batch;
+	delete store;
+	return result;
+}
+
+static void print(const char *name, const RunResult &result)
+{
+	printf("%-22s %9lu %6lu %8lu %8lu %8lu %8lu %10.1f %6d %9d\n", name, result.published, result.live,
+		   result.history, result.missing, result.dropped, result.duplicates, result.drain_ms / 1000.0,
+		   result.largest_batch, result.most_segments);
+}
+
+int main()
+{
+	log_dir = "/tmp/bench_store_" + std::to_string(getpid());
+	int failures = 0;
+
+	printf("%-22s %9s %6s %8s %8s %8s %8s %10s %6s %9s\n", "run", "published", "live", "history", "missing",
+		   "dropped", "repeated", "drain s", "batch", "segments");
+
+	// an hour down, rebooted after half an hour
+	RunResult full = run(STORE_DEFAULTS, 120, 10, 70, 40);
+	print("1 h outage, reboot", full);
+	if (full.missing != 0 || full.out_of_order != 0 || full.live_late != 0 ||
+		full.largest_batch > STORE_DEFAULTS.batch || full.dropped != 0)
+	{
+		printf("FAILED: the outage was not forwarded whole and in order\n");
+		failures++;
+	}
+	// the age of those is unknown if the clock of the node started again at the reboot
+	if (full.before_boot == 0 || full.before_boot != full.stored_early)
+	{
+		printf("FAILED: %lu of %lu messages from before the reboot were told apart\n", full.before_boot,
+			   full.stored_early);
+		failures++;
+	}
+	const char *kept = "{\"owner\": \"ESP32\", \"message\": 1}";
+	char unknown[64 + HISTORY_PAYLOAD_EXTRA];
+	size_t size = history_payload(reinterpret_cast<const uint8_t *>(kept), strlen(kept), 7, 1000, HISTORY_AGE_UNKNOWN,
+								  reinterpret_cast<uint8_t *>(unknown), sizeof(unknown) - 1);
+	unknown[size] = '\0';
+	if (strcmp(unknown, "{\"seq\": 7, \"time\": 1000, \"age\": null, \"owner\": \"ESP32\", \"message\": 1}") != 0)
+	{
+		printf("FAILED: unknown age %s\n", unknown);
+		failures++;
+	}
+	int files = 0;
+	unsigned long appends = 0;
+	for (int i = 0; i < STORE_DEFAULTS.segments; i++)
+	{
+		files += segment_writes[i] > 0;
+		appends += segment_writes[i];
+	}
+
+	// the same outage into a log that can not hold it
+	const StoreSettings small = {4, 2048, 8, 200};
+	RunResult bounded = run(small, 120, 10, 70, 0);
+	print("1 h outage, 8 kB log", bounded);
+	if (bounded.most_segments > small.segments || bounded.dropped == 0 || bounded.before_boot != 0 || bounded.dropped != bounded.missing ||
+		bounded.out_of_order != 0 || bounded.old_kept != 0)
+	{
+		printf("FAILED: the small log did not drop the oldest messages\n");
+		failures++;
+	}
+
+	printf("\nthe first run wrote %lu times to %d of the %d segment files\n", appends, files, STORE_DEFAULTS.segments);
+
+	std::string command = "rm -rf " + log_dir;
+	if (system(command.c_str()) != 0)
+	{
+		failures++;
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,436 @@
+/*
+Benchmark for the telemetry payloads, runs on the host:
+  pio run -e bench_telemetry -t exec
+
+Publishes the messages of one control tick, with string concatenation
+like the old printMQTT / printMQTT_parking, with TelemetryPublisher and
+with TelemetryPublisher in frame and binary frame mode. Every operator
+new is counted, so the number of heap allocations per tick is measured
+for all of them.
+
+The payloads and topics are compared first, and the benchmark stops if
+TelemetryPublisher does not send exactly the same bytes, if a frame does
+not fit its buffer, or if decode_frame does not give back every figure
+of the binary frame.
+
+Then a quiet car park is run for a few hours of ticks, with publishing
+of everything and with set_delta. What the dashboard would show is kept
+for both, and the benchmark stops if the bay status, the parked cars or
+a keyframe differs between them.
+*/
+#include <telemetry.h>
+#include <batteryDispatcher.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+// counts every allocation made through operator new, not inlined so the
+// compiler does not match the malloc and free inside them against each other
+static long long allocations = 0;
+
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+	allocations++;
+	void *memory = std::malloc(size == 0 ? 1 : size);
+	if (memory == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+__attribute__((noinline)) void operator delete(void *memory) noexcept
+{
+	std::free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void *memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+// what the publish functions saw
+static std::vector<std::string> sent;
+static bool record = false;
+static size_t bytes_sent = 0;
+static size_t messages_sent = 0;
+
+static std::vector<uint8_t> last_payload;
+
+// what a subscriber has seen, the dashboard keeps the last message per topic
+struct View
+{
+	std::map<std::string, std::string> topics;
+	// owner of the last decharging or charging message for every bay number
+	std::map<std::string, std::string> status;
+	size_t messages = 0;
+	size_t bytes = 0;
+};
+
+// everything is published to this view if it is set
+static View *view = nullptr;
+
+// the text after "key": up to the first of the end characters
+static std::string field(const std::string &payload, const char *key, const char *end)
+{
+	size_t start = payload.find(std::string("\"") + key + "\": ");
+	if (start == std::string::npos)
+	{
+		return "";
+	}
+	start += std::strlen(key) + 4;
+	return payload.substr(start, payload.find_first_of(end, start) - start);
+}
+
+static void show(View &target, const std::string &topic, const std::string &payload)
+{
+	target.messages++;
+	target.bytes += topic.size() + payload.size();
+	if (topic == TOPIC_GRID_DECHARGING || topic == TOPIC_GRID_CHARGING)
+	{
+		target.status[field(payload, "message", "}")] = field(payload, "owner", ",");
+	}
+	else
+	{
+		target.topics[topic] = payload;
+	}
+}
+
+static bool publish(const char *topic, const uint8_t *payload, size_t length)
+{
+	if (view != nullptr)
+	{
+		show(*view, topic, std::string(reinterpret_cast<const char *>(payload), length));
+		return true;
+	}
+	if (record)
+	{
+		sent.push_back(std::string(topic) + " " + std::string(reinterpret_cast<const char *>(payload), length));
+		last_payload.assign(payload, payload + length);
+	}
+	bytes_sent += std::strlen(topic) + length;
+	messages_sent++;
+	return true;
+}
+
+// string_tick publishes text, like the old code did with client.publish(topic, payload)
+static bool publish(const char *topic, const char *payload)
+{
+	return publish(topic, reinterpret_cast<const uint8_t *>(payload), std::strlen(payload));
+}
+
+// printMQTT and printMQTT_parking as they were, with std::string instead of String
+static void printMQTT(std::string topic, std::string msg, std::string owner)
+{
+	std::string mqtt_msg = "{\"owner\": \"" + owner + "\", \"message\": " + msg + "}";
+	std::string mqtt_topic = "esp32/output/" + topic;
+	publish(mqtt_topic.c_str(), mqtt_msg.c_str());
+}
+
+static void printMQTT_parking(std::string topic, std::string msg, std::string owner, int timeParked,
+							  int battery_status)
+{
+	std::string mqtt_msg = "{\"owner\": \"" + owner + "\", \"amount\": " + msg + ", \"timeParked\": " +
+						   std::to_string(timeParked) + " , \"battery_status\": " + std::to_string(battery_status) + "}";
+	std::string mqtt_topic = "esp32/output/" + topic;
+	publish(mqtt_topic.c_str(), mqtt_msg.c_str());
+}
+
+template <int BAYS>
+static void string_tick(const FleetTable<BAYS> &fleet, const TickReport<BAYS> &report)
+{
+	printMQTT("powergrid/need", std::to_string(report.result.battery_need), "grid");
+	printMQTT("powergrid/batteryPark", std::to_string(report.result.power_given_from_battery), "grid");
+	for (int i = 0; i < BAYS; i++)
+	{
+		printMQTT("powergrid/decharging", std::to_string(i + 1), fleet.decharging.get(i) ? "discharge" : "standby");
+	}
+	if (report.charging)
+	{
+		for (int i = 0; i < BAYS; i++)
+		{
+			if (report.charged.get(i))
+			{
+				printMQTT("powergrid/charging", std::to_string(i + 1), "charge");
+			}
+			if (!fleet.parked.get(i))
+			{
+				printMQTT("powergrid/charging", std::to_string(i + 1), "standby");
+			}
+		}
+	}
+	printMQTT("battery", std::to_string(report.grid), "pot_meter");
+	for (int i = 0; i < BAYS; i++)
+	{
+		printMQTT_parking("parking_" + std::to_string(i + 1), std::to_string(int(fleet.parked.get(i))),
+						  "button_" + std::to_string(i + 1), fleet.timeParked[i], fleet.battery_percent(i));
+	}
+	printMQTT("parking_status", std::to_string(fleet.parked_count()), "parking_status");
+}
+
+// the same names as BAY(pin, number) gives, made at runtime for any number of bays
+struct Layout
+{
+	std::vector<std::string> names;
+	std::vector<BayDescription> bays;
+
+	explicit Layout(int count) : names(3 * count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			std::string number = std::to_string(i + 1);
+			names[3 * i] = number;
+			names[3 * i + 1] = TOPIC("parking_") + number;
+			names[3 * i + 2] = "button_" + number;
+		}
+		for (int i = 0; i < count; i++)
+		{
+			bays.push_back(BayDescription{0, names[3 * i].c_str(), names[3 * i + 1].c_str(), names[3 * i + 2].c_str()});
+		}
+	}
+};
+
+// decodes a binary frame and compares every figure with the fleet and the report
+template <int BAYS>
+static bool binary_matches(const FleetTable<BAYS> &fleet, const TickReport<BAYS> &report,
+						   const std::vector<uint8_t> &payload)
+{
+	FrameHeader header;
+	FrameBay bays[BAYS];
+	if (!decode_frame(payload.data(), payload.size(), header, bays, BAYS))
+	{
+		return false;
+	}
+	if (header.bays != BAYS || header.grid != report.grid || header.need != report.result.battery_need ||
+		header.batteryPark != report.result.power_given_from_battery ||
+		header.parking_status != fleet.parked_count() || header.charging != report.charging)
+	{
+		return false;
+	}
+	for (int i = 0; i < BAYS; i++)
+	{
+		if (bays[i].number != i + 1 || bays[i].parked != fleet.parked.get(i) ||
+			bays[i].decharging != fleet.decharging.get(i) ||
+			bays[i].charged != (report.charging && report.charged.get(i)) ||
+			bays[i].battery_status != fleet.battery_percent(i) || bays[i].timeParked != uint32_t(fleet.timeParked[i]))
+		{
+			return false;
+		}
+	}
+
+	// a frame that is cut or from another version is refused
+	FrameHeader ignored;
+	std::vector<uint8_t> changed(payload);
+	changed[0]++;
+	return !decode_frame(payload.data(), payload.size() - 1, ignored, bays, BAYS) &&
+		   !decode_frame(changed.data(), changed.size(), ignored, bays, BAYS);
+}
+
+template <class Function>
+static void measure(const char *name, int bays, int ticks, Function tick)
+{
+	record = false;
+	bytes_sent = 0;
+	messages_sent = 0;
+	long long allocations_before = allocations;
+	bench_clock::time_point start = bench_clock::now();
+	for (int i = 0; i < ticks; i++)
+	{
+		tick(i);
+	}
+	long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start).count();
+	long long allocations_used = allocations - allocations_before;
+
+	printf("%8d %-24s %12.0f %14.1f %16.2f %14.1f %12zu\n", bays, name, double(ns) / ticks, double(ticks) * 1e9 / ns,
+		   double(allocations_used) / ticks, double(messages_sent) / ticks, bytes_sent / ticks);
+}
+
+template <int BAYS>
+static void bench()
+{
+	Layout layout(BAYS);
+	FleetTable<BAYS> fleet;
+	std::mt19937 rng(BAYS);
+	for (int i = 0; i < BAYS; i++)
+	{
+		fleet.parked.set(i, rng() % 4 != 0);
+		fleet.decharging.set(i, rng() % 3 == 0);
+		fleet.battery_status[i] = GridEnergy(20 + rng() % 60) * GRID_ENERGY_WH;
+		fleet.timeParked[i] = int(rng() % 5000);
+	}
+
+	// an idle tick where the cars are charged and a busy one where they give power
+	TickReport<BAYS> reports[2];
+	reports[0].grid = 0;
+	reports[0].result = DispatchResult{0, 0};
+	reports[0].charging = true;
+	reports[1].grid = 12345;
+	reports[1].result = DispatchResult{0, 12345};
+	reports[1].charging = false;
+	for (int i = 0; i < BAYS; i++)
+	{
+		reports[0].charged.set(i, fleet.parked.get(i) && i % 2 == 0);
+	}
+
+	TelemetryPublisher<BAYS> telemetry(layout.bays.data(), fleet, ::publish);
+
+	for (const TickReport<BAYS> &report : reports)
+	{
+		record = true;
+		sent.clear();
+		string_tick(fleet, report);
+		std::vector<std::string> expected = sent;
+		sent.clear();
+		telemetry.tick(report);
+		record = false;
+		if (sent != expected)
+		{
+			printf("%d bays: TelemetryPublisher does not send the same messages\n", BAYS);
+			exit(1);
+		}
+
+		record = true;
+		sent.clear();
+		telemetry.set_mode(TELEMETRY_FRAME);
+		telemetry.tick(report);
+		telemetry.set_mode(TELEMETRY_MESSAGES);
+		record = false;
+		if (sent.size() != 1)
+		{
+			printf("%d bays: the frame does not fit in %zu bytes\n", BAYS, TelemetryPublisher<BAYS>::FRAME_SIZE);
+			exit(1);
+		}
+
+		record = true;
+		sent.clear();
+		telemetry.set_mode(TELEMETRY_BINARY);
+		telemetry.tick(report);
+		telemetry.set_mode(TELEMETRY_MESSAGES);
+		record = false;
+		if (sent.size() != 1 || !binary_matches(fleet, report, last_payload))
+		{
+			printf("%d bays: the binary frame does not decode to the same figures\n", BAYS);
+			exit(1);
+		}
+	}
+
+	int ticks = 200000 / BAYS;
+	measure("String concatenation", BAYS, ticks, [&](int i) { string_tick(fleet, reports[i % 2]); });
+	measure("TelemetryPublisher", BAYS, ticks, [&](int i) { telemetry.tick(reports[i % 2]); });
+	telemetry.set_mode(TELEMETRY_FRAME);
+	measure("TelemetryPublisher frame", BAYS, ticks, [&](int i) { telemetry.tick(reports[i % 2]); });
+	telemetry.set_mode(TELEMETRY_BINARY);
+	measure("TelemetryPublisher binary", BAYS, ticks, [&](int i) { telemetry.tick(reports[i % 2]); });
+
+	// decoding is what the receiving side pays for the binary frame
+	std::vector<FrameBay> decoded(BAYS);
+	FrameHeader header;
+	measure("decode_frame", BAYS, ticks, [&](int) { decode_frame(last_payload.data(), last_payload.size(), header, decoded.data(), BAYS); });
+}
+
+// true if the two views show the same parked cars and bay status
+static bool same_state(const View &all, const View &delta, int bays)
+{
+	if (all.status != delta.status || all.topics.at(TOPIC_PARKING_STATUS) != delta.topics.at(TOPIC_PARKING_STATUS))
+	{
+		return false;
+	}
+	for (int i = 1; i <= bays; i++)
+	{
+		std::string topic = TOPIC("parking_") + std::to_string(i);
+		if (field(all.topics.at(topic), "amount", ",") != field(delta.topics.at(topic), "amount", ","))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+a quiet car park, 2 s ticks: an hour with no load where the cars are
+charged until they are full, then an hour where the potentiometer is
+steady with some noise. a car comes or goes about every two minutes
+*/
+template <int BAYS>
+static void quiet()
+{
+	const int TICKS = 4 * 1800;
+	Layout layout(BAYS);
+	FleetTable<BAYS> fleet;
+	BatteryDispatcher<BAYS> dispatcher(fleet);
+	std::mt19937 rng(BAYS);
+	for (int i = 0; i < BAYS; i++)
+	{
+		fleet.parked.set(i, i % 3 != 0);
+		fleet.battery_status[i] = GridEnergy(20 + rng() % 60) * GRID_ENERGY_WH;
+		dispatcher.update(i);
+	}
+
+	TelemetryPublisher<BAYS> all(layout.bays.data(), fleet, ::publish);
+	TelemetryPublisher<BAYS> delta(layout.bays.data(), fleet, ::publish);
+	delta.set_delta(true);
+	const unsigned long keyframe_ticks = TELEMETRY_DELTA_DEFAULTS.keyframe_interval / 2000;
+
+	View all_view;
+	View delta_view;
+	for (int tick = 0; tick < TICKS; tick++)
+	{
+		if (rng() % 60 == 0)
+		{
+			int bay = int(rng() % BAYS);
+			fleet.parked.toggle(bay);
+			fleet.battery_status[bay] = GridEnergy(20 + rng() % 60) * GRID_ENERGY_WH;
+			dispatcher.update(bay);
+		}
+		fleet.time_parked(GRID_TICK_MS);
+
+		TickReport<BAYS> report;
+		report.grid = (tick / 1800) % 2 == 0 ? 0 : 4000 + int(rng() % 61) - 30;
+		report.time = (unsigned long)tick * 2000;
+		report.result = dispatcher.dispatch(report.grid, GRID_TICK_MS);
+		report.charging = dispatcher.charge(report.grid, GRID_TICK_MS, report.charged);
+
+		view = &all_view;
+		all.tick(report);
+		view = &delta_view;
+		delta.tick(report);
+		view = nullptr;
+
+		bool keyframe = tick % keyframe_ticks == 0;
+		if (!same_state(all_view, delta_view, BAYS) || (keyframe && all_view.topics != delta_view.topics))
+		{
+			printf("%d bays: the delta messages show something else at tick %d\n", BAYS, tick);
+			exit(1);
+		}
+	}
+
+	printf("%8d %-24s %14.2f %12.1f\n", BAYS, "everything", double(all_view.messages) / TICKS,
+		   double(all_view.bytes) / TICKS);
+	printf("%8d %-24s %14.2f %12.1f\n", BAYS, "delta", double(delta_view.messages) / TICKS,
+		   double(delta_view.bytes) / TICKS);
+}
+
+int main()
+{
+	printf("%8s %-24s %12s %14s %16s %14s %12s\n", "bays", "payloads", "ns/tick", "ticks/s", "allocations/tick",
+		   "messages/tick", "bytes/tick");
+	bench<3>();
+	bench<16>();
+	bench<64>();
+
+	printf("\nquiet car park, %lu s keyframes\n", TELEMETRY_DELTA_DEFAULTS.keyframe_interval / 1000);
+	printf("%8s %-24s %14s %12s\n", "bays", "messages", "messages/tick", "bytes/tick");
+	quiet<3>();
+	quiet<16>();
+	quiet<64>();
+	return 0;
+}
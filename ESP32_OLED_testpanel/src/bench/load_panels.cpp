@@ -0,0 +1,800 @@
+/*
+Load generator for the broker and the dashboard, runs on the host against
+the mosquitto of mosquitto-docker-compose-master/full-stack:
+  docker-compose up -d mqtt
+  pio run -e load_panels
+  .pio/build/load_panels/program [--host 127.0.0.1] [--port 1883] [--steps 10,100,1000]
+      [--seconds 30] [--sensors 25] [--speed 1] [--frame]
+
+Every virtual testpanel is a PanelController, a PublishRate and a
+TelemetryPublisher of the firmware, with its own MQTT connection and the
+client id and topics DeviceId gives a panel, so the broker gets what a
+fleet of real panels would send: a control tick every 100 ms, and the
+messages (or the frame, with --frame) of the ticks PublishRate lets
+through. The grid load of a panel swings for 10 s of every minute and a
+car comes or goes every 40 s or so, at a random phase per panel.
+--sensors is the share of the devices, in %, that are sensor nodes like
+bme280 instead: temperature, humidity, pressure and altitude every time
+their PublishRate lets them through. --speed runs the simulated time
+that many times faster than the clock, for a bigger load per device.
+
+One more connection subscribes to site/+/esp32/output/# the way the
+Node-RED flow does and takes the time from the publish of every message
+to its arrival. The messages of one device arrive in the order they were
+sent, so a message that is skipped over was lost by the broker.
+
+The fleet is stepped up through --steps, the connections of one step are
+kept for the next one. After the connections of a step are up it
+publishes for --seconds and waits 2 s for what is still on its way. Per
+step it prints the messages published and received per second, the
+round trip p50, p90, p99 and the longest in ms, the messages that never
+arrived, the publishes that did not go out because the connection was
+backed up, and ticks the generator itself was late for (if that is not 0
+the host is the limit, not the broker).
+
+Only QoS 0, like PubSubClient on the panels. For thousands of devices
+the broker needs more open files than the default 1024, see the
+ulimits in docker-compose.yml, and the generator raises its own limit.
+*/
+#include <panelController.h>
+#include <publishRate.h>
+#include <telemetry.h>
+#include <deviceId.h>
+#include <storeForward.h>
+#include <metrics.h>
+#include <bays.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const unsigned long CONTROL_MS = 100; // CONTROL_TIME of the testpanel
+const unsigned long SAMPLE_MS = 250;  // SAMPLE_TIME of bme280
+const PublishRateSettings PANEL_RATE = {250, 10000};
+const PublishRateSettings SENSOR_RATE = {1000, 30000};
+const size_t BACKLOG_LIMIT = 64 * 1024; // bytes waiting for a connection, a publish past it fails
+const uint16_t KEEPALIVE_S = 60;
+const unsigned long DRAIN_MS = 2000;
+const int CONNECTS_PER_ROUND = 64; // new connections per turn of the loop, so the broker is not flooded
+
+static uint64_t now_us()
+{
+	return uint64_t(
+		std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+			.count());
+}
+
+// ________________ MQTT 3.1.1, as much as the panels use ________________
+
+static void put_length(std::string &out, size_t length)
+{
+	do
+	{
+		uint8_t byte = uint8_t(length % 128);
+		length /= 128;
+		out += char(length > 0 ? byte | 0x80 : byte);
+	} while (length > 0);
+}
+
+static void put_string(std::string &out, const char *text, size_t length)
+{
+	out += char(length >> 8);
+	out += char(length & 0xFF);
+	out.append(text, length);
+}
+
+static void put_packet(std::string &out, uint8_t type, const std::string &body)
+{
+	out += char(type);
+	put_length(out, body.size());
+	out += body;
+}
+
+struct MqttConnection
+{
+	int fd;
+	bool open;   // the TCP connection is there, or on its way
+	bool up;     // CONNACK with rc 0
+	bool failed; // refused or closed, not tried again
+	std::string out;
+	size_t out_sent;
+	std::vector<uint8_t> in;
+	uint64_t last_write;
+
+	MqttConnection() : fd(-1), open(false), up(false), failed(false), out_sent(0), last_write(0) {}
+	~MqttConnection()
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+	}
+
+	size_t backlog() const { return out.size() - out_sent; }
+
+	bool start(const sockaddr_in &broker, const char *client_id)
+	{
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			failed = true;
+			return false;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (connect(fd, reinterpret_cast<const sockaddr *>(&broker), sizeof(broker)) != 0 && errno != EINPROGRESS)
+		{
+			failed = true;
+			return false;
+		}
+		open = true;
+
+		std::string body;
+		put_string(body, "MQTT", 4);
+		body += char(4);    // 3.1.1
+		body += char(0x02); // clean session, like the sensor nodes
+		body += char(KEEPALIVE_S >> 8);
+		body += char(KEEPALIVE_S & 0xFF);
+		put_string(body, client_id, strlen(client_id));
+		put_packet(out, 0x10, body);
+		return true;
+	}
+
+	bool publish(const char *topic, const uint8_t *payload, size_t length)
+	{
+		if (!up || backlog() > BACKLOG_LIMIT)
+		{
+			return false;
+		}
+		std::string body;
+		put_string(body, topic, strlen(topic));
+		body.append(reinterpret_cast<const char *>(payload), length);
+		put_packet(out, 0x30, body);
+		return true;
+	}
+
+	void subscribe(const char *filter)
+	{
+		std::string body;
+		body += char(0);
+		body += char(1); // packet id
+		put_string(body, filter, strlen(filter));
+		body += char(0); // QoS 0
+		put_packet(out, 0x82, body);
+	}
+
+	void ping(uint64_t now)
+	{
+		if (up && out.size() == out_sent && now - last_write > KEEPALIVE_S * 500000ULL)
+		{
+			out += char(0xC0);
+			out += char(0);
+		}
+	}
+
+	void flush(uint64_t now)
+	{
+		while (open && out_sent < out.size())
+		{
+			ssize_t sent = send(fd, out.data() + out_sent, out.size() - out_sent, MSG_NOSIGNAL);
+			if (sent <= 0)
+			{
+				if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOTCONN)
+				{
+					lost();
+				}
+				return;
+			}
+			out_sent += size_t(sent);
+			last_write = now;
+		}
+		if (out_sent == out.size())
+		{
+			out.clear();
+			out_sent = 0;
+		}
+	}
+
+	void lost()
+	{
+		open = false;
+		up = false;
+		failed = true;
+	}
+
+	// reads what is there and hands every PUBLISH to "received"
+	template <class Received>
+	void read(Received received)
+	{
+		uint8_t chunk[16384];
+		for (;;)
+		{
+			ssize_t got = recv(fd, chunk, sizeof(chunk), 0);
+			if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+			{
+				lost();
+				return;
+			}
+			if (got < 0)
+			{
+				break;
+			}
+			in.insert(in.end(), chunk, chunk + got);
+		}
+
+		size_t at = 0;
+		while (in.size() - at >= 2)
+		{
+			size_t length = 0;
+			size_t header = 1;
+			int shift = 0;
+			bool complete = false;
+			while (at + header < in.size() && header <= 4)
+			{
+				uint8_t byte = in[at + header++];
+				length |= size_t(byte & 0x7F) << shift;
+				shift += 7;
+				if ((byte & 0x80) == 0)
+				{
+					complete = true;
+					break;
+				}
+			}
+			if (!complete || in.size() - at < header + length)
+			{
+				break;
+			}
+			const uint8_t *body = in.data() + at + header;
+			uint8_t type = in[at] >> 4;
+			if (type == 2 && length >= 2)
+			{
+				up = body[1] == 0;
+				failed = !up;
+			}
+			else if (type == 3 && length >= 2)
+			{
+				size_t topic_length = size_t(body[0]) << 8 | body[1];
+				size_t skip = 2 + topic_length + ((in[at] & 0x06) != 0 ? 2 : 0);
+				if (skip <= length)
+				{
+					received(std::string(reinterpret_cast<const char *>(body + 2), topic_length), body + skip,
+							 length - skip);
+				}
+			}
+			at += header + length;
+		}
+		in.erase(in.begin(), in.begin() + at);
+	}
+};
+
+// ________________ what was sent, and what came back ________________
+
+static uint32_t message_hash(const char *topic, const uint8_t *payload, size_t length)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (const char *c = topic; *c != '\0'; c++)
+	{
+		hash = (hash ^ uint8_t(*c)) * 16777619u;
+	}
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ payload[i]) * 16777619u;
+	}
+	return hash;
+}
+
+struct Sent
+{
+	uint32_t hash;
+	uint64_t time;
+};
+
+struct StepStats
+{
+	unsigned long published;
+	unsigned long backed_up;
+	unsigned long received;
+	unsigned long lost;
+	unsigned long unknown; // not from this run, e.g. a real panel on the same broker
+	unsigned long late_ticks;
+	LogHistogram round_trip; // us
+};
+
+static StepStats stats;
+
+// the devices by their name, and the messages of each on their way
+static std::unordered_map<std::string, int> device_index;
+static std::vector<std::deque<Sent>> in_flight;
+
+static void received(const std::string &topic, const uint8_t *payload, size_t length)
+{
+	uint64_t now = now_us();
+	// site/<name>/...
+	size_t first = topic.find('/');
+	size_t second = first == std::string::npos ? first : topic.find('/', first + 1);
+	auto device = second == std::string::npos ? device_index.end()
+											  : device_index.find(topic.substr(first + 1, second - first - 1));
+	if (device == device_index.end())
+	{
+		stats.unknown++;
+		return;
+	}
+	std::deque<Sent> &queue = in_flight[device->second];
+	uint32_t hash = message_hash(topic.c_str(), payload, length);
+	for (size_t i = 0; i < queue.size(); i++)
+	{
+		if (queue[i].hash == hash)
+		{
+			// everything the device sent before it did not come
+			stats.lost += i;
+			stats.round_trip.add(uint32_t(now - queue[i].time));
+			stats.received++;
+			queue.erase(queue.begin(), queue.begin() + long(i) + 1);
+			return;
+		}
+	}
+	stats.unknown++;
+}
+
+// ________________ the devices ________________
+
+struct Device
+{
+	int index;
+	DeviceId id;
+	MqttConnection connection;
+	unsigned long next_tick; // simulated ms
+	PublishRate rate;
+	unsigned long backed_up; // publishes of this device that did not go out
+
+	Device(int device_index, const PublishRateSettings &settings)
+		: index(device_index), next_tick(0), rate(settings), backed_up(0)
+	{
+	}
+	virtual ~Device() {}
+	virtual void tick(unsigned long now) = 0;
+	virtual unsigned long period() const = 0;
+};
+
+static bool publish_device(Device &device, const char *topic, const uint8_t *payload, size_t length)
+{
+	char full[STORE_TOPIC_SIZE + DEVICE_PREFIX_SIZE];
+	if (!device.id.topic(topic, full, sizeof(full)) || !device.connection.publish(full, payload, length))
+	{
+		stats.backed_up++;
+		device.backed_up++;
+		return false;
+	}
+	stats.published++;
+	in_flight[device.index].push_back(Sent{message_hash(full, payload, length), now_us()});
+	return true;
+}
+
+static Device *publishing = NULL; // TelemetryPublisher takes a plain function
+
+static bool publish_current(const char *topic, const uint8_t *payload, size_t length)
+{
+	return publish_device(*publishing, topic, payload, length);
+}
+
+struct VirtualPanel : Device
+{
+	PanelController<BAY_COUNT> controller;
+	TelemetryPublisher<BAY_COUNT> telemetry;
+	TickReport<BAY_COUNT> sent_report;
+	FleetTable<BAY_COUNT> sent_fleet;
+	bool first;
+	unsigned long phase; // ms into the minute the swing starts
+	std::mt19937 random;
+
+	VirtualPanel(int device_index, bool frame)
+		: Device(device_index, PANEL_RATE), telemetry(BAY_LAYOUT, controller.fleet, publish_current), first(true),
+		  phase(0), random(uint32_t(device_index) + 1)
+	{
+		id.begin("site", "testpanel", 0x100000000000ULL + uint64_t(device_index));
+		controller.start(uint32_t(device_index) + 1, 0);
+		telemetry.set_mode(frame ? TELEMETRY_FRAME : TELEMETRY_MESSAGES);
+		telemetry.set_delta(true);
+		phase = random() % 60000;
+	}
+
+	unsigned long period() const { return CONTROL_MS; }
+
+	void tick(unsigned long now)
+	{
+		unsigned long minute = (now + phase) % 60000;
+		int grid = minute < 10000 ? int(4000 + 4000 * sin(2 * M_PI * minute / 5000.0)) : 1500;
+		if (random() % 400 == 0)
+		{
+			controller.press(int(random() % BAY_COUNT));
+		}
+		TickReport<BAY_COUNT> report;
+		controller.tick(grid, now, report);
+		float change = telemetry_change(report, controller.fleet, sent_report, sent_fleet, telemetry.get_deadband());
+		if (!first && !rate.due(now, change))
+		{
+			return;
+		}
+		rate.published(now, change >= 1);
+		unsigned long backed_up_before = backed_up;
+		publishing = this;
+		telemetry.tick(report);
+		// publishes that could not go out hold the rate back, like on the panel
+		backed_up == backed_up_before ? rate.delivered() : rate.congested();
+		sent_report = report;
+		sent_fleet = controller.fleet;
+		first = false;
+	}
+};
+
+struct VirtualSensor : Device
+{
+	float temperature, humidity, pressure;
+	float sent_temperature, sent_humidity, sent_pressure;
+	std::mt19937 random;
+	std::normal_distribution<float> drift;
+
+	explicit VirtualSensor(int device_index)
+		: Device(device_index, SENSOR_RATE), temperature(21), humidity(40), pressure(1013), sent_temperature(-100),
+		  sent_humidity(0), sent_pressure(0), random(uint32_t(device_index) + 1), drift(0, 1)
+	{
+		id.begin("site", "bme280", 0x200000000000ULL + uint64_t(device_index));
+	}
+
+	unsigned long period() const { return SAMPLE_MS; }
+
+	bool value(const char *topic, float value)
+	{
+		char number[16];
+		snprintf(number, sizeof(number), "%.2f", value);
+		char buffer[TELEMETRY_BUFFER_SIZE];
+		JsonWriter json(buffer, sizeof(buffer));
+		message_payload(json, "bme280", number);
+		return publish_device(*this, topic, reinterpret_cast<const uint8_t *>(json.c_str()), json.length());
+	}
+
+	void tick(unsigned long now)
+	{
+		temperature += 0.02f * drift(random);
+		humidity += 0.1f * drift(random);
+		pressure += 0.02f * drift(random);
+		// the deadbands of bme280
+		float change = fabsf(temperature - sent_temperature) / 0.1f;
+		change = fmaxf(change, fabsf(humidity - sent_humidity) / 0.5f);
+		change = fmaxf(change, fabsf(pressure - sent_pressure) / 0.1f);
+		if (!rate.due(now, change))
+		{
+			return;
+		}
+		rate.published(now, change >= 1);
+		bool sent = value(TOPIC("temperature"), temperature);
+		sent &= value(TOPIC("humidity"), humidity);
+		sent &= value(TOPIC("pressure"), pressure);
+		sent &= value(TOPIC("altitude"), 44330.0f * (1.0f - powf(pressure / 1013.25f, 0.1903f)));
+		sent ? rate.delivered() : rate.congested();
+		sent_temperature = temperature;
+		sent_humidity = humidity;
+		sent_pressure = pressure;
+	}
+};
+
+// ________________ the run ________________
+
+struct Options
+{
+	std::string host;
+	int port;
+	std::vector<int> steps;
+	unsigned long seconds;
+	int sensors; // % of the devices
+	double speed;
+	bool frame;
+};
+
+static std::vector<std::unique_ptr<Device>> devices;
+static MqttConnection subscriber;
+
+// one turn of the loop: writes, waits up to timeout_ms for the sockets, reads
+static void serve(int timeout_ms)
+{
+	static std::vector<pollfd> fds;
+	static std::vector<MqttConnection *> owners;
+	fds.clear();
+	owners.clear();
+	uint64_t now = now_us();
+	auto add = [&](MqttConnection &connection) {
+		if (!connection.open)
+		{
+			return;
+		}
+		connection.ping(now);
+		connection.flush(now);
+		short events = POLLIN;
+		if (connection.backlog() > 0)
+		{
+			events |= POLLOUT;
+		}
+		fds.push_back(pollfd{connection.fd, events, 0});
+		owners.push_back(&connection);
+	};
+	add(subscriber);
+	for (auto &device : devices)
+	{
+		add(device->connection);
+	}
+	if (poll(fds.data(), fds.size(), timeout_ms) <= 0)
+	{
+		return;
+	}
+	now = now_us();
+	for (size_t i = 0; i < fds.size(); i++)
+	{
+		if (fds[i].revents & (POLLERR | POLLHUP))
+		{
+			owners[i]->lost();
+			continue;
+		}
+		if (fds[i].revents & POLLOUT)
+		{
+			owners[i]->flush(now);
+		}
+		if (fds[i].revents & POLLIN)
+		{
+			owners[i]->read(received);
+		}
+	}
+}
+
+static double percentile(const LogHistogram &histogram, double fraction)
+{
+	uint32_t total = histogram.count();
+	uint32_t seen = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS && total > 0; i++)
+	{
+		seen += histogram.get(i);
+		if (seen >= fraction * total)
+		{
+			return LogHistogram::upper(i) / 1000.0;
+		}
+	}
+	return 0;
+}
+
+static bool parse_options(int argc, char **argv, Options &options)
+{
+	options.host = "127.0.0.1";
+	options.port = 1883;
+	options.steps = {10, 100, 1000};
+	options.seconds = 30;
+	options.sensors = 25;
+	options.speed = 1;
+	options.frame = false;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		bool has_value = i + 1 < argc;
+		if (option == "--frame")
+		{
+			options.frame = true;
+		}
+		else if (option == "--host" && has_value)
+		{
+			options.host = argv[++i];
+		}
+		else if (option == "--port" && has_value)
+		{
+			options.port = atoi(argv[++i]);
+		}
+		else if (option == "--seconds" && has_value)
+		{
+			options.seconds = strtoul(argv[++i], NULL, 10);
+		}
+		else if (option == "--sensors" && has_value)
+		{
+			options.sensors = atoi(argv[++i]);
+		}
+		else if (option == "--speed" && has_value)
+		{
+			options.speed = atof(argv[++i]);
+		}
+		else if (option == "--steps" && has_value)
+		{
+			options.steps.clear();
+			for (char *step = strtok(argv[++i], ","); step != NULL; step = strtok(NULL, ","))
+			{
+				options.steps.push_back(atoi(step));
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return !options.steps.empty() && options.speed > 0 && options.sensors >= 0 && options.sensors <= 100;
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!parse_options(argc, argv, options))
+	{
+		printf("usage: %s [--host 127.0.0.1] [--port 1883] [--steps 10,100,1000] [--seconds 30] "
+			   "[--sensors 25] [--speed 1] [--frame]\n",
+			   argv[0]);
+		return 2;
+	}
+
+	// a socket per device
+	rlimit files;
+	getrlimit(RLIMIT_NOFILE, &files);
+	files.rlim_cur = files.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &files);
+
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *address = NULL;
+	if (getaddrinfo(options.host.c_str(), NULL, &hints, &address) != 0 || address == NULL)
+	{
+		printf("FAILED: can not resolve %s\n", options.host.c_str());
+		return 1;
+	}
+	sockaddr_in broker = *reinterpret_cast<sockaddr_in *>(address->ai_addr);
+	broker.sin_port = htons(uint16_t(options.port));
+	freeaddrinfo(address);
+
+	// the dashboard
+	char subscriber_id[32];
+	snprintf(subscriber_id, sizeof(subscriber_id), "load-dashboard-%d", int(getpid()));
+	subscriber.start(broker, subscriber_id);
+	subscriber.subscribe("site/+/esp32/output/#");
+	for (uint64_t until = now_us() + 5000000; !subscriber.up && !subscriber.failed && now_us() < until;)
+	{
+		serve(10);
+	}
+	if (!subscriber.up)
+	{
+		printf("FAILED: no broker on %s:%d\n", options.host.c_str(), options.port);
+		return 1;
+	}
+
+	printf("%s, %.3gx speed, %d %% sensor nodes, %lu s per step\n\n",
+		   options.frame ? "TELEMETRY_FRAME" : "TELEMETRY_MESSAGES", options.speed, options.sensors, options.seconds);
+	printf("%7s %7s %7s %9s %9s %7s %7s %7s %8s %8s %9s %6s\n", "devices", "panels", "conn s", "sent/s", "recv/s",
+		   "p50 ms", "p90 ms", "p99 ms", "max ms", "lost", "backed up", "late");
+
+	int failures = 0;
+	for (int step : options.steps)
+	{
+		// the new devices of the step, every fourth or so a sensor node
+		uint64_t connect_start = now_us();
+		int panels = 0;
+		while (int(devices.size()) < step)
+		{
+			int index = int(devices.size());
+			bool sensor = (index * options.sensors) % 100 + options.sensors >= 100;
+			Device *device = sensor ? static_cast<Device *>(new VirtualSensor(index))
+									: static_cast<Device *>(new VirtualPanel(index, options.frame));
+			devices.emplace_back(device);
+			in_flight.emplace_back();
+			device_index[device->id.get_name()] = index;
+		}
+		size_t started = 0;
+		for (;;)
+		{
+			for (int i = 0; i < CONNECTS_PER_ROUND && started < devices.size(); started++)
+			{
+				Device &device = *devices[started];
+				if (!device.connection.open && !device.connection.failed)
+				{
+					device.connection.start(broker, device.id.get_client_id());
+					i++;
+				}
+			}
+			bool waiting = started < devices.size();
+			for (auto &device : devices)
+			{
+				waiting |= device->connection.open && !device->connection.up;
+			}
+			if (!waiting || now_us() - connect_start > 60000000)
+			{
+				break;
+			}
+			serve(10);
+		}
+		int up = 0;
+		for (auto &device : devices)
+		{
+			up += device->connection.up;
+			panels += dynamic_cast<VirtualPanel *>(device.get()) != NULL;
+		}
+		double connect_s = (now_us() - connect_start) / 1e6;
+
+		// the step, in simulated ms from its start
+		stats.published = stats.backed_up = stats.received = stats.lost = stats.unknown = stats.late_ticks = 0;
+		stats.round_trip.reset();
+		std::mt19937 phases{uint32_t(step)};
+		unsigned long simulated_end = (unsigned long)(options.seconds * 1000 * options.speed);
+		for (auto &device : devices)
+		{
+			device->next_tick = phases() % device->period();
+		}
+		uint64_t start = now_us();
+		for (;;)
+		{
+			unsigned long now = (unsigned long)((now_us() - start) / 1000 * options.speed);
+			if (now >= simulated_end)
+			{
+				break;
+			}
+			for (auto &device : devices)
+			{
+				if (!device->connection.up || device->next_tick > now)
+				{
+					continue;
+				}
+				device->tick(device->next_tick);
+				device->next_tick += device->period();
+				if (device->next_tick + 10 * device->period() < now)
+				{
+					// the generator can not keep up, the ticks it missed are not made up
+					stats.late_ticks += (now - device->next_tick) / device->period();
+					device->next_tick = now;
+				}
+			}
+			serve(1);
+		}
+		for (uint64_t until = now_us() + DRAIN_MS * 1000; now_us() < until;)
+		{
+			serve(10);
+		}
+		for (std::deque<Sent> &queue : in_flight)
+		{
+			stats.lost += queue.size();
+			queue.clear();
+		}
+
+		double seconds = options.seconds;
+		printf("%7d %7d %7.1f %9.0f %9.0f %7.1f %7.1f %7.1f %8.1f %8lu %9lu %6lu\n", up, panels, connect_s,
+			   stats.published / seconds, stats.received / seconds, percentile(stats.round_trip, 0.50),
+			   percentile(stats.round_trip, 0.90), percentile(stats.round_trip, 0.99),
+			   percentile(stats.round_trip, 1.0), stats.lost, stats.backed_up, stats.late_ticks);
+		fflush(stdout);
+		if (up < step)
+		{
+			printf("        %d of %d devices could not connect\n", step - up, step);
+			failures++;
+		}
+		if (!subscriber.up)
+		{
+			printf("FAILED: the broker closed the dashboard connection\n");
+			return 1;
+		}
+	}
+	if (stats.unknown > 0)
+	{
+		printf("\n%lu messages of other devices on the broker were not counted\n", stats.unknown);
+	}
+	return failures == 0 ? 0 : 1;
+}
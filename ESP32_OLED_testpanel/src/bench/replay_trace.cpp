@@ -0,0 +1,398 @@
+/*
+Replays a trace of the testpanel on the host:
+  pio run -e replay_trace -t exec
+  .pio/build/replay_trace/program <trace>
+
+The trace is what the panel writes with TRACE_OUTPUT, either the serial log
+or the messages of site/<panel>/esp32/output/trace saved with mosquitto_sub
+(one panel, the records of two panels do not make one trace). Every "T"
+line is read, the rest is skipped. A session record starts a new
+PanelController with the seed of the panel, the presses are applied in
+order and every tick is run again with the recorded grid load. The outputs
+of the tick must be the same as the ones in the trace, the first few that
+are not are printed with the time of the tick.
+
+The session also tells the dispatch policy, the replay runs the policy of
+the first session and skips the sessions of another one. A lost record
+means the panel dropped records, so the rest of that session can not be
+replayed and is skipped up to the next session.
+
+Without a file a day of ticks is recorded with the same controller and
+replayed, once as it is, once with one tick output changed and once with
+one press left out, to show that the replay finds both. Then a day with
+each of the other policies.
+*/
+#include <panelController.h>
+#include <dispatchPolicy.h>
+#include <traceLog.h>
+#include <bays.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+// CONTROL_TIME in main.cpp, the loop starts a tick up to TICK_LATE ms late
+const unsigned long TICK_MS = 100;
+const unsigned long TICK_LATE = 30;
+const unsigned long DAY_MS = 24UL * 3600 * 1000;
+
+// the tick outputs, value[1] to value[5] of a tick record
+const char *const OUTPUT_NAMES[TRACE_VALUES] = {
+	"grid", "powergrid/need", "powergrid/batteryPark", "charging", "powergrid/decharging", "powergrid/charging",
+};
+
+const int PRINT_MISMATCHES = 5;
+
+struct ReplayResult
+{
+	unsigned long sessions;
+	unsigned long ticks;
+	unsigned long presses;
+	unsigned long mismatches;
+	unsigned long skipped; // records after a lost record or in a session that can not be replayed
+	uint32_t first_time;
+	uint32_t last_time;
+	double seconds;
+};
+
+// replays the sessions of one dispatch policy, the others are skipped
+template <class Dispatcher>
+static ReplayResult replay(const std::vector<std::string> &lines, bool verbose)
+{
+	typedef PanelController<BAY_COUNT, Dispatcher> Controller;
+	ReplayResult result = {};
+	std::unique_ptr<Controller> controller;
+	bool broken = true; // nothing can be replayed before the first session
+	bool first = true;
+
+	bench_clock::time_point start = bench_clock::now();
+	for (const std::string &line : lines)
+	{
+		TraceRecord record;
+		if (!parse_trace(line.c_str(), record))
+		{
+			continue;
+		}
+		if (first)
+		{
+			result.first_time = record.time;
+			first = false;
+		}
+		result.last_time = record.time;
+
+		if (record.kind == TRACE_SESSION)
+		{
+			result.sessions++;
+			broken = record.value[1] != BAY_COUNT || record.value[2] != TRACE_VERSION ||
+					 record.value[3] != Dispatcher::POLICY;
+			if (broken && verbose)
+			{
+				printf("session at %lu ms: %lld bays, version %lld, policy %lld, this replayer has %d bays, version "
+					   "%d, policy %d\n",
+					   (unsigned long)record.time, (long long)record.value[1], (long long)record.value[2],
+					   (long long)record.value[3], BAY_COUNT, TRACE_VERSION, int(Dispatcher::POLICY));
+			}
+			controller.reset(new Controller());
+			controller->start(uint32_t(record.value[0]), record.time);
+			continue;
+		}
+		if (record.kind == TRACE_LOST)
+		{
+			if (!broken && verbose)
+			{
+				printf("%lld records lost at %lu ms, skipped to the next session\n", (long long)record.value[0],
+					   (unsigned long)record.time);
+			}
+			broken = true;
+			continue;
+		}
+		if (broken)
+		{
+			result.skipped++;
+			continue;
+		}
+
+		FleetTable<BAY_COUNT> &fleet = controller->fleet;
+		if (record.kind == TRACE_RESTORE)
+		{
+			int bay = int(record.value[0]);
+			fleet.parked.set(bay, record.value[1] != 0);
+			fleet.battery_status[bay] = record.value[2];
+			fleet.timeParked[bay] = int32_t(record.value[3]);
+			fleet.charging.set(bay, (record.value[4] & 1) != 0);
+			fleet.held.set(bay, (record.value[4] & 2) != 0);
+			fleet.forced.set(bay, (record.value[4] & 4) != 0);
+			fleet.parked_ms[bay] = uint16_t(record.value[5]);
+			controller->dispatcher.reset();
+		}
+		else if (record.kind == TRACE_PRESS)
+		{
+			result.presses++;
+			controller->press(int(record.value[0]));
+		}
+		else if (record.kind == TRACE_COMMAND)
+		{
+			controller->command(BayCommand(record.value[0]), int(record.value[1]), record.value[2] != 0);
+		}
+		else if (record.kind == TRACE_TICK)
+		{
+			result.ticks++;
+			TickReport<BAY_COUNT> report;
+			controller->tick(int(record.value[0]), record.time, report);
+			TraceRecord replayed = trace_tick(report, fleet);
+
+			for (int i = 1; i < TRACE_VALUES; i++)
+			{
+				if (replayed.value[i] == record.value[i])
+				{
+					continue;
+				}
+				if (verbose && result.mismatches < PRINT_MISMATCHES)
+				{
+					printf("tick at %lu ms: %s is %lld in the trace, %lld replayed\n", (unsigned long)record.time,
+						   OUTPUT_NAMES[i], (long long)record.value[i], (long long)replayed.value[i]);
+				}
+				result.mismatches++;
+				break;
+			}
+		}
+	}
+	result.seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+	return result;
+}
+
+// replays with the dispatch policy of the first session
+static ReplayResult replay(const std::vector<std::string> &lines, bool verbose)
+{
+	for (const std::string &line : lines)
+	{
+		TraceRecord record;
+		if (!parse_trace(line.c_str(), record) || record.kind != TRACE_SESSION)
+		{
+			continue;
+		}
+		switch (record.value[3])
+		{
+		case DISPATCH_PROPORTIONAL:
+			return replay<DispatcherFor<BAY_COUNT, DISPATCH_PROPORTIONAL>::type>(lines, verbose);
+		case DISPATCH_LONGEST_PARKED:
+			return replay<DispatcherFor<BAY_COUNT, DISPATCH_LONGEST_PARKED>::type>(lines, verbose);
+		default:
+			break;
+		}
+		break;
+	}
+	return replay<DispatcherFor<BAY_COUNT, DISPATCH_GREEDY>::type>(lines, verbose);
+}
+
+static void print_result(const char *name, const ReplayResult &result)
+{
+	double span = (result.last_time - result.first_time) / 1000.0;
+	printf("%-16s %8lu %10lu %8lu %10lu %8lu %9.3f s %9.0fx\n", name, result.sessions, result.ticks, result.presses,
+		   result.mismatches, result.skipped, result.seconds, result.seconds > 0 ? span / result.seconds : 0);
+}
+
+static void print_header()
+{
+	printf("%-16s %8s %10s %8s %10s %8s %11s %10s\n", "trace", "sessions", "ticks", "presses", "mismatches",
+		   "skipped", "replay", "real time");
+}
+
+static void write_line(std::vector<std::string> &lines, const TraceRecord &record)
+{
+	char line[TRACE_LINE_SIZE];
+	format_trace(record, line, sizeof(line));
+	lines.push_back(line);
+}
+
+/*
+a day of the panel at TICK_MS: the potentiometer drifts around, a car
+arrives or leaves about every 20 minutes, a bay command comes about every
+hour, and the panel sleeps and wakes once half way, with the fleet kept in
+RTC memory. the other output of the panel is mixed in like on the serial
+port
+*/
+template <class Dispatcher>
+static std::vector<std::string> record_day(std::mt19937 &rng, unsigned long &ticks)
+{
+	typedef PanelController<BAY_COUNT, Dispatcher> Controller;
+	std::vector<std::string> lines;
+	std::uniform_int_distribution<int> step(-100, 100);
+	std::uniform_int_distribution<int> bay(0, BAY_COUNT - 1);
+	std::uniform_int_distribution<int> press(0, 11999);
+	std::uniform_int_distribution<int> command(0, 35999);
+	std::uniform_int_distribution<unsigned long> late(0, TICK_LATE);
+
+	std::unique_ptr<Controller> controller(new Controller());
+	uint32_t seed = uint32_t(rng());
+	controller->start(seed, 0);
+	lines.push_back("Wifi connected");
+	write_line(lines, trace_session(0, seed, BAY_COUNT, Dispatcher::POLICY));
+
+	int grid = 7500;
+	bool woke = false;
+	unsigned long now = 0;
+	for (ticks = 0; now < DAY_MS; ticks++)
+	{
+		now += TICK_MS + late(rng);
+
+		if (!woke && now >= DAY_MS / 2)
+		{
+			woke = true;
+			// a new boot after deep sleep: a new seed and the fleet from RTC memory
+			std::unique_ptr<Controller> woken(new Controller());
+			woken->fleet = controller->fleet;
+			woken->dispatcher.reset();
+			controller.swap(woken);
+			seed = uint32_t(rng());
+			controller->start(seed, now);
+			lines.push_back("Fleet restored from RTC memory");
+			write_line(lines, trace_session(now, seed, BAY_COUNT, Dispatcher::POLICY));
+			for (int i = 0; i < BAY_COUNT; i++)
+			{
+				write_line(lines, trace_restore(now, controller->fleet, i));
+			}
+		}
+
+		if (press(rng) == 0)
+		{
+			int pressed = bay(rng);
+			controller->press(pressed);
+			write_line(lines, trace_press(now, pressed));
+		}
+		if (command(rng) == 0)
+		{
+			BayCommand type = rng() % 2 ? BAY_FORCE_CHARGE : BAY_STOP_DISCHARGE;
+			int target = bay(rng);
+			bool on = rng() % 2;
+			controller->command(type, target, on);
+			write_line(lines, trace_command(now, type, target, on));
+		}
+
+		grid = std::min(15000, std::max(0, grid + step(rng)));
+		TickReport<BAY_COUNT> report;
+		controller->tick(grid, now, report);
+		write_line(lines, trace_tick(report, controller->fleet));
+
+		if (ticks % 36000 == 0)
+		{
+			lines.push_back("control: tick 0.01 ms (max 0.02 ms), potentiometer 8000 samples, buttons 0 waits");
+		}
+	}
+	return lines;
+}
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+static int replay_file(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		perror(path);
+		return 1;
+	}
+	std::vector<std::string> lines;
+	char line[1024];
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		lines.push_back(line);
+	}
+	fclose(file);
+
+	ReplayResult result = replay(lines, true);
+	print_header();
+	print_result(path, result);
+	return result.mismatches == 0 && result.ticks > 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+	{
+		return replay_file(argv[1]);
+	}
+
+	std::mt19937 rng(42);
+	unsigned long ticks;
+	std::vector<std::string> day = record_day<BatteryDispatcher<BAY_COUNT>>(rng, ticks);
+
+	print_header();
+	ReplayResult clean = replay(day, false);
+	print_result("day", clean);
+	expect(clean.ticks == ticks, "every tick of the day is replayed");
+	expect(clean.sessions == 2, "the wake starts a second session");
+	expect(clean.mismatches == 0, "the day replays without a mismatch");
+
+	// one tick with a changed output, the replay must find that tick and only that one
+	std::vector<std::string> changed = day;
+	for (size_t i = changed.size() / 3; i < changed.size(); i++)
+	{
+		TraceRecord record;
+		if (parse_trace(changed[i].c_str(), record) && record.kind == TRACE_TICK)
+		{
+			record.value[2] += 1;
+			char line[TRACE_LINE_SIZE];
+			format_trace(record, line, sizeof(line));
+			changed[i] = line;
+			break;
+		}
+	}
+	ReplayResult corrupted = replay(changed, false);
+	print_result("changed output", corrupted);
+	expect(corrupted.mismatches == 1, "a changed tick output gives one mismatch");
+
+	// a press that is not in the trace, every tick after it can be different
+	std::vector<std::string> dropped = day;
+	for (size_t i = dropped.size() / 4; i < dropped.size(); i++)
+	{
+		TraceRecord record;
+		if (parse_trace(dropped[i].c_str(), record) && record.kind == TRACE_PRESS)
+		{
+			dropped.erase(dropped.begin() + i);
+			break;
+		}
+	}
+	ReplayResult missing = replay(dropped, false);
+	print_result("dropped press", missing);
+	expect(missing.mismatches > 0, "a dropped press makes the replay differ");
+
+	// a lost record, the rest of the first session is skipped
+	std::vector<std::string> lost = day;
+	lost.insert(lost.begin() + lost.size() / 4, "T L 1 3");
+	ReplayResult holes = replay(lost, false);
+	print_result("lost records", holes);
+	expect(holes.mismatches == 0 && holes.skipped > 0, "a lost record skips to the next session");
+
+	// the other policies replay the same way
+	unsigned long proportional_ticks;
+	std::vector<std::string> proportional =
+		record_day<DispatcherFor<BAY_COUNT, DISPATCH_PROPORTIONAL>::type>(rng, proportional_ticks);
+	ReplayResult shared = replay(proportional, false);
+	print_result("proportional", shared);
+	expect(shared.ticks == proportional_ticks && shared.mismatches == 0, "a proportional day replays");
+
+	unsigned long longest_ticks;
+	std::vector<std::string> longest =
+		record_day<DispatcherFor<BAY_COUNT, DISPATCH_LONGEST_PARKED>::type>(rng, longest_ticks);
+	ReplayResult ordered = replay(longest, false);
+	print_result("longest parked", ordered);
+	expect(ordered.ticks == longest_ticks && ordered.mismatches == 0, "a longest parked day replays");
+
+	return failures == 0 ? 0 : 1;
+}
@@ -1,11 +1,38 @@
 #include <Arduino.h>
-#include <ezButton.h>
 #include <adafruit_gfx.h>
 #include <adafruit_ssd1306.h>
 #include <WiFi.h>
 #include <PubSubClient.h>
 #include <Wire.h>
 #include <random>
+#include <gridDispatch.h>
+#include <fleetTable.h>
+#include <batteryDispatcher.h>
+#include <dispatchPolicy.h>
+#include <telemetry.h>
+#include <connection.h>
+#include <spscRing.h>
+#include <buttonBank.h>
+#include <oledFlusher.h>
+#include <adcSampler.h>
+#include <rtcState.h>
+#include <panelController.h>
+#include <traceLog.h>
+#include <commandRouter.h>
+#include <publishRate.h>
+#include <storeForward.h>
+#include <flashLog.h>
+#include <metrics.h>
+#include <profiler.h>
+#include <deviceId.h>
+#include <driver/rtc_io.h>
+#include <esp_timer.h>
+#include <esp_pm.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#include <sys/time.h>
+#include <atomic>
+#include "bays.h"
 
 // _____________________SLEEP MODE_____________________
 #define uS_TO_S_FACTOR 1000000 /* Conversion factor for micro seconds to seconds */
@@ -14,8 +41,26 @@
 // RTC_DATA_ATTR is used to store variables in RTC memory
 RTC_DATA_ATTR int bootCount = 0;
 
+// the access point and the DHCP lease of the last connection
+struct WifiCache
+{
+  uint8_t bssid[6];
+  int32_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
+// kept through deep sleep, so a wake does not start from nothing
+RTC_DATA_ATTR RtcSlot<FleetTable<BAY_COUNT>> rtc_fleet;
+RTC_DATA_ATTR RtcSlot<WifiCache> rtc_wifi;
+
 int last_sleep = 0;
 
+// the bay whose button wakes the panel from deep sleep, -1 if none can
+int wake_bay = -1;
+
 /*
 Method to print the reason by which ESP32
 has been awaken from sleep
@@ -58,28 +103,68 @@ const char *password = "wifi_password";
 const char *mqtt_server = "MQTT_BROKER_IP_ADDRESS";
 const int mqtt_port = 1883;
 
+// every topic of the panel is under MQTT_SITE/<MAC in hex>/, so one broker takes many panels.
+// the topics in the comments are the part after that, e.g. MQTT_SITE/a4cf12b3c4d5/esp32/input
+#define MQTT_SITE "site"
+
+// TELEMETRY_MESSAGES sends every value on its own topic, TELEMETRY_FRAME sends
+// one message per tick on esp32/output/frame (needs the frame fan-out in Node-RED),
+// TELEMETRY_BINARY sends the same frame packed on esp32/output/frame/bin
+#define TELEMETRY_MODE TELEMETRY_MESSAGES
+// only publish what changed (past the deadbands in TELEMETRY_DELTA_DEFAULTS),
+// everything is sent again every 30 s for new subscribers
+#define TELEMETRY_DELTA true
+
+// TRACE_SERIAL prints the inputs and results of every press and tick as "T" lines
+// for replay_trace on the host, TRACE_MQTT publishes them on esp32/output/trace
+// and TRACE_OFF records nothing
+#define TRACE_OUTPUT TRACE_SERIAL
+
+// with -D PROFILER=1 in the build_flags of platformio.ini the PROFILE_ZONE scopes (the
+// dispatch, the display, the parking messages and the button scan) are timed in CPU cycles,
+// and esp32/input/profile serial|mqtt writes them out as a flat profile
+
+// DUAL_CORE 1 runs wifi, mqtt and publishing in a task on NETWORK_CORE, and the
+// buttons, control tick and display in loop() on the other core. 0 runs both in
+// loop() one after the other, to compare the tick jitter and the press latency
+#define DUAL_CORE 1
+#define NETWORK_CORE 0
+
+// POWER_SAVE 1 lets the tasks block between events instead of spinning, so the
+// chip can drop into automatic light sleep with wifi in modem sleep. A press, a
+// command or a due tick is handled at most POWER_WAKE_LATENCY ms late. 0 runs the
+// loop at full speed like before
+#define POWER_SAVE 1
+#define POWER_WAKE_LATENCY 50
+#define POWER_MAX_MHZ 240 // the CPU clock scales between these while the chip is awake
+#define POWER_MIN_MHZ 80
+
+// the control tick, in ms. the batteries and the time parked count the time that went
+// by since the last tick, so the rate does not change the energy totals
+#define CONTROL_TIME 100
+
+// the display and the sleep check, in ms
+#define TICK_TIME 2000
+
+// publishing is between these, in ms: every PUBLISH_MIN_PERIOD while the grid or the bays
+// change, every PUBLISH_MAX_PERIOD while nothing does. esp32/input/telemetry/min and
+// esp32/input/telemetry/max set them while running
+#define PUBLISH_MIN_PERIOD 250
+#define PUBLISH_MAX_PERIOD 10000
+
 // declares name and variables for wifi and mqtt
 WiFiClient espClient;
 PubSubClient client(espClient);
 long lastMsg = 0;
+long last_control = 0;
+bool first_tick = true;
 char msg[50];
 int value = 0;
 
 // BUTTON SETUP
-#define BUTTON_PIN_1 19          // port from button to ESP32
-ezButton button_1(BUTTON_PIN_1); // set up button
-#define DEBOUNCE_TIME 50         // number of milliseconds to debounce
-
-#define BUTTON_PIN_2 5           // port from button to ESP32
-ezButton button_2(BUTTON_PIN_2); // set up button
-
-#define BUTTON_PIN_3 17          // port from button to ESP32
-ezButton button_3(BUTTON_PIN_3); // set up button
-
-// buttonVariables has the 0 element as a fail safe
-bool buttonVariables[4] = {false, false, false, false};
-
-bool buttonVariables_old[4] = {false, false, false, false};
+// one button per bay, the pins are in BAY_LAYOUT (bays.h)
+ButtonBank buttons;      // set up in setup()
+#define DEBOUNCE_TIME 50 // number of milliseconds to debounce
 
 // LED SETUP
 #define LED1_PIN 18         // port from LED1 to ESP32
@@ -87,26 +172,221 @@ const int LED1_CHANNEL = 1; // channel for LED1
 
 // POTENTIOMETER SETUP
 #define POT_PIN 36 // port from potentiometer to ESP32
+#if POWER_SAVE
+#define POT_SAMPLE_US 20000 // 8 samples back to back every 20 ms, the chip sleeps in between
+#define POT_BURST 8
+#else
+#define POT_SAMPLE_US 1000 // the sampler reads the potentiometer every millisecond
+#define POT_BURST 1
+#endif
+// what the ADC reads at the ends of the potentiometer, pot.reading() shows it on a new panel
+const AdcCalibration POT_CALIBRATION = {20, 4075};
+// median, IIR and hysteresis of the readings, and 15000 W at the high end
+const AdcFilterSettings POT_FILTER = {6, 5, 15000};
+AdcSampler pot; // set up in setup()
 
 // OLED SETUP
 #define SCREEN_WIDTH 128 // OLED display width, in pixels
 #define SCREEN_HEIGHT 64 // OLED display height, in pixels
 // Declaration for an SSD1306 display connected to I2C (SDA, SCL pins)
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, -1);
+// sends only what changed on the screen, from a task on DISPLAY_CORE so the loop does not wait for I2C
+OledFlusher oled;
+#define OLED_ADDRESS 0x3C
+#define OLED_I2C_CLOCK 800000 // the SSD1306 is fine above the 400 kHz of the datasheet
+#define DISPLAY_CORE 0
+
+// how the parked cars share the need of the grid: DISPATCH_GREEDY gives from the biggest
+// battery first, DISPATCH_PROPORTIONAL from every car by its energy, DISPATCH_LONGEST_PARKED
+// from the car parked the longest first
+#define DISPATCH_POLICY DISPATCH_GREEDY
 
 // _________________________FUNCTIONS___________________________
 
-// global int, first element is a fail safe
-int timeParked_cars[4] = {0, 0, 0, 0};
+typedef DispatcherFor<BAY_COUNT, DISPATCH_POLICY>::type Dispatcher;
+
+// the grid control, the same code the trace replayer runs on the host
+PanelController<BAY_COUNT, Dispatcher> controller;
+
+// parked, charging, decharging, battery status and time parked for every bay
+FleetTable<BAY_COUNT> &fleet = controller.fleet;
+
+// shares the grid need between the cars, must be updated when a car arrives or leaves
+Dispatcher &dispatcher = controller.dispatcher;
+
+// what the control task hands the network task every tick
+struct TickSnapshot
+{
+  FleetTable<BAY_COUNT> fleet;
+  TickReport<BAY_COUNT> report;
+  bool pressed;             // a button was pressed since the last tick
+  unsigned long pressed_at; // micros() of the first press
+};
+
+// what the network task hands the control task
+enum CommandType
+{
+  COMMAND_LED,            // value is the LED duty, 0-255
+  COMMAND_FORCE_CHARGE,   // value 1 charges the car of "bay" every tick, 0 stops it
+  COMMAND_STOP_DISCHARGE, // value 1 stops the car of "bay" giving power, 0 lets it again
+  COMMAND_RATE_MIN,       // value is the shortest publish period, in ms
+  COMMAND_RATE_MAX,       // value is the longest publish period, in ms
+};
+
+struct Command
+{
+  CommandType type;
+  int bay; // index in BAY_LAYOUT, for the bay commands
+  int value;
+  unsigned long received_at; // micros() when the message came, for command_latency
+};
+
+// control -> network and network -> control, one task pushes and the other pops
+SpscRing<TickSnapshot, 4> snapshots;
+SpscRing<Command, 8> commands;
+
+// trace records from the control task, written out by the network task
+SpscRing<TraceRecord, 32> trace_records;
+unsigned long lost_records = 0; // not in the queue yet, a lost record goes in first
 
-// global int, battery percentage, first element is a fail safe
-int battery_satus[4] = {0, 0, 0, 0};
+void trace(const TraceRecord &record)
+{
+#if TRACE_OUTPUT != TRACE_OFF
+  if (lost_records != 0)
+  {
+    if (!trace_records.push(trace_lost(record.time, lost_records)))
+    {
+      lost_records++;
+      return;
+    }
+    lost_records = 0;
+  }
+  if (!trace_records.push(record))
+  {
+    lost_records++;
+  }
+#endif
+}
+unsigned long dropped_snapshots = 0; // the network task was too slow
+
+// counted by the network task, the control task slows the publishing down when they fail
+std::atomic<unsigned long> publishes(0);
+std::atomic<unsigned long> failed_publishes(0);
+
+// the hot paths, in us, summed up on esp32/output/metrics every METRICS_TIME ms
+#define METRICS_TIME 10000
+#define METRICS_SIZE 512 // bytes of the summary
+static const char TOPIC_METRICS[] = TOPIC("metrics");
+LogHistogram loop_us;      // loop(), control task
+LogHistogram display_us;   // drawing the OLED and handing it to the flusher, control task
+LogHistogram publish_us;   // client.publish, network task
+LogHistogram mqtt_loop_us; // client.loop, network task
+unsigned long reconnects = 0;
+
+// when the control task hands over a snapshot, and the last one it did
+const PublishRateSettings PUBLISH_RATE = {PUBLISH_MIN_PERIOD, PUBLISH_MAX_PERIOD};
+PublishRate publish_rate(PUBLISH_RATE);
+TickSnapshot sent_snapshot;
+unsigned long seen_failures = 0;
+
+// runs networkStep() on NETWORK_CORE when DUAL_CORE is 1
+void networkTask(void *parameter);
+
+// the tasks that block between events when POWER_SAVE is 1, NULL if there is none
+TaskHandle_t control_task = NULL;
+TaskHandle_t network_task = NULL;
+
+// ends the wait of a task, so it runs now and not at its next wake
+void wakeTask(TaskHandle_t task)
+{
+  if (task != NULL)
+  {
+    xTaskNotifyGive(task);
+  }
+}
+
+// takes the fleet back after a wake from deep sleep
+void restoreAfterWake();
+
+// names the histograms, counters and gauges of esp32/output/metrics
+void metricsSetup();
 
-// global bool, if true == charging, first element is a fail safe
-bool charging_status[4] = {true, true, true, true};
+// the fleet as of the last snapshot, only used by the network task
+FleetTable<BAY_COUNT> published_fleet;
 
-// global bool, if true == decharging, first element is a fail safe
-bool decharging_status[4] = {true, true, true, true};
+// what could not be published while the broker was gone, sent on its history topics when it is back
+StoreForward<8, TelemetryPublisher<BAY_COUNT>::FRAME_SIZE> store(FLASH_LOG);
+uint8_t history_buffer[TelemetryPublisher<BAY_COUNT>::FRAME_SIZE + HISTORY_PAYLOAD_EXTRA];
+
+// the store is only used by the network task, the control task asks it to save the RAM before a deep sleep
+std::atomic<int> store_in_ram(0);
+std::atomic<bool> store_flush(false);
+
+// ms of the RTC clock, which goes on over a deep sleep, for the times of the kept messages
+uint32_t rtcMillis()
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return uint32_t(uint64_t(now.tv_sec) * 1000 + now.tv_usec / 1000);
+}
+
+// the RTC clock starts again at a power-on or a brownout, the times of the kept messages from before it
+// mean nothing then. set in setup()
+bool rtc_kept = false;
+
+// ms from the first publish of a kept message to now
+uint32_t historyAge(uint32_t sequence, uint32_t time)
+{
+  if (!rtc_kept && !store.from_this_boot(sequence))
+  {
+    return HISTORY_AGE_UNKNOWN;
+  }
+  return rtcMillis() - time;
+}
+
+// the client id and the topics of this panel, from its MAC
+DeviceId device;
+
+// publishes on the topic of this panel
+bool devicePublish(const char *topic, const uint8_t *payload, size_t length)
+{
+  char full[STORE_TOPIC_SIZE + 8 + DEVICE_PREFIX_SIZE];
+  return device.topic(topic, full, sizeof(full)) && client.publish(full, payload, length);
+}
+
+// function to send the data to the server, what can not be sent is kept for later
+bool publish_mqtt(const char *topic, const uint8_t *payload, size_t length)
+{
+  unsigned long start = micros();
+  bool sent = client.connected() && devicePublish(topic, payload, length);
+  publish_us.add(micros() - start);
+  if (sent)
+  {
+    publishes++;
+  }
+  else
+  {
+    failed_publishes++;
+    store.store(rtcMillis(), topic, payload, length);
+  }
+  return sent;
+}
+
+// sends a kept message on its history topic, with its sequence number and time
+bool forward_mqtt(const char *topic, const uint8_t *payload, size_t length, uint32_t sequence, uint32_t time)
+{
+  char history[STORE_TOPIC_SIZE + 8];
+  size_t size = history_payload(payload, length, sequence, time, historyAge(sequence, time), history_buffer,
+                                sizeof(history_buffer));
+  if (size == 0 || !history_topic(topic, history, sizeof(history)))
+  {
+    return true; // it never fits, so it is dropped and not tried again
+  }
+  return devicePublish(history, history_buffer, size);
+}
+
+// writes the payloads into a fixed buffer, so publishing does not use the heap
+TelemetryPublisher<BAY_COUNT> telemetry(BAY_LAYOUT, published_fleet, publish_mqtt);
 
 // maximum W the grid can deliver (excluded batteries, in W)
 #define MAX_GRID 100 * 1000 // 100 kW
@@ -120,75 +400,246 @@ void setupLED(int ledPin, int channelLED)
   ledcWrite(channelLED, 0);
 }
 
-/*
-function to connect to wifi
-time_reconnect works well at 0
-*/
-void setup_wifi(int time_reconnect)
+bool fast_join = false;  // joining the cached access point with the cached address, no scan and no DHCP
+bool wifi_saved = false; // the network of this connection is in rtc_wifi
+
+// starts connecting to wifi, the connection manager waits for it
+void wifi_begin()
 {
-  delay(10);
-  // We start by connecting to a WiFi network
-  Serial.println();
+  WifiCache cache;
+  wifi_saved = false;
+  fast_join = rtc_wifi.load(cache);
+  if (fast_join)
+  {
+    Serial.printf("Connecting to %s on channel %d\n", ssid, int(cache.channel));
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+    WiFi.begin(ssid, password, cache.channel, cache.bssid);
+    return;
+  }
   Serial.print("Connecting to ");
   Serial.println(ssid);
-
+  // back to DHCP, a fast join before may have set the address
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
   WiFi.begin(ssid, password);
+}
 
-  while (WiFi.status() != WL_CONNECTED)
+void wifi_disconnect()
+{
+  // the access point may have moved or the address been given away, the next join scans
+  if (fast_join)
   {
-    long now = millis();
-    // read every 500ms
-    if ((now - lastMsg > 500))
-    {
-      lastMsg = now;
-      Serial.print(".");
-    }
-    if ((now - time_reconnect > 5000))
-    {
-      // restart if not connected after 5s, this is to avoid the ESP32 to get "stuck"
-      Serial.print("Restarting esp32");
-      time_reconnect = now;
-      ESP.restart();
-    }
+    rtc_wifi.clear();
   }
-  Serial.println("");
-  Serial.println("WiFi connected");
-  Serial.println("IP address: ");
-  Serial.println(WiFi.localIP());
+  WiFi.disconnect();
 }
 
-// function to sett callback for mqtt, this subscribes to the topic
-void callback(char *topic, byte *message, unsigned int length)
+bool wifi_connected()
 {
-  // print the topic and the message
-  Serial.print("Message arrived on topic: ");
-  Serial.print(topic);
-  Serial.print(". Message: ");
-  String dataMessage;
+  bool connected = WiFi.status() == WL_CONNECTED;
+  if (connected && !wifi_saved)
+  {
+    WifiCache cache;
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.ip = uint32_t(WiFi.localIP());
+    cache.gateway = uint32_t(WiFi.gatewayIP());
+    cache.subnet = uint32_t(WiFi.subnetMask());
+    cache.dns = uint32_t(WiFi.dnsIP());
+    rtc_wifi.save(cache);
+    wifi_saved = true;
+  }
+  return connected;
+}
 
-  // makes a variable "dataMessage" and adds char together
-  for (int i = 0; i < length; i++)
+// one attempt to connect to mqtt, subscribes if it works
+bool mqtt_connect()
+{
+  Serial.print("Attempting MQTT connection...");
+  // no will, and cleanSession false so the subscription lives on the broker between connections
+  // the id is the same on every connect, so the broker keeps the session of the panel while it sleeps
+  if (!client.connect(device.get_client_id(), NULL, NULL, NULL, 0, false, NULL, false))
+  {
+    Serial.print("failed, rc=");
+    Serial.println(client.state());
+    return false;
+  }
+  Serial.println("connected");
+  // QoS 1, so the broker keeps commands sent while the panel sleeps. subscribing
+  // again does not wait for the broker, and covers a broker that lost the session
+  char subscription[sizeof(INPUT_SUBSCRIPTION) + DEVICE_PREFIX_SIZE];
+  if (device.topic(INPUT_SUBSCRIPTION, subscription, sizeof(subscription)))
   {
-    Serial.print((char)message[i]);
-    dataMessage += (char)message[i];
+    client.subscribe(subscription, 1);
   }
-  Serial.println();
+  return true;
+}
 
-  // if the message is on, turn on the LED, this just shows that two-way communication works
-  if (String(topic) == "esp32/input")
+bool mqtt_connected()
+{
+  return client.connected();
+}
+
+// keeps wifi and mqtt connected from loop() without blocking it
+const LinkDriver link_driver = {wifi_begin, wifi_disconnect, wifi_connected, mqtt_connect, mqtt_connected};
+ConnectionManager link(link_driver);
+LinkState link_state = LINK_WIFI_JOINING;
+
+// loop times, tick jitter and press to publish latency, printed every LOOP_REPORT_TIME ms
+LoopTimer loop_timer;
+LoopTimer network_timer;
+LoopTimer tick_jitter;
+LoopTimer press_latency;
+LoopTimer route_time;      // mqtt callback, network task
+LoopTimer command_latency; // message to the command being done, control task
+#define LOOP_REPORT_TIME 10000
+unsigned long last_loop_report = 0;
+unsigned long last_network_report = 0;
+unsigned long last_tick_us = 0;
+
+// the first button press since the last tick, for press_latency
+bool pressed = false;
+unsigned long pressed_at = 0;
+
+unsigned long dropped_commands = 0;
+
+// hands a command to the control task, it owns the LED and the fleet
+void pushCommand(CommandType type, int bay, int value)
+{
+  Command command = {type, bay, value, micros()};
+  if (!commands.push(command))
   {
-    Serial.print("Changing output to ");
-    if (dataMessage == "on")
-    {
-      Serial.println("on");
-      ledcWrite(1, 255);
-    }
-    else if (dataMessage == "off")
+    dropped_commands++;
+  }
+  wakeTask(control_task);
+}
+
+// the bay with the number in the topic, -1 if there is none
+int bayFromTopic(const TextView &number)
+{
+  for (int i = 0; i < BAY_COUNT; i++)
+  {
+    if (number.equals(BAY_LAYOUT[i].number))
     {
-      Serial.println("off");
-      ledcWrite(1, 0);
+      return i;
     }
   }
+  return -1;
+}
+
+// "on" or "off", anything else is left alone
+bool onOff(const TextView &payload, int &value)
+{
+  if (payload.equals("on"))
+  {
+    value = 1;
+    return true;
+  }
+  if (payload.equals("off"))
+  {
+    value = 0;
+    return true;
+  }
+  return false;
+}
+
+// esp32/input on|off, this just shows that two-way communication works
+void ledCommand(const RouteMatch &match, const TextView &payload)
+{
+  int on;
+  if (onOff(payload, on))
+  {
+    pushCommand(COMMAND_LED, -1, on ? 255 : 0);
+  }
+}
+
+// esp32/input/bay/<number>/charge on|off, on charges the car even when the grid needs power
+void chargeCommand(const RouteMatch &match, const TextView &payload)
+{
+  int bay = bayFromTopic(match.capture[0]);
+  int on;
+  if (bay >= 0 && onOff(payload, on))
+  {
+    pushCommand(COMMAND_FORCE_CHARGE, bay, on);
+  }
+}
+
+// esp32/input/bay/<number>/discharge on|off, off stops the car giving power to the grid
+void dischargeCommand(const RouteMatch &match, const TextView &payload)
+{
+  int bay = bayFromTopic(match.capture[0]);
+  int on;
+  if (bay >= 0 && onOff(payload, on))
+  {
+    pushCommand(COMMAND_STOP_DISCHARGE, bay, !on);
+  }
+}
+
+// esp32/input/telemetry/min|max <ms>, the shortest and the longest publish period
+void rateCommand(const RouteMatch &match, const TextView &payload)
+{
+  long period;
+  if (!payload.to_long(period) || period < 0)
+  {
+    return;
+  }
+  if (match.capture[0].equals("min"))
+  {
+    pushCommand(COMMAND_RATE_MIN, -1, int(period));
+  }
+  else if (match.capture[0].equals("max"))
+  {
+    pushCommand(COMMAND_RATE_MAX, -1, int(period));
+  }
+}
+
+#if PROFILER
+// where the next profile goes, set by profileCommand and done by the network task
+enum ProfileOutput
+{
+  PROFILE_NONE,
+  PROFILE_SERIAL,
+  PROFILE_MQTT,
+};
+std::atomic<int> profile_output(PROFILE_NONE);
+static const char TOPIC_PROFILE[] = TOPIC("profile");
+
+// esp32/input/profile serial|mqtt, writes the profile once
+void profileCommand(const RouteMatch &match, const TextView &payload)
+{
+  if (payload.equals("serial"))
+  {
+    profile_output = PROFILE_SERIAL;
+  }
+  else if (payload.equals("mqtt"))
+  {
+    profile_output = PROFILE_MQTT;
+  }
+}
+#endif
+
+const CommandRoute COMMAND_ROUTES[] = {
+    {INPUT_PREFIX, ledCommand},
+    {INPUT_TOPIC("bay/+/charge"), chargeCommand},
+    {INPUT_TOPIC("bay/+/discharge"), dischargeCommand},
+    {INPUT_TOPIC("telemetry/+"), rateCommand},
+#if PROFILER
+    {INPUT_TOPIC("profile"), profileCommand},
+#endif
+};
+
+CommandRouter router(COMMAND_ROUTES, sizeof(COMMAND_ROUTES) / sizeof(COMMAND_ROUTES[0]));
+
+// function to sett callback for mqtt, the topic and the payload are used where PubSubClient has them
+void callback(char *topic, byte *message, unsigned int length)
+{
+  route_time.start(micros());
+  // the subscription only takes the topics of this panel, the routes are without the device
+  const char *local = device.local(topic);
+  if (local != NULL)
+  {
+    router.route(local, message, length);
+  }
+  route_time.stop(micros());
 }
 
 void esp32_sleep_setup()
@@ -207,396 +658,637 @@ void esp32_sleep_setup()
   esp_sleep_enable_timer_wakeup(TIME_TO_SLEEP * uS_TO_S_FACTOR);
   Serial.println("Setup ESP32 to sleep for every " + String(TIME_TO_SLEEP) +
                  " Seconds");
+
+  // a bay button can only wake the panel from deep sleep if it is on an RTC pin
+  for (int i = 0; i < BAY_COUNT && wake_bay < 0; i++)
+  {
+    if (rtc_gpio_is_valid_gpio(gpio_num_t(BAY_LAYOUT[i].pin)))
+    {
+      wake_bay = i;
+    }
+  }
+  if (wake_bay < 0)
+  {
+    Serial.println("No bay button is on an RTC pin, only the timer wakes the panel");
+  }
+}
+
+// what has to be done right before esp_deep_sleep_start()
+void esp32_sleep_prepare()
+{
+  rtc_fleet.save(fleet);
+  if (wake_bay >= 0)
+  {
+    gpio_num_t pin = gpio_num_t(BAY_LAYOUT[wake_bay].pin);
+    // ext0 keeps the RTC pins powered, so the pull-up holds the pin high while the panel sleeps
+    rtc_gpio_pullup_en(pin);
+    rtc_gpio_pulldown_dis(pin);
+    esp_sleep_enable_ext0_wakeup(pin, 0);
+  }
+}
+
+#if POWER_SAVE
+// the LEDC clock stops in light sleep, so a lit LED keeps the chip awake
+esp_pm_lock_handle_t led_lock = NULL;
+bool led_locked = false;
+
+void powerSetup()
+{
+  // modem sleep: the radio only wakes for the beacons, the access point holds packets meanwhile
+  WiFi.setSleep(true);
+  buttons.enable_wakeup();
+
+  esp_pm_config_esp32_t pm;
+  pm.max_freq_mhz = POWER_MAX_MHZ;
+  pm.min_freq_mhz = POWER_MIN_MHZ;
+  pm.light_sleep_enable = true;
+  esp_err_t err = esp_pm_configure(&pm);
+  if (err != ESP_OK)
+  {
+    // the SDK needs CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE for it
+    Serial.printf("No automatic light sleep (%s), the tasks still block between events\n", esp_err_to_name(err));
+    return;
+  }
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "led", &led_lock);
+}
+
+void ledAwake(bool lit)
+{
+  if (led_lock == NULL || lit == led_locked)
+  {
+    return;
+  }
+  led_locked = lit;
+  if (lit)
+  {
+    esp_pm_lock_acquire(led_lock);
+  }
+  else
+  {
+    esp_pm_lock_release(led_lock);
+  }
 }
+#endif
 
 void setup()
 {
   Serial.begin(9600);
-  button_1.setDebounceTime(DEBOUNCE_TIME); // set debounce time
-  button_2.setDebounceTime(DEBOUNCE_TIME); // set debounce time
-  button_3.setDebounceTime(DEBOUNCE_TIME); // set debounce time
-  setupLED(LED1_PIN, LED1_CHANNEL);        // set up LED1
-
-  if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C))
+  // the seed is in the trace, so the batteries of arriving cars can be replayed
+  uint32_t seed = esp_random();
+  unsigned long start = millis();
+  controller.start(seed, start);
+  trace(trace_session(start, seed, BAY_COUNT, DISPATCH_POLICY));
+  buttons.begin(BAY_LAYOUT, BAY_COUNT, DEBOUNCE_TIME);
+  pot.begin(POT_PIN, POT_CALIBRATION, POT_FILTER, POT_SAMPLE_US, POT_BURST);
+  setupLED(LED1_PIN, LED1_CHANNEL); // set up LED1
+
+  if (!display.begin(SSD1306_SWITCHCAPVCC, OLED_ADDRESS))
   { // Address 0x3C for 128x64
     Serial.println(F("SSD1306 allocation failed"));
     for (;;)
       ; // Don't proceed, loop forever
   }
-
-  // starts wifi:
-  setup_wifi(0);
+  oled.begin(Wire, OLED_ADDRESS, OLED_I2C_CLOCK, DISPLAY_CORE);
+
+  // starts wifi, the connection is made in loop()
+  WiFi.mode(WIFI_STA);
+  // the network is kept in rtc_wifi, writing it to flash on every join only slows the join
+  WiFi.persistent(false);
+#if POWER_SAVE
+  powerSetup();
+  control_task = xTaskGetCurrentTaskHandle();
+#endif
   client.setServer(mqtt_server, mqtt_port);
   client.setCallback(callback);
+  // a broker that does not answer holds up the loop for at most this many seconds
+  client.setSocketTimeout(2);
+  if (!device.begin(MQTT_SITE, "testpanel", ESP.getEfuseMac()))
+  {
+    Serial.println("MQTT_SITE is not one level of a topic, nothing is published");
+  }
+  Serial.printf("mqtt: %s on %s\n", device.get_client_id(), device.get_prefix());
+  link.begin(millis(), esp_random());
+  // room for the frame, the history fields of a kept frame, the topic with the device and the MQTT header
+  client.setBufferSize(TelemetryPublisher<BAY_COUNT>::FRAME_SIZE + HISTORY_PAYLOAD_EXTRA + DEVICE_PREFIX_SIZE + 64);
+  // the history that was not sent before a reset or a deep sleep
+  if (!flash_log_begin())
+  {
+    Serial.println("store: no file system, the history is only kept in RAM");
+  }
+  store.begin();
+  esp_reset_reason_t reset = esp_reset_reason();
+  rtc_kept = reset != ESP_RST_POWERON && reset != ESP_RST_BROWNOUT;
+  metricsSetup();
+  telemetry.set_mode(TELEMETRY_MODE);
+  telemetry.set_delta(TELEMETRY_DELTA);
 
   // setup for deep sleep
   esp32_sleep_setup();
-}
+  restoreAfterWake();
 
-// function that runs until mqtt is connected
-void reconnect()
-{
-  // Loop until we're reconnected
-  while (!client.connected())
-  {
-    Serial.print("Attempting MQTT connection...");
-    // Attempt to connect
-    if (client.connect("ESP8266Client"))
-    {
-      Serial.println("connected");
-      // Subscribe
-      client.subscribe("esp32/input");
-    }
-    else
-    {
-      Serial.print("failed, rc=");
-      Serial.print(client.state());
-      Serial.println(" try again in 5 seconds");
-      // Wait 5 seconds before retrying
-      delay(5000);
-    }
-  }
+#if DUAL_CORE
+  xTaskCreatePinnedToCore(networkTask, "network", 8192, NULL, 1, &network_task, NETWORK_CORE);
+#endif
 }
 
-// function to display the potentiometer value on the OLED
-void displayPot(int potValue, int button_1, int timeParked_1, int button_2, int timeParked_2, int button_3, int timeParked_3)
+// function to display the potentiometer value and the first bays on the OLED
+void displayPot(int potValue)
 {
+  PROFILE_ZONE("displayPot");
   display.clearDisplay();
   display.setTextSize(1);
   display.setTextColor(WHITE);
   display.setCursor(0, 0);
   display.print("Potentiometer: ");
   display.println(potValue);
-  display.print("Car 1: ");
-  display.println(button_1);
-  display.print("Time parked:");
-  display.println(timeParked_1);
-  display.print("Car 2: ");
-  display.println(button_2);
-  display.print("Time parked:");
-  display.println(timeParked_2);
-  display.print("Car 3: ");
-  display.println(button_3);
-  display.print("Time parked:");
-  display.println(timeParked_3);
-  display.display();
+  for (int i = 0; i < DISPLAY_BAYS; i++)
+  {
+    display.print("Car ");
+    display.print(BAY_LAYOUT[i].number);
+    display.print(": ");
+    display.println(int(fleet.parked.get(i)));
+    display.print("Time parked:");
+    display.println(fleet.timeParked[i]);
+  }
+  // drawing only touches the buffer, the flusher sends the parts that changed
+  oled.submit(display.getBuffer());
 }
 
-int bool_from_array_to_int(bool boolArray[], int index)
+// a button press toggles if a car is parked in the bay
+void bayPressed(int bay)
 {
-  if (boolArray[index] == true)
+  if (!pressed)
   {
-    return 1;
+    pressed = true;
+    pressed_at = micros();
   }
-  else
+  controller.press(bay);
+  trace(trace_press(millis(), bay));
+}
+
+void buttonState()
+{
+  ButtonEvent event;
+  while (buttons.next(event))
   {
-    return 0;
+    if (event.pressed)
+    {
+      bayPressed(event.bay);
+    }
   }
 }
 
-// function to increase the time parked for each car
-void timeParked()
+void restoreAfterWake()
 {
-  // if the button is pressed, increase the time parked
-  for (int i = 1; i < 4; i++)
+  esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+  if (cause == ESP_SLEEP_WAKEUP_UNDEFINED)
   {
-    if (buttonVariables[i] == true)
+    return; // power-on or reset, nothing was saved for this boot
+  }
+  if (rtc_fleet.load(fleet))
+  {
+    dispatcher.reset();
+    Serial.println("Fleet restored from RTC memory");
+    for (int i = 0; i < BAY_COUNT; i++)
     {
-      timeParked_cars[i] += 1;
+      trace(trace_restore(millis(), fleet, i));
     }
-    else
+  }
+  // the button bank started with the button already down, so the press that woke the panel is counted here
+  if (cause == ESP_SLEEP_WAKEUP_EXT0 && wake_bay >= 0)
+  {
+    bayPressed(wake_bay);
+  }
+}
+
+// prints the link state when it changes and the publish latency every LOOP_REPORT_TIME ms
+void networkReport(unsigned long now)
+{
+  if (link.get_state() != link_state)
+  {
+    link_state = link.get_state();
+    Serial.print("link: ");
+    Serial.println(link_state_name(link_state));
+    if (link_state == LINK_CONNECTED)
     {
-      timeParked_cars[i] = 0;
+      reconnects++;
+      Serial.print("IP address: ");
+      Serial.println(WiFi.localIP());
     }
   }
+  if (now - last_network_report >= LOOP_REPORT_TIME)
+  {
+    // the share of the time the network task was running, not counting the wifi driver
+    float awake = 100.0f * network_timer.sum() / ((now - last_network_report) * 1000.0f);
+    last_network_report = now;
+    Serial.printf("network: press to publish longest %lu us, mean %lu us, %lu dropped ticks, link %s, awake %.2f%%\n",
+                  press_latency.longest(), press_latency.mean(), dropped_snapshots, link_state_name(link_state),
+                  awake);
+    Serial.printf("commands: %lu routed, %lu unmatched, %lu dropped, callback longest %lu us, mean %lu us\n",
+                  router.get_routed(), router.get_unmatched(), dropped_commands, route_time.longest(),
+                  route_time.mean());
+    Serial.printf("store: %lu kept, %lu sent, %lu dropped, %lu too big, %d in RAM, %d segments\n",
+                  store.get_stored(), store.get_forwarded(), store.get_dropped(), store.get_too_big(),
+                  store.in_ram(), store.segments_used());
+    press_latency.reset();
+    route_time.reset();
+    network_timer.reset();
+  }
 }
 
-int parking_status_array(bool varArray[], int size)
+// prints the loop times, the tick jitter and the display flushes every LOOP_REPORT_TIME ms
+void controlReport(unsigned long now)
 {
-  int sum = 0;
-  for (int i = 1; i < size; i++)
+  if (now - last_loop_report >= LOOP_REPORT_TIME)
   {
-    sum += bool_from_array_to_int(varArray, i);
+    // the share of the time loop() was running, the rest it was blocked or the chip asleep
+    float awake = 100.0f * loop_timer.sum() / ((now - last_loop_report) * 1000.0f);
+    last_loop_report = now;
+    Serial.printf("control: loop longest %lu us, mean %lu us, tick jitter longest %lu us, mean %lu us, %lu loops, "
+                  "awake %.2f%%\n",
+                  loop_timer.longest(), loop_timer.mean(), tick_jitter.longest(), tick_jitter.mean(),
+                  loop_timer.loops(), awake);
+    Serial.printf("commands: message to done longest %lu us, mean %lu us, %lu done\n", command_latency.longest(),
+                  command_latency.mean(), command_latency.loops());
+    command_latency.reset();
+    Serial.printf("publish: period %lu ms, floor %lu ms, limits %lu-%lu ms, %lu sent, %lu failed\n",
+                  publish_rate.get_period(), publish_rate.get_floor(), publish_rate.get_limits().min_period,
+                  publish_rate.get_limits().max_period, publishes.load(), failed_publishes.load());
+    Serial.printf("display: %lu flushes, %lu unchanged, %lu dropped, %lu bytes, last flush %lu us\n",
+                  oled.get_flushes(), oled.get_unchanged(), oled.get_dropped(), oled.get_bytes(), oled.get_last_us());
+#if POWER_SAVE && defined(CONFIG_PM_PROFILING)
+    // the time the chip spent in each power mode, with light sleep
+    esp_pm_dump_locks(stdout);
+#endif
+    loop_timer.reset();
+    tick_jitter.reset();
   }
-  return sum;
 }
 
-// function to send the data to the server
-void printMQTT(String topic, String msg, String owner)
+// the newest snapshot from while the link was down, published as soon as it is up
+TickSnapshot waiting_snapshot;
+bool waiting = false;
+
+// esp_timer_get_time() of the first publish since boot, 0 until then
+int64_t first_publish_us = 0;
+
+void publishSnapshot(const TickSnapshot &snapshot)
 {
-  // print the topic and message to the serial monitor
-  String mqtt_msg = "{\"owner\": \"" + owner + "\", \"message\": " + msg + "}";
-  String mqtt_topic = "esp32/output/" + topic;
-  client.publish(mqtt_topic.c_str(), mqtt_msg.c_str());
+  PROFILE_ZONE("telemetry");
+  published_fleet = snapshot.fleet;
+  telemetry.tick(snapshot.report); // send the data to the server
+  if (snapshot.pressed)
+  {
+    press_latency.add(micros() - snapshot.pressed_at);
+  }
+  if (first_publish_us == 0)
+  {
+    // the time from the wake (or power-on) to the first data on the broker, without the bootloader
+    first_publish_us = esp_timer_get_time();
+    Serial.printf("wake: first publish %lu ms after boot %d, %s join\n", (unsigned long)(first_publish_us / 1000),
+                  bootCount, fast_join ? "fast" : "full");
+  }
 }
 
-// function to send the data to the server
-void printMQTT_parking(String topic, String msg, String owner, int timeParked, int battery_status)
+// keeps the newest snapshot, with the first press of the ones it replaces
+void waitSnapshot(const TickSnapshot &snapshot)
 {
-  // print the topic and message to the serial monitor
-  String mqtt_msg = "{\"owner\": \"" + owner + "\", \"amount\": " + msg + ", \"timeParked\": " + String(timeParked) + " , \"battery_status\": " + String(battery_status) + "}";
-  String mqtt_topic = "esp32/output/" + topic;
-  client.publish(mqtt_topic.c_str(), mqtt_msg.c_str());
+  bool was_pressed = waiting && waiting_snapshot.pressed;
+  unsigned long was_pressed_at = waiting_snapshot.pressed_at;
+  waiting_snapshot = snapshot;
+  if (was_pressed)
+  {
+    waiting_snapshot.pressed = true;
+    waiting_snapshot.pressed_at = was_pressed_at;
+  }
+  waiting = true;
 }
 
-int give_random_battery_status()
+// the summary of the hot paths, the counters and the heap
+MetricsReport metrics("testpanel");
+unsigned long last_metrics = 0;
+
+void metricsSetup()
 {
-  int Wh = 3600;
-  int random_number = int(random(20, 80)) * Wh;
-  return random_number;
+  metrics.histogram("loop_us", loop_us);
+  metrics.histogram("display_us", display_us);
+  metrics.histogram("publish_us", publish_us);
+  metrics.histogram("mqtt_loop_us", mqtt_loop_us);
+  metrics.counter("publishes", []() { return uint32_t(publishes.load()); });
+  metrics.counter("publish_failed", []() { return uint32_t(failed_publishes.load()); });
+  metrics.counter("reconnects", []() { return uint32_t(reconnects); });
+  metrics.counter("stored", []() { return uint32_t(store.get_stored()); });
+  metrics.gauge("heap", []() { return uint32_t(heap_caps_get_free_size(MALLOC_CAP_8BIT)); });
+  metrics.gauge("heap_block", []() { return uint32_t(heap_caps_get_largest_free_block(MALLOC_CAP_8BIT)); });
+  metrics.gauge("heap_min", []() { return uint32_t(heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT)); });
+  metrics.gauge("flush_us", []() { return uint32_t(oled.get_last_us()); });
 }
 
-// changes the button value to true or false
-void buttonState()
+void metricsStep(unsigned long now)
 {
-  if (button_1.isPressed())
-  {
-    buttonVariables[1] = !buttonVariables[1]; // toggle buttonVariable
-    battery_satus[1] = give_random_battery_status();
-  }
-  if (button_2.isPressed())
+  if (now - last_metrics < METRICS_TIME)
   {
-    buttonVariables[2] = !buttonVariables[2];
-    battery_satus[2] = give_random_battery_status();
+    return;
   }
-  if (button_3.isPressed())
+  last_metrics = now;
+  char payload[METRICS_SIZE];
+  size_t length = metrics.write(now, payload, sizeof(payload));
+  // a summary is only worth something for its own interval, so it is not kept for later like telemetry
+  if (length > 0 && client.connected())
   {
-    buttonVariables[3] = !buttonVariables[3];
-    battery_satus[3] = give_random_battery_status();
+    devicePublish(TOPIC_METRICS, (const uint8_t *)payload, length);
   }
 }
 
-int battery_grid_need(int actual_grid, int max_grid)
+// writes out the trace records, over mqtt only while it is connected so none are lost
+void traceStep()
 {
-  int battery_grid_need = 0;
-  if ((actual_grid + 100000) > max_grid)
+#if TRACE_OUTPUT == TRACE_MQTT
+  if (!link.connected())
+  {
+    return;
+  }
+#endif
+  TraceRecord record;
+  char line[TRACE_LINE_SIZE + 2];
+  while (trace_records.pop(record))
   {
-    battery_grid_need = actual_grid + 100000 - max_grid;
+    size_t length = format_trace(record, line, TRACE_LINE_SIZE);
+#if TRACE_OUTPUT == TRACE_MQTT
+    devicePublish(TOPIC_TRACE, (const uint8_t *)line, length);
+#else
+    // one write, so the line is not split by the prints of the other task
+    line[length++] = '\r';
+    line[length++] = '\n';
+    Serial.write((const uint8_t *)line, length);
+#endif
   }
-  return battery_grid_need;
 }
 
-/*
-function to find the index of the biggest value in an array and checks
-if that element is avalible
-*/
-int find_max_index(int array_with_elements[], bool array_with_bool[], int size)
+#if PROFILER
+// one line of the profile, a message on esp32/output/profile or a line on the serial port
+void profileLine(int output, char *line, size_t length)
 {
-  int biggest_element = 0;
-  int index_biggest_element = 0;
-  for (int i = 0; i < size; i++)
+  if (output == PROFILE_MQTT)
   {
-    if (array_with_bool[i])
-    {
-      if (array_with_elements[i] > biggest_element)
-      {
-        biggest_element = array_with_elements[i];
-        index_biggest_element = i;
-      }
-    }
+    devicePublish(TOPIC_PROFILE, (const uint8_t *)line, length);
+    return;
   }
-  return index_biggest_element;
+  line[length++] = '\r';
+  line[length++] = '\n';
+  Serial.write((const uint8_t *)line, length);
 }
 
-// updates the global battery status of the cars
-void update_battery_status(int actual_grid_status, int max_grid_status)
+// writes the profile that was asked for, the zones with the most cycles first
+void profileStep()
 {
-  int size = 4; // size of the arrays
-  int Wh = 3600;
-  int power_given_from_battery = 0;
-  int battery_need = actual_grid_status;
-
-  // arrays have 4 elements, but the index 0 is not used
-  int battery_cars[size] = {};
-  bool car_available[size] = {};
-  for (int i = 0; i < size; i++)
+  int output = profile_output.exchange(PROFILE_NONE);
+  if (output == PROFILE_NONE || (output == PROFILE_MQTT && !link.connected()))
   {
-    battery_cars[i] = battery_satus[i];
-    car_available[i] = buttonVariables[i];
-    // set discharge to false, it will change to true if the battery is discharged
-    decharging_status[i] = false;
+    return;
   }
-
-  // check if the avalible cars have over 10% battery left
-  for (int i = 0; i < size; i++)
+  const ProfileZone *zones[PROFILE_MAX_ZONES];
+  int count = profile_sorted(zones, PROFILE_MAX_ZONES);
+  char line[PROFILE_LINE_SIZE + 2];
+  // the lines are "Z <name> <calls> <cycles> <mean> <longest>"
+  int length = snprintf(line, PROFILE_LINE_SIZE, "profile: %d zones (%d not listed), %lu cycles per zone, %lu MHz now",
+                        count, profile_unlisted(), (unsigned long)profile_overhead(),
+                        (unsigned long)getCpuFrequencyMhz());
+  if (length > 0 && size_t(length) < PROFILE_LINE_SIZE)
   {
-    if (car_available[i])
+    profileLine(output, line, size_t(length));
+  }
+  for (int i = 0; i < count; i++)
+  {
+    size_t size = format_profile(*zones[i], line, PROFILE_LINE_SIZE);
+    if (size > 0)
     {
-      if (battery_cars[i] < 10 * Wh)
-      {
-        car_available[i] = false;
-      }
+      profileLine(output, line, size);
     }
   }
+}
+#endif
 
-  // check if the cars have enough battery to give power to the grid
-  int number_of_cars = parking_status_array(car_available, size);
+// wifi, mqtt and publishing the snapshots from the control task
+void networkStep()
+{
+  // one step of connecting, returns at once while wifi or mqtt is down
+  link.poll(millis());
+  unsigned long loop_start = micros();
+  client.loop();
+  mqtt_loop_us.add(micros() - loop_start);
 
-  bool avalible_cars = false;
-  if (number_of_cars > 0)
+  if (waiting && link.connected())
   {
-    avalible_cars = true;
+    waiting = false;
+    publishSnapshot(waiting_snapshot);
   }
-
-  while (battery_need > 0 && number_of_cars > 0 && avalible_cars)
+  TickSnapshot snapshot;
+  while (snapshots.pop(snapshot))
   {
-    // find the biggest battery
-    int biggest_battery_index = find_max_index(battery_cars, car_available, size);
-
-    if (biggest_battery_index == 0)
+    if (link.connected())
     {
-      // this eliminates battery1 beeing used even tough its not avalible
-      avalible_cars = false;
+      publishSnapshot(snapshot);
     }
-    // the biggest battery has index "biggest_battery_index"
-    // check if battery_need is smaller than what the battery can give (5000 stands for 5kW)
-    if (battery_need < 5000)
-    {
-      battery_cars[biggest_battery_index] -= battery_need;
-      power_given_from_battery += battery_need;
-      battery_need = 0;
-    }
-    if (battery_need >= 5000)
+    else
     {
-      battery_cars[biggest_battery_index] -= 5000;
-      power_given_from_battery += 5000;
-      battery_need -= 5000;
+      // the messages go to the store, and the newest is published live when the link is back
+      published_fleet = snapshot.fleet;
+      telemetry.tick(snapshot.report);
+      waitSnapshot(snapshot);
     }
-
-    decharging_status[biggest_battery_index] = true; // set the decharging status to true
-    charging_status[biggest_battery_index] = false;  // set the charging status to false
-
-    // the biggest battery has now been used, and we need to set it to unavalible
-    car_available[biggest_battery_index] = false;
-    number_of_cars--; // one car has been used
   }
-  // send mqtt message to update battery status
-  printMQTT("powergrid/need", String(battery_need), "grid");
-  printMQTT("powergrid/batteryPark", String(power_given_from_battery), "grid");
-
-  // update discharge status
-  for (int i = 1; i < size; i++)
+  // the history goes out a batch at a time, and only when there is nothing live to send
+  if (link.connected() && snapshots.empty())
   {
-    if (decharging_status[i] == true)
-    {
-      printMQTT("powergrid/decharging", String(i), "discharge");
-    }
-    if (decharging_status[i] == false)
-    {
-      printMQTT("powergrid/decharging", String(i), "standby");
-    }
+    store.drain(millis(), forward_mqtt);
   }
-
-  // update the battery variables
-  for (int i = 0; i < 4; i++)
+  if (store_flush)
   {
-    battery_satus[i] = battery_cars[i];
+    store.flush();
+    store_flush = false;
   }
+  store_in_ram = store.in_ram();
+  traceStep();
+#if PROFILER
+  profileStep();
+#endif
+  metricsStep(millis());
+  networkReport(millis());
 }
 
-// function to update the charging status of the cars
-void update_battery_charging(int grid, int size)
+void networkTask(void *parameter)
 {
-  int Wh = 3600;
-  // if there is power to charge batteries
-  if (grid == 0)
+  for (;;)
   {
-    for (int i = 1; i < size; i++)
-    {
-      // check if the car is parked
-      if (buttonVariables[i] == true)
-      {
-        // check if the battery is not full
-        if (battery_satus[i] < 100 * Wh)
-        {
-          // start charging
-          charging_status[i] = true;
-          battery_satus[i] += 5000;
-          printMQTT("powergrid/charging", String(i), "charge");
-        }
-      }
-      if (buttonVariables[i] == false)
-      {
-        // stop charging
-        charging_status[i] = false;
-        printMQTT("powergrid/charging", String(i), "standby");
-      }
-    }
+    network_timer.start(micros());
+    networkStep();
+    network_timer.stop(micros());
+#if POWER_SAVE
+    // until the control task hands over a snapshot, mqtt is served at least every POWER_WAKE_LATENCY ms
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(POWER_WAKE_LATENCY));
+#else
+    // lets the idle task on this core run, so its watchdog is fed
+    vTaskDelay(1);
+#endif
   }
 }
 
-// function to check if array contains a true value
-bool array_contains_true(bool array[], int size)
+// buttons, potentiometer, the control tick and the display
+void controlStep()
 {
-  for (int i = 0; i < size; i++)
+  Command command;
+  while (commands.pop(command))
   {
-    if (array[i])
+    if (command.type == COMMAND_LED)
     {
-      return true;
+      ledcWrite(LED1_CHANNEL, command.value);
+#if POWER_SAVE
+      ledAwake(command.value > 0);
+#endif
     }
+    else if (command.type == COMMAND_RATE_MIN || command.type == COMMAND_RATE_MAX)
+    {
+      PublishRateSettings limits = publish_rate.get_limits();
+      (command.type == COMMAND_RATE_MIN ? limits.min_period : limits.max_period) = (unsigned long)command.value;
+      publish_rate.set_limits(limits.min_period, limits.max_period);
+    }
+    else
+    {
+      BayCommand bay_command = command.type == COMMAND_FORCE_CHARGE ? BAY_FORCE_CHARGE : BAY_STOP_DISCHARGE;
+      controller.command(bay_command, command.bay, command.value != 0);
+      trace(trace_command(millis(), bay_command, command.bay, command.value != 0));
+    }
+    command_latency.add(micros() - command.received_at);
   }
-  return false;
-}
-
-void loop()
-{
-  // if mqtt is not connected, reconnect
-  if (!client.connected())
-  {
-    Serial.print("disconnect mqtt");
-    reconnect();
-  }
-  client.loop();
 
-  button_1.loop(); // run the button loop
-  button_2.loop(); // run the button loop
-  button_3.loop(); // run the button loop
+  buttons.poll(millis()); // samples the buttons if one of them moved
 
-  int potValue = analogRead(POT_PIN);                     // read the potentiometer value
-  int potValueMapped = map(potValue, 0, 4095, 0, 15000);  // map the potentiometer value to 0-115 (115kW)
-  int potValueMappedLed = map(potValue, 0, 4095, 0, 100); // map the potentiometer value to 0-100 (100%)
+  int potValueMapped = int(pot.value()); // the filtered potentiometer value, 0-15000 W
 
   buttonState(); // run the buttonState function
 
   long now = millis();
-  // leser av hvert sekund
-  if ((now - lastMsg > 2000))
+  // the first tick comes at once so a wake has something to publish
+  if (!first_tick && now - last_control < CONTROL_TIME)
   {
-    lastMsg = now;
+    return;
+  }
+  last_control = now;
+  unsigned long tick_us = micros();
+  if (last_tick_us != 0)
+  {
+    unsigned long interval = tick_us - last_tick_us;
+    const unsigned long tick_us_time = CONTROL_TIME * 1000UL;
+    tick_jitter.add(interval > tick_us_time ? interval - tick_us_time : tick_us_time - interval);
+  }
+  last_tick_us = tick_us;
 
-    timeParked();                                    // run the timeParked function to update the time parked for each car
-    update_battery_status(potValueMapped, MAX_GRID); // update the battery status
-    update_battery_charging(potValueMapped, 4);      // update the charging status
+  TickSnapshot snapshot;
+  TickReport<BAY_COUNT> &report = snapshot.report;
+  controller.tick(potValueMapped, now, report); // time parked, battery status and charging
+  trace(trace_tick(report, fleet));
 
-    // map the battery status back to 0-100 by dividing by Wh (3600)
-    int mapped_battery_status[4] = {};
-    for (int i = 0; i < 4; i++)
+  // published sooner while the grid or the bays change, and later while nothing does
+  float change =
+      telemetry_change(report, fleet, sent_snapshot.report, sent_snapshot.fleet, telemetry.get_deadband());
+  if (first_tick || publish_rate.due(now, change))
+  {
+    // publishes that failed, or a snapshot still waiting for the network task, hold the rate back
+    unsigned long failures = failed_publishes.load();
+    if (failures != seen_failures || snapshots.size() > 1)
+    {
+      publish_rate.congested();
+    }
+    else
     {
-      mapped_battery_status[i] = battery_satus[i] / (3600);
+      publish_rate.delivered();
     }
+    seen_failures = failures;
+    publish_rate.published(now, change >= 1);
+
+    // the network task publishes it, a full ring means it is behind and the tick is dropped
+    snapshot.fleet = fleet;
+    snapshot.pressed = pressed;
+    snapshot.pressed_at = pressed_at;
+    pressed = false;
+    if (!snapshots.push(snapshot))
+    {
+      dropped_snapshots++;
+    }
+    sent_snapshot = snapshot;
+    wakeTask(network_task);
+  }
 
-    printMQTT("battery", String(potValueMapped), "pot_meter");                                                                                    // send the battery value to the server
-    printMQTT_parking("parking_1", String(bool_from_array_to_int(buttonVariables, 1)), "button_1", timeParked_cars[1], mapped_battery_status[1]); // send the car 1 value to the server
-    printMQTT_parking("parking_2", String(bool_from_array_to_int(buttonVariables, 2)), "button_2", timeParked_cars[2], mapped_battery_status[2]); // send the car 2 value to the server
-    printMQTT_parking("parking_3", String(bool_from_array_to_int(buttonVariables, 3)), "button_3", timeParked_cars[3], mapped_battery_status[3]); // send the car 3 value to the server
-    printMQTT("parking_status", String(parking_status_array(buttonVariables, 4)), "parking_status");                                              // send the parking status to the server
+  // leser av hvert sekund
+  if (first_tick || (now - lastMsg >= TICK_TIME))
+  {
+    first_tick = false;
+    lastMsg = now;
 
-    displayPot(potValueMapped, bool_from_array_to_int(buttonVariables, 1), timeParked_cars[1], bool_from_array_to_int(buttonVariables, 2), timeParked_cars[2],
-               bool_from_array_to_int(buttonVariables, 3), timeParked_cars[3]); // display the potentiometer value on the OLED
+    unsigned long display_start = micros();
+    displayPot(potValueMapped); // display the potentiometer value on the OLED
+    display_us.add(micros() - display_start);
 
     // esp32 deep sleep conditions
     int sleep_time = 1000;        // time in ms
     sleep_time = sleep_time * 15; // time in s
 
     // wait for sleep time and that the potentiometer is at 0, and no car is parked
-    if (now - last_sleep > sleep_time && potValueMapped == 0 && parking_status_array(buttonVariables, 4) == 0)
+    bool idle = now - last_sleep > sleep_time && potValueMapped == 0 && !fleet.parked.any();
+    if (idle && store_in_ram > 0)
+    {
+      // the history in RAM is written to flash first, a deep sleep would lose it
+      store_flush = true;
+      wakeTask(network_task);
+    }
+    else if (idle)
     {
       last_sleep = now;
       // Now we enter the deep sleep mode.
       Serial.println("Going to sleep now");
       Serial.flush();
+      esp32_sleep_prepare();
       esp_deep_sleep_start();
       Serial.println("This will never be printed");
     }
   }
 }
+
+#if POWER_SAVE
+// ms until loop() has something to do: the next tick, or the next sample of a moving button
+unsigned long controlWait(unsigned long now)
+{
+  unsigned long wait = POWER_WAKE_LATENCY;
+  if (buttons.busy() && buttons.get_interval() < wait)
+  {
+    wait = buttons.get_interval();
+  }
+  // the publishing runs in a control tick, so that is the next thing due
+  unsigned long since = now - (unsigned long)last_control;
+  unsigned long to_tick = since >= CONTROL_TIME ? 0 : CONTROL_TIME - since;
+  return to_tick < wait ? to_tick : wait;
+}
+#endif
+
+void loop()
+{
+  unsigned long loop_start = micros();
+  loop_timer.start(loop_start);
+#if !DUAL_CORE
+  // the network runs between the control steps, like before the split
+  networkStep();
+#endif
+  controlStep();
+  unsigned long loop_end = micros();
+  loop_timer.stop(loop_end);
+  loop_us.add(loop_end - loop_start);
+
+  // after the timer, so the report is not counted in the loop times
+  controlReport(millis());
+
+#if POWER_SAVE
+  // blocked until then or a command comes, the idle task lets the chip sleep meanwhile
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(controlWait(millis())));
+#endif
+}
@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include "UbidotsEsp32Mqtt.h"
 #include <ezButton.h>
+#include <publishRate.h>
 
 /****************************************
  * Define Constants
@@ -13,7 +14,13 @@ const char *VARIABLE_LABEL = "parking";                            // Put here y
 
 long lastMsg = 0;
 
-const int PUBLISH_FREQUENCY = 5000; // Update rate in milliseconds
+// update rate in milliseconds: a press is published after PUBLISH_MIN_PERIOD, and the
+// period grows up to PUBLISH_MAX_PERIOD while nothing changes
+#define PUBLISH_MIN_PERIOD 500
+#define PUBLISH_MAX_PERIOD 30000
+const PublishRateSettings PUBLISH_RATE = {PUBLISH_MIN_PERIOD, PUBLISH_MAX_PERIOD};
+PublishRate publish_rate(PUBLISH_RATE);
+int sentValue = -1; // the last published buttonValue
 
 // BUTTON SETUP
 #define BUTTON_PIN 19        // port from button to ESP32
@@ -81,17 +88,29 @@ void loop()
     buttonValue = 0;
   }
 
+  // a publish without the broker is a failed one, so the rate backs off until it is back
   if (!ubidots.connected())
   {
+    publish_rate.congested();
     ubidots.reconnect();
   }
   long now = millis();
-  if (now - lastMsg > PUBLISH_FREQUENCY) // triggers the routine every 5 seconds
+  bool changed = buttonValue != sentValue;
+  if (ubidots.connected() && publish_rate.due(now, changed ? 1 : 0))
   {
     lastMsg = now;
-
     ubidots.add(VARIABLE_LABEL, buttonValue); // Insert your variable Labels and the value to be sent
-    ubidots.publish(DEVICE_LABEL);
+    // a failed publish holds the rate back, the value is sent again when it is due
+    if (ubidots.publish(DEVICE_LABEL))
+    {
+      publish_rate.delivered();
+      sentValue = buttonValue;
+    }
+    else
+    {
+      publish_rate.congested();
+    }
+    publish_rate.published(now, changed);
   }
   ubidots.loop();
 }
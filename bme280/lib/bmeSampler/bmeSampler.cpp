@@ -0,0 +1,154 @@
+#include <bmeSampler.h>
+#include <math.h>
+
+// the value the sensor gives for a measurement that was left out
+const int32_t SKIPPED_20BIT = 0x80000;
+const int32_t SKIPPED_16BIT = 0x8000;
+
+void bme280_compensate(const bme280_calib_data &calibration, int32_t t_fine_adjust, const uint8_t burst[8],
+					   float sea_level_hpa, BmeReading &reading)
+{
+	// press_msb, press_lsb, press_xlsb, temp_msb, temp_lsb, temp_xlsb, hum_msb, hum_lsb
+	int32_t adc_P = (int32_t(burst[0]) << 12) | (int32_t(burst[1]) << 4) | (burst[2] >> 4);
+	int32_t adc_T = (int32_t(burst[3]) << 12) | (int32_t(burst[4]) << 4) | (burst[5] >> 4);
+	int32_t adc_H = (int32_t(burst[6]) << 8) | burst[7];
+
+	reading.temperature = NAN;
+	reading.humidity = NAN;
+	reading.pressure = NAN;
+	reading.altitude = NAN;
+	// pressure and humidity are compensated with the temperature
+	if (adc_T == SKIPPED_20BIT)
+	{
+		return;
+	}
+	int32_t var1 = (adc_T / 8 - int32_t(calibration.dig_T1) * 2) * int32_t(calibration.dig_T2) / 2048;
+	int32_t var2 = adc_T / 16 - int32_t(calibration.dig_T1);
+	var2 = var2 * var2 / 4096 * int32_t(calibration.dig_T3) / 16384;
+	int32_t t_fine = var1 + var2 + t_fine_adjust;
+	reading.temperature = float((t_fine * 5 + 128) / 256) / 100;
+
+	if (adc_P != SKIPPED_20BIT)
+	{
+		int64_t p1 = int64_t(t_fine) - 128000;
+		int64_t p2 = p1 * p1 * int64_t(calibration.dig_P6);
+		p2 = p2 + p1 * int64_t(calibration.dig_P5) * 131072;
+		p2 = p2 + int64_t(calibration.dig_P4) * 34359738368LL;
+		p1 = p1 * p1 * int64_t(calibration.dig_P3) / 256 + p1 * int64_t(calibration.dig_P2) * 4096;
+		p1 = (140737488355328LL + p1) * int64_t(calibration.dig_P1) / 8589934592LL;
+		if (p1 != 0)
+		{
+			int64_t p = 1048576 - adc_P;
+			p = (p * 2147483648LL - p2) * 3125 / p1;
+			int64_t p9 = int64_t(calibration.dig_P9) * (p / 8192) * (p / 8192) / 33554432;
+			int64_t p8 = int64_t(calibration.dig_P8) * p / 524288;
+			p = (p + p9 + p8) / 256 + int64_t(calibration.dig_P7) * 16;
+			// Pa in 24.8 fixed point
+			reading.pressure = float(p / 256.0) / 100;
+			reading.altitude = 44330 * (1.0f - powf(reading.pressure / sea_level_hpa, 0.1903f));
+		}
+	}
+
+	if (adc_H != SKIPPED_16BIT)
+	{
+		int32_t h1 = t_fine - 76800;
+		int32_t h2 = adc_H * 16384;
+		int32_t h3 = int32_t(calibration.dig_H4) * 1048576;
+		int32_t h4 = int32_t(calibration.dig_H5) * h1;
+		int32_t h5 = (h2 - h3 - h4 + 16384) / 32768;
+		h2 = h1 * int32_t(calibration.dig_H6) / 1024;
+		h3 = h1 * int32_t(calibration.dig_H3) / 2048;
+		h4 = h2 * (h3 + 32768) / 1024 + 2097152;
+		h2 = (h4 * int32_t(calibration.dig_H2) + 8192) / 16384;
+		h3 = h5 * h2;
+		h4 = (h3 / 32768) * (h3 / 32768) / 128;
+		h5 = h3 - h4 * int32_t(calibration.dig_H1) / 16;
+		h5 = h5 < 0 ? 0 : h5;
+		h5 = h5 > 419430400 ? 419430400 : h5;
+		reading.humidity = float(uint32_t(h5 / 4096)) / 1024;
+	}
+}
+
+// samples of an oversampling setting, 0 when it is left out
+static unsigned long oversampling(Adafruit_BME280::sensor_sampling sampling)
+{
+	return sampling == Adafruit_BME280::SAMPLING_NONE ? 0 : 1UL << (int(sampling) - 1);
+}
+
+unsigned long bme280_measure_time(const BmeSettings &settings)
+{
+	// appendix B of the datasheet, t_measure,max
+	unsigned long time = 1250 + 2300 * oversampling(settings.temperature);
+	if (settings.pressure != Adafruit_BME280::SAMPLING_NONE)
+	{
+		time += 2300 * oversampling(settings.pressure) + 575;
+	}
+	if (settings.humidity != Adafruit_BME280::SAMPLING_NONE)
+	{
+		time += 2300 * oversampling(settings.humidity) + 575;
+	}
+	return time;
+}
+
+BmeSampler::BmeSampler()
+	: settings(BME_WEATHER), sea_level_hpa(1013.25f), measure_time(0), started(0), measuring(false), samples(0),
+	  failures(0)
+{
+	last.temperature = NAN;
+	last.humidity = NAN;
+	last.pressure = NAN;
+	last.altitude = NAN;
+}
+
+bool BmeSampler::begin(uint8_t address, const BmeSettings &settings, float sea_level_hpa)
+{
+	this->sea_level_hpa = sea_level_hpa;
+	if (!Adafruit_BME280::begin(address))
+	{
+		return false;
+	}
+	set_settings(settings);
+	return true;
+}
+
+void BmeSampler::set_settings(const BmeSettings &settings)
+{
+	this->settings = settings;
+	measure_time = bme280_measure_time(settings);
+	setSampling(MODE_FORCED, settings.temperature, settings.pressure, settings.humidity, settings.filter);
+	// writing the forced mode starts a measurement, it is the first reading
+	measuring = true;
+	started = micros();
+}
+
+bool BmeSampler::start(unsigned long now_us)
+{
+	if (measuring)
+	{
+		return false;
+	}
+	// ctrl_meas with the forced mode, the sensor goes back to sleep after it
+	write8(BME280_REGISTER_CONTROL, _measReg.get());
+	measuring = true;
+	started = now_us;
+	return true;
+}
+
+bool BmeSampler::poll(unsigned long now_us)
+{
+	if (!measuring || now_us - started < measure_time)
+	{
+		return false;
+	}
+	measuring = false;
+	uint8_t reg = BME280_REGISTER_PRESSUREDATA;
+	uint8_t burst[8];
+	if (i2c_dev == NULL || !i2c_dev->write_then_read(&reg, 1, burst, sizeof(burst)))
+	{
+		failures++;
+		return false;
+	}
+	bme280_compensate(_bme280_calib, t_fine_adjust, burst, sea_level_hpa, last);
+	samples++;
+	return true;
+}
@@ -0,0 +1,88 @@
+#ifndef bmeSampler_h
+#define bmeSampler_h
+
+#include <Arduino.h>
+#include <Adafruit_BME280.h>
+
+/*
+Reads the BME280 in forced mode: the sensor sleeps between samples, start()
+wakes it for one measurement, and when it is done poll() reads pressure,
+temperature and humidity in one burst of 8 bytes and compensates them all
+from that. readTemperature(), readHumidity(), readPressure() and
+readAltitude() of the library each go to the bus on their own, the last
+three read the temperature again first.
+
+The reading is kept until the next one, everything that needs a value
+takes it from reading() instead of the sensor. The loop is not held up
+while the sensor measures, poll() only reads once the longest measurement
+time of the datasheet has passed.
+
+More oversampling is less noise for more time and current per sample,
+the IIR filter smooths the values over the samples at no cost. For a
+sample every few seconds the datasheet suggests 1x on all three and the
+filter off ("weather monitoring").
+*/
+
+struct BmeSettings
+{
+	Adafruit_BME280::sensor_sampling temperature;
+	Adafruit_BME280::sensor_sampling pressure;
+	Adafruit_BME280::sensor_sampling humidity; // SAMPLING_NONE leaves a value out, it is NAN then
+	Adafruit_BME280::sensor_filter filter;
+};
+
+const BmeSettings BME_WEATHER = {Adafruit_BME280::SAMPLING_X1, Adafruit_BME280::SAMPLING_X1,
+								 Adafruit_BME280::SAMPLING_X1, Adafruit_BME280::FILTER_OFF};
+
+struct BmeReading
+{
+	float temperature; // *C
+	float humidity;    // %
+	float pressure;    // hPa
+	float altitude;    // m, from the pressure and the sea level pressure
+};
+
+// the compensation of the datasheet, like the library, for the 8 bytes from 0xF7
+void bme280_compensate(const bme280_calib_data &calibration, int32_t t_fine_adjust, const uint8_t burst[8],
+					   float sea_level_hpa, BmeReading &reading);
+
+// the longest time of one forced measurement with the settings, in us
+unsigned long bme280_measure_time(const BmeSettings &settings);
+
+// the library class, for its calibration and registers
+class BmeSampler : public Adafruit_BME280
+{
+private:
+	BmeSettings settings;
+	float sea_level_hpa;
+	BmeReading last;
+	unsigned long measure_time; // us
+	unsigned long started;      // micros() of start()
+	bool measuring;
+	unsigned long samples;
+	unsigned long failures;
+
+public:
+	BmeSampler();
+
+	// finds the sensor on I2C and puts it in forced mode, false if it is not there
+	bool begin(uint8_t address, const BmeSettings &settings, float sea_level_hpa);
+
+	// new oversampling and filter, from the next sample
+	void set_settings(const BmeSettings &settings);
+	const BmeSettings &get_settings() const { return settings; }
+
+	// one measurement, the sensor sleeps again after it. false while the last one is not read
+	bool start(unsigned long now_us);
+
+	// true when a new reading is there
+	bool poll(unsigned long now_us);
+
+	bool is_measuring() const { return measuring; }
+	const BmeReading &reading() const { return last; }
+	unsigned long get_samples() const { return samples; }
+	// bursts that could not be read
+	unsigned long get_failures() const { return failures; }
+};
+
+#endif
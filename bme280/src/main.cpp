@@ -1,75 +1,200 @@
 #include <Wire.h>
 #include <Adafruit_Sensor.h>
 #include <Adafruit_BME280.h>
+#include <bmeSampler.h>
 #include <WiFi.h>
 #include <PubSubClient.h>
+#include <connection.h>
+#include <commandRouter.h>
+#include <publishRate.h>
+#include <storeForward.h>
+#include <flashLog.h>
+#include <metrics.h>
+#include <deviceId.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#include <sys/time.h>
 
-// BME280 setup
+// BME280 setup, in forced mode: it sleeps between the samples and all values of a
+// sample are read at once. more oversampling is less noise for more time and current
 #define SEALEVELPRESSURE_HPA (1013.25)
-Adafruit_BME280 bme;
+const BmeSettings BME_SETTINGS = {Adafruit_BME280::SAMPLING_X1, Adafruit_BME280::SAMPLING_X1,
+                                  Adafruit_BME280::SAMPLING_X1, Adafruit_BME280::FILTER_OFF};
+BmeSampler bme;
 
 // Wifi name (ssid) and password
 const char *ssid = "ssid";
 const char *password = "password";
 
+// the sensor is read every SAMPLE_TIME ms, and published more often while it changes:
+// between PUBLISH_MIN_PERIOD and PUBLISH_MAX_PERIOD ms. esp32/input/bme280/telemetry/min
+// and esp32/input/bme280/telemetry/max set them while running
+#define SAMPLE_TIME 250
+#define PUBLISH_MIN_PERIOD 1000
+#define PUBLISH_MAX_PERIOD 30000
+const PublishRateSettings PUBLISH_RATE = {PUBLISH_MIN_PERIOD, PUBLISH_MAX_PERIOD};
+PublishRate publish_rate(PUBLISH_RATE);
+
+// how far a value may move before it is news to the subscribers
+#define TEMPERATURE_DEADBAND 0.1 // *C
+#define HUMIDITY_DEADBAND 0.5    // %
+#define PRESSURE_DEADBAND 0.1    // hPa
+
+// the last published values, and the number of publishes that failed
+float sent_temperature = 0;
+float sent_humidity = 0;
+float sent_pressure = 0;
+unsigned long failed_publishes = 0;
+unsigned long seen_failures = 0;
+
+// the readings that could not be published while the broker was gone, sent on their
+// history topics when it is back
+StoreForward<16, 64> store(FLASH_LOG);
+
+// ms of the RTC clock, which goes on over a reset, for the times of the kept readings like on the testpanel
+uint32_t rtcMillis()
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return uint32_t(uint64_t(now.tv_sec) * 1000 + now.tv_usec / 1000);
+}
+
+// the RTC clock starts again at a power-on or a brownout, the times of the kept readings from before it
+// mean nothing then. set in setup()
+bool rtc_kept = false;
+
+// ms from the first publish of a kept reading to now
+uint32_t historyAge(uint32_t sequence, uint32_t time)
+{
+  if (!rtc_kept && !store.from_this_boot(sequence))
+  {
+    return HISTORY_AGE_UNKNOWN;
+  }
+  return rtcMillis() - time;
+}
+
+// the hot paths, in us, summed up on esp32/output/metrics every METRICS_TIME ms
+#define METRICS_TIME 10000
+#define METRICS_SIZE 448 // bytes of the summary
+LogHistogram loop_us;
+LogHistogram sample_us; // reading a sample from the sensor
+LogHistogram publish_us;
+LogHistogram mqtt_loop_us;
+unsigned long reconnects = 0;
+MetricsReport metrics("bme280");
+unsigned long last_metrics = 0;
+
 // MQTT Broker IP-address
 const char *mqtt_server = "ip"; // home
 const int mqtt_port = 1883;
 
+// every topic of the node is under MQTT_SITE/<MAC in hex>/, like the testpanel. the
+// topics in the comments are the part after that
+#define MQTT_SITE "site"
+DeviceId device;
+
 // declare the mqtt client
 WiFiClient espClient;
 PubSubClient client(espClient);
-long lastMsg = 0;
+long lastSample = 0;
 char msg[50];
 int value = 0;
 
-// function to connect to wifi
-void setup_wifi(int time_reconnect)
+// starts connecting to wifi, the connection manager waits for it
+void wifi_begin()
 {
-  delay(10);
-  // We start by connecting to a WiFi network
-  Serial.println();
   Serial.print("Connecting to ");
   Serial.println(ssid);
-
   WiFi.begin(ssid, password);
+}
+
+void wifi_disconnect()
+{
+  WiFi.disconnect();
+}
+
+bool wifi_connected()
+{
+  return WiFi.status() == WL_CONNECTED;
+}
 
-  while (WiFi.status() != WL_CONNECTED) // wait for connection
+// one attempt to connect to mqtt
+bool mqtt_connect()
+{
+  Serial.print("Attempting MQTT connection...");
+  if (!client.connect(device.get_client_id()))
   {
-    long now = millis();
-    if ((now - lastMsg > 500)) // every 500 ms
-    {
-      lastMsg = now;
-      Serial.print(".");
-    }
-    if ((now - time_reconnect > 5000)) // every 5 s
-    {
-      // restarer esp etter 5 sekunder for raskere oppkobling til wifi
-      Serial.print("Restarter esp32");
-      time_reconnect = now;
-      ESP.restart();
-    }
+    Serial.print("failed, rc=");
+    Serial.println(client.state());
+    return false;
+  }
+  Serial.println("connected");
+  // the publish periods can be set while running
+  char subscription[sizeof(INPUT_TOPIC("bme280/telemetry/+")) + DEVICE_PREFIX_SIZE];
+  if (device.topic(INPUT_TOPIC("bme280/telemetry/+"), subscription, sizeof(subscription)))
+  {
+    client.subscribe(subscription);
+  }
+  return true;
+}
+
+// publishes on the topic of this node
+bool devicePublish(const char *topic, const uint8_t *payload, size_t length)
+{
+  char full[STORE_TOPIC_SIZE + 8 + DEVICE_PREFIX_SIZE];
+  return device.topic(topic, full, sizeof(full)) && client.publish(full, payload, length);
+}
+
+bool mqtt_connected()
+{
+  return client.connected();
+}
+
+// keeps wifi and mqtt connected from loop() without blocking it
+const LinkDriver link_driver = {wifi_begin, wifi_disconnect, wifi_connected, mqtt_connect, mqtt_connected};
+ConnectionManager link(link_driver);
+LinkState link_state = LINK_WIFI_JOINING;
+
+// the longest loop since the last report, printed every LOOP_REPORT_TIME ms
+LoopTimer loop_timer;
+#define LOOP_REPORT_TIME 10000
+unsigned long last_loop_report = 0;
+
+// esp32/input/bme280/telemetry/min|max <ms>, the shortest and the longest publish period
+void rateCommand(const RouteMatch &match, const TextView &payload)
+{
+  long period;
+  if (!payload.to_long(period) || period < 0)
+  {
+    return;
+  }
+  PublishRateSettings limits = publish_rate.get_limits();
+  if (match.capture[0].equals("min"))
+  {
+    limits.min_period = (unsigned long)period;
   }
-  Serial.println("");
-  Serial.println("WiFi connected");
-  Serial.println("IP address: ");
-  Serial.println(WiFi.localIP());
+  else if (match.capture[0].equals("max"))
+  {
+    limits.max_period = (unsigned long)period;
+  }
+  publish_rate.set_limits(limits.min_period, limits.max_period);
+  Serial.printf("publish: limits %lu-%lu ms\n", publish_rate.get_limits().min_period,
+                publish_rate.get_limits().max_period);
 }
 
+const CommandRoute COMMAND_ROUTES[] = {
+    {INPUT_TOPIC("bme280/telemetry/+"), rateCommand},
+};
+
+CommandRouter router(COMMAND_ROUTES, sizeof(COMMAND_ROUTES) / sizeof(COMMAND_ROUTES[0]));
+
 // Listens for messages on subscribed topics
 void callback(char *topic, byte *message, unsigned int length)
 {
-  // prints the topic and the message
-  Serial.print("Message arrived on topic: ");
-  Serial.print(topic);
-  Serial.print(". Message: ");
-  String dataMessage;
-
-  // makes a string from the message
-  for (int i = 0; i < length; i++)
+  const char *local = device.local(topic);
+  if (local != NULL)
   {
-    Serial.print((char)message[i]);
-    dataMessage += (char)message[i];
+    router.route(local, message, length);
   }
 }
 
@@ -77,51 +202,92 @@ void setup()
 {
   Serial.begin(9600); // start serial for output
 
-  if (!bme.begin(0x76)) // start BME280
+  if (!bme.begin(0x76, BME_SETTINGS, SEALEVELPRESSURE_HPA)) // start BME280
   {
     Serial.println("Could not find a valid BME280 sensor, check wiring!");
     while (1)
       ;
   }
 
-  // starter wifi:
-  setup_wifi(0);
+  // starter wifi, the connection is made in loop()
+  WiFi.mode(WIFI_STA);
   client.setServer(mqtt_server, mqtt_port);
   client.setCallback(callback);
+  // a broker that does not answer holds up the loop for at most this many seconds
+  client.setSocketTimeout(2);
+  // room for the metrics summary, the topic with the device and the MQTT header
+  client.setBufferSize(METRICS_SIZE + DEVICE_PREFIX_SIZE + 64);
+  if (!device.begin(MQTT_SITE, "bme280", ESP.getEfuseMac()))
+  {
+    Serial.println("MQTT_SITE is not one level of a topic, nothing is published");
+  }
+  Serial.printf("mqtt: %s on %s\n", device.get_client_id(), device.get_prefix());
+  link.begin(millis(), esp_random());
+  // the history that was not sent before a reset
+  if (!flash_log_begin())
+  {
+    Serial.println("store: no file system, the history is only kept in RAM");
+  }
+  store.begin();
+  esp_reset_reason_t reset = esp_reset_reason();
+  rtc_kept = reset != ESP_RST_POWERON && reset != ESP_RST_BROWNOUT;
+
+  metrics.histogram("loop_us", loop_us);
+  metrics.histogram("sample_us", sample_us);
+  metrics.histogram("publish_us", publish_us);
+  metrics.histogram("mqtt_loop_us", mqtt_loop_us);
+  metrics.counter("publish_failed", []() { return uint32_t(failed_publishes); });
+  metrics.counter("reconnects", []() { return uint32_t(reconnects); });
+  metrics.counter("sample_failed", []() { return uint32_t(bme.get_failures()); });
+  metrics.counter("stored", []() { return uint32_t(store.get_stored()); });
+  metrics.gauge("heap", []() { return uint32_t(heap_caps_get_free_size(MALLOC_CAP_8BIT)); });
+  metrics.gauge("heap_block", []() { return uint32_t(heap_caps_get_largest_free_block(MALLOC_CAP_8BIT)); });
+  metrics.gauge("heap_min", []() { return uint32_t(heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT)); });
 }
 
-// MQTT reconnect function
-void reconnect()
+// prints the link state when it changes and the loop times every LOOP_REPORT_TIME ms
+void linkReport(unsigned long now)
 {
-  // Loop until we're reconnected
-  while (!client.connected())
+  if (link.get_state() != link_state)
   {
-    Serial.print("Attempting MQTT connection...");
-    // Attempt to connect
-    if (client.connect("ESP8266Client"))
+    link_state = link.get_state();
+    Serial.print("link: ");
+    Serial.println(link_state_name(link_state));
+    if (link_state == LINK_CONNECTED)
     {
-      Serial.println("connected");
-      // Subscribe
-      // client.subscribe("esp32/input");
-    }
-    else
-    {
-      Serial.print("failed, rc=");
-      Serial.print(client.state());
-      Serial.println(" try again in 5 seconds");
-      // Wait 5 seconds before retrying
-      delay(5000);
+      reconnects++;
+      Serial.print("IP address: ");
+      Serial.println(WiFi.localIP());
     }
   }
+  if (now - last_loop_report >= LOOP_REPORT_TIME)
+  {
+    last_loop_report = now;
+    Serial.printf("loop: longest %lu us, mean %lu us, %lu loops, link %s\n", loop_timer.longest(), loop_timer.mean(),
+                  loop_timer.loops(), link_state_name(link_state));
+    Serial.printf("publish: period %lu ms, floor %lu ms, %lu failed\n", publish_rate.get_period(),
+                  publish_rate.get_floor(), failed_publishes);
+    Serial.printf("store: %lu kept, %lu sent, %lu dropped, %d in RAM, %d segments\n", store.get_stored(),
+                  store.get_forwarded(), store.get_dropped(), store.in_ram(), store.segments_used());
+    loop_timer.reset();
+  }
 }
 
-void printMQTT(String topic, String msg, String owner)
+// returns false if the message could not be sent, it is kept in the store then
+bool printMQTT(String topic, String msg, String owner)
 {
   bool debug = false;
   // print the topic and message to the serial monitor
   String mqtt_msg = "{\"owner\": \"" + owner + "\", \"message\": " + msg + "}";
   String mqtt_topic = "esp32/output/" + topic;
-  client.publish(mqtt_topic.c_str(), mqtt_msg.c_str());
+  unsigned long start = micros();
+  bool sent = client.connected() &&
+              devicePublish(mqtt_topic.c_str(), (const uint8_t *)mqtt_msg.c_str(), mqtt_msg.length());
+  publish_us.add(micros() - start);
+  if (!sent)
+  {
+    store.store(rtcMillis(), mqtt_topic.c_str(), (const uint8_t *)mqtt_msg.c_str(), mqtt_msg.length());
+  }
   if (debug)
   {
     Serial.print("Topic: ");
@@ -129,44 +295,127 @@ void printMQTT(String topic, String msg, String owner)
     Serial.print("Message: ");
     Serial.println(mqtt_msg);
   }
+  return sent;
 }
-void loop()
+
+// sends a kept reading on its history topic, with its sequence number and time
+bool forwardMQTT(const char *topic, const uint8_t *payload, size_t length, uint32_t sequence, uint32_t time)
 {
-  // if mqtt is not connected, reconnect
-  if (!client.connected())
+  char history[STORE_TOPIC_SIZE + 8];
+  uint8_t buffer[64 + HISTORY_PAYLOAD_EXTRA];
+  size_t size = history_payload(payload, length, sequence, time, historyAge(sequence, time), buffer,
+                                sizeof(buffer));
+  if (size == 0 || !history_topic(topic, history, sizeof(history)))
   {
-    Serial.print("disconnect mqtt");
-    reconnect();
+    return true; // it never fits, so it is dropped and not tried again
   }
+  return devicePublish(history, buffer, size);
+}
+
+// the biggest move since the last publish, in deadbands
+float sensorChange(float temperature, float humidity, float pressure)
+{
+  float change = fabsf(temperature - sent_temperature) / TEMPERATURE_DEADBAND;
+  change = fmaxf(change, fabsf(humidity - sent_humidity) / HUMIDITY_DEADBAND);
+  return fmaxf(change, fabsf(pressure - sent_pressure) / PRESSURE_DEADBAND);
+}
+void loop()
+{
+  unsigned long loop_start = micros();
+  loop_timer.start(loop_start);
+
+  // one step of connecting, returns at once while wifi or mqtt is down
+  link.poll(millis());
 
   long now = millis();
 
-  if ((now - lastMsg > 1000)) // every second
+  // a measurement every SAMPLE_TIME ms, it is read in a later loop when the sensor is done
+  if (now - lastSample >= SAMPLE_TIME && bme.start(micros()))
+  {
+    lastSample = now;
+  }
+  unsigned long sample_start = micros();
+  if (bme.poll(sample_start))
   {
-    // send data to mqtt
-    printMQTT("temperature", String(bme.readTemperature()), "ESP32");
-    printMQTT("humidity", String(bme.readHumidity()), "ESP32");
-    printMQTT("pressure", String(bme.readPressure() / 100.0F), "ESP32");
-    printMQTT("altitude", String(bme.readAltitude(SEALEVELPRESSURE_HPA)), "ESP32");
+    sample_us.add(micros() - sample_start);
+    const BmeReading &reading = bme.reading();
+    float change = sensorChange(reading.temperature, reading.humidity, reading.pressure);
+    if (publish_rate.due(now, change))
+    {
+      // failed publishes, or no link at all, hold the rate back
+      if (failed_publishes != seen_failures)
+      {
+        publish_rate.congested();
+      }
+      else
+      {
+        publish_rate.delivered();
+      }
+      seen_failures = failed_publishes;
+      publish_rate.published(now, change >= 1);
+
+      // send data to mqtt
+      bool sent = printMQTT("temperature", String(reading.temperature), "ESP32");
+      sent &= printMQTT("humidity", String(reading.humidity), "ESP32");
+      sent &= printMQTT("pressure", String(reading.pressure), "ESP32");
+      sent &= printMQTT("altitude", String(reading.altitude), "ESP32");
+      if (sent)
+      {
+        sent_temperature = reading.temperature;
+        sent_humidity = reading.humidity;
+        sent_pressure = reading.pressure;
+      }
+      else
+      {
+        failed_publishes++;
+      }
 
-    // print the data to the serial monitor
-    Serial.print("Temperature = ");
-    Serial.print(bme.readTemperature());
-    Serial.println("*C");
+      // print the data to the serial monitor
+      Serial.print("Temperature = ");
+      Serial.print(reading.temperature);
+      Serial.println("*C");
 
-    Serial.print("Pressure = ");
-    Serial.print(bme.readPressure() / 100.0F);
-    Serial.println("hPa");
+      Serial.print("Pressure = ");
+      Serial.print(reading.pressure);
+      Serial.println("hPa");
 
-    Serial.print("Approx. Altitude = ");
-    Serial.print(bme.readAltitude(SEALEVELPRESSURE_HPA));
-    Serial.println("m");
+      Serial.print("Approx. Altitude = ");
+      Serial.print(reading.altitude);
+      Serial.println("m");
 
-    Serial.print("Humidity = ");
-    Serial.print(bme.readHumidity());
-    Serial.println("%");
+      Serial.print("Humidity = ");
+      Serial.print(reading.humidity);
+      Serial.println("%");
 
-    Serial.println();
+      Serial.println();
+    }
   }
+  unsigned long mqtt_start = micros();
   client.loop(); // listen for incoming messages
+  mqtt_loop_us.add(micros() - mqtt_start);
+
+  // the history goes out a batch at a time, between the live readings
+  if (link.connected())
+  {
+    store.drain(millis(), forwardMQTT);
+  }
+
+  // the summary of the hot paths, the counters and the heap
+  if (millis() - last_metrics >= METRICS_TIME)
+  {
+    last_metrics = millis();
+    char payload[METRICS_SIZE];
+    size_t length = metrics.write(last_metrics, payload, sizeof(payload));
+    // a summary is only worth something for its own interval, so it is not kept for later like the readings
+    if (length > 0 && client.connected())
+    {
+      devicePublish("esp32/output/metrics", (const uint8_t *)payload, length);
+    }
+  }
+
+  unsigned long loop_end = micros();
+  loop_timer.stop(loop_end);
+  loop_us.add(loop_end - loop_start);
+  // after the timer, so the report is not counted in the loop times
+  linkReport(millis());
 }